@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+#include "loader.h"
+#include "save.h"
+
+#define BENCH_MB 512   // size of the file made when none is given
+#define BENCH_LINE "a line of a log file as big as most of them, with a timestamp and some words in it\n"
+
+// a new file of BENCH_MB of lines under $TMPDIR, its path or NULL
+static char *bench_make(void) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+    char *path = malloc(strlen(dir) + 20);
+    if (!path) return NULL;
+    sprintf(path, "%s/bench_io.XXXXXX", dir);
+    int fd = mkstemp(path);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!f) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+            unlink(path);
+        }
+        free(path);
+        return NULL;
+    }
+    size_t line = strlen(BENCH_LINE);
+    for (size_t done = 0; done < (size_t)BENCH_MB << 20; done += line) fwrite(BENCH_LINE, 1, line, f);
+    int ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    fclose(f);
+    if (!ok) {
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+
+// drops the file from the page cache, it is synced so its pages are clean and go. Every load reads the drive
+static void bench_uncache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+static double bench_seconds(Uint64 since) {
+    return (double)(SDL_GetPerformanceCounter() - since) / (double)SDL_GetPerformanceFrequency();
+}
+
+
+// loads path and saves it to out the way the editor does, with io_uring or with pread and pwritev.
+// 0 and the seconds each took, -1 when either failed
+static int bench_run(const char *path, const char *out, double *load_s, double *save_s, size_t *size) {
+    loader load;
+    loader_init(&load);
+    bench_uncache(path);
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (loader_start(&load, path) != 0) return -1;
+    int state;
+    while ((state = loader_step(&load)) == 1) SDL_Delay(1);   // a frame of the editor, the thread reads on meanwhile
+    if (state != 0) {
+        loader_cancel(&load);
+        return -1;
+    }
+    *load_s = bench_seconds(start);
+    *size = load.done;
+    textbuffer buf = load.buf;
+    text_encoding enc = load.enc;
+    loader_finish(&load);
+    save_base base;
+    save_base_init(&base);   // nothing on disk to reuse, every byte is written
+    start = SDL_GetPerformanceCounter();
+    save_job *job = save_start(out, &buf, &base, &enc);
+    int result = -1;
+    if (job) {
+        save_wait(job);
+        result = job->result;
+        save_free(job);
+    }
+    *save_s = bench_seconds(start);
+    save_base_free(&base);
+    buffer_free(&buf);
+    unlink(out);
+    return result;
+}
+
+
+// bench/io [file]: load and save throughput of both backends. Without a file one is made in $TMPDIR for the
+// run and removed after it
+int main(int argc, char *argv[]) {
+    if (SDL_Init(SDL_INIT_EVENTS) != 0) {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    char *made = argc > 1 ? NULL : bench_make();
+    const char *path = argc > 1 ? argv[1] : made;
+    if (!path) return 1;
+    char *out = malloc(strlen(path) + 8);
+    if (!out) {
+        if (made) unlink(made);
+        free(made);
+        return 1;
+    }
+    sprintf(out, "%s.saved", path);
+    uring probe;
+    if (uring_init(&probe) != 0) printf("no io_uring on this kernel, both rows are the fallback\n");
+    uring_free(&probe);
+    const char *names[] = {"io_uring", "pread/pwritev"};
+    int failed = 0;
+    for (int fallback = 0; fallback < 2; ++fallback) {
+        if (fallback) setenv("BEDITOR_NO_URING", "1", 1);
+        double load_s, save_s;
+        size_t size = 0;
+        if (bench_run(path, out, &load_s, &save_s, &size) != 0) {
+            printf("%-14s failed\n", names[fallback]);
+            failed = 1;
+            continue;
+        }
+        double mb = (double)size / (1 << 20);
+        printf("%-14s %8.0f MB  load %8.1f MB/s  save %8.1f MB/s\n", names[fallback], mb, mb / load_s,
+               mb / save_s);
+    }
+    unlink(out);
+    free(out);
+    if (made) unlink(made);
+    free(made);
+    SDL_Quit();
+    return failed;
+}
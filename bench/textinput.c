@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "beditor.h"
+#include "minimap.h"
+#include "macro.h"
+
+#define BENCH_EVENTS 100000   // synthetic SDL_TEXTINPUT events per run
+#define BENCH_BURST 1000      // events queued before each frame, like autorepeat or xdotool piling up
+
+// from beditor.c
+void type_text(sdltext *txt, minimap *map, const char *text, size_t len);
+void flush_text_input(sdltext *txt, minimap *map, textinput *pending);
+void collect_text_input(sdltext *txt, minimap *map, textinput *pending, macro *keys, const char *text);
+
+// the kinds of text an event brings, single keys, utf-8 and a whole ime commit
+static const char *bench_texts[] = {"a", "b", " ", "\xc3\xa9", "\xe2\x82\xac", "an ime commit of thirty bytes!"};
+
+
+static void bench_text_init(sdltext *txt) {
+    memset(txt, 0, sizeof(*txt));
+    buffer_init(&txt->buf);
+    undo_init(&txt->undo);
+    encoding_init(&txt->encoding);
+    txt->line_break = "\n";
+    txt->preferred_x = -1;
+    txt->MAX_VISIBLE_LINES = 30;
+}
+
+
+// pushes BENCH_EVENTS text events in bursts and takes them in like the event loop does. per_event applies
+// every event on its own, the way typing went before bursts were collected. Returns the seconds it took
+static double bench_run(int per_event, size_t *typed, size_t *expected) {
+    sdltext txt;
+    minimap map;
+    macro keys;
+    textinput pending;
+    bench_text_init(&txt);
+    minimap_init(&map);
+    macro_init(&keys);
+    pending.len = 0;
+    *expected = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int sent = 0; sent < BENCH_EVENTS;) {
+        for (int i = 0; i < BENCH_BURST && sent < BENCH_EVENTS; ++i, ++sent) {
+            SDL_Event e;
+            memset(&e, 0, sizeof(e));
+            e.type = SDL_TEXTINPUT;
+            strcpy(e.text.text, bench_texts[sent % (sizeof(bench_texts) / sizeof(bench_texts[0]))]);
+            *expected += strlen(e.text.text);
+            SDL_PushEvent(&e);
+        }
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            if (e.type != SDL_TEXTINPUT) continue;
+            if (per_event) {
+                type_text(&txt, &map, e.text.text, strlen(e.text.text));
+            } else {
+                collect_text_input(&txt, &map, &pending, &keys, e.text.text);
+            }
+        }
+        flush_text_input(&txt, &map, &pending);   // once per frame
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+    *typed = buffer_length(&txt.buf);
+    undo_free(&txt.undo);
+    buffer_free(&txt.buf);
+    macro_free(&keys);
+    minimap_free(&map);
+    return seconds;
+}
+
+
+int main(void) {
+    if (SDL_Init(SDL_INIT_EVENTS) != 0) {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        return 1;
+    }
+    const char *names[] = {"collected per frame", "one edit per event"};
+    int failed = 0;
+    for (int per_event = 0; per_event < 2; ++per_event) {
+        size_t typed, expected;
+        double seconds = bench_run(per_event, &typed, &expected);
+        printf("%-20s %d events in %8.2f ms, %10.0f events/s\n", names[per_event], BENCH_EVENTS,
+               seconds * 1000.0, BENCH_EVENTS / seconds);
+        if (typed != expected) {
+            printf("%-20s typed %zu bytes, expected %zu\n", names[per_event], typed, expected);
+            failed = 1;
+        }
+    }
+    SDL_Quit();
+    return failed;
+}
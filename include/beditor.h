@@ -0,0 +1,78 @@
+#ifndef BEDITOR_H
+#define BEDITOR_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include "buffer.h"
+#include "undo.h"
+#include "encoding.h"
+
+#define MAX_TEXT_LEN 1024   // bytes of a line that get measured and rendered, the rest is past the right edge
+#define WINDOW_WIDTH_INITIAL 640
+#define WINDOW_HEIGHT_INITIAL 480
+
+typedef struct{
+SDL_Window *window;
+SDL_Renderer *renderer;
+int window_width;
+int window_height;
+int current_render_y;
+char status[256];     // status bar text, the bar is hidden while it is empty
+int status_progress;  // permille of the status bar filled in
+}sdlwindow;
+
+// selected range of the buffer, head follows the cursor and it is empty when both are equal
+typedef struct{
+size_t anchor;
+size_t head;
+}selection;
+
+typedef struct{
+TTF_Font *font;
+SDL_Color color;
+textbuffer buf;
+undolog undo;
+char *path;   // file the document was opened from or saved to, NULL for a new one
+text_encoding encoding;   // of that file, the buffer holds utf-8 and a save writes it back the way it was
+const char *line_break;   // what enter inserts, "\r\n" when most lines of the file end in it
+int cursor_location_y;
+int cursor_location_x;
+selection sel;
+selection *cursors;    // extra cursors next to the main one, sorted by offset and never overlapping
+size_t cursor_count;
+size_t cursor_cap;
+int preferred_x;          // pixel column up and down aim for, -1 or stale once the cursor left preferred_at
+size_t preferred_at;
+int first_visible_line;
+int MAX_VISIBLE_LINES;
+int text_w;
+int text_h;
+int line_height;
+int glyph_advance[128];   // pixel advance of every ascii byte, other characters are measured by code point
+}sdltext;
+
+// alt + drag block selection, rows are rebuilt once per frame however many motion events come in
+typedef struct{
+int active;
+int dirty;
+int anchor_line;
+int anchor_x;   // pixels from the left edge of the text
+int line;
+int x;
+}blockdrag;
+
+// text from SDL_TEXTINPUT events waiting to be inserted as one edit
+typedef struct{
+char text[MAX_TEXT_LEN];
+size_t len;
+}textinput;
+
+// maps a y pixel inside an area starting at top to a line index, pixels_per/lines_per is the row height
+int line_from_y(int y, int top, int first_line, int lines_per, int pixels_per, int line_count);
+size_t cursor_offset(sdltext *txt);
+void set_cursor_offset(sdltext *txt, size_t offset);
+int column_at_x(sdltext *txt, const char *line, int x);
+int text_insert(sdltext *txt, size_t offset, const char *text, size_t len);
+int text_delete(sdltext *txt, size_t offset, size_t len);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+#define BUFFER_CHUNK_SIZE (1 << 20)   // size of the chunks typed text is appended to
+#define BUFFER_SEARCH_BLOCK (1 << 16) // bytes scanned per read while searching
+#define BUFFER_NOT_FOUND ((size_t)-1)
+#define BUFFER_NUL_SHOWN '\x1A'     // what a NUL byte is in a line copy, drawn like other control bytes
+
+// append-only storage, bytes never move or change once written so pieces can point into it
+typedef struct{
+char *data;
+size_t len;
+size_t cap;
+size_t *newlines;      // sorted offsets of every '\n' in data
+size_t newline_count;
+size_t newline_cap;
+int external;          // data belongs to someone else (a mapped file), never freed or appended to
+}bufchunk;
+
+// a span of one chunk that is part of the document
+typedef struct{
+int chunk;
+size_t start;
+size_t len;
+size_t newlines;
+}piece;
+
+// piece table with a line index, the document is the pieces read in order
+typedef struct{
+bufchunk *chunks;
+int chunk_count;
+int chunk_cap;
+int append_chunk;
+piece *pieces;
+size_t piece_count;
+size_t piece_cap;
+size_t *piece_offset;  // document offset of piece i, piece_count + 1 entries
+size_t *piece_line;    // newlines before piece i, piece_count + 1 entries
+size_t index_valid;    // entries up to here are current, edits lower it and lookups rebuild the rest
+size_t length;
+size_t newline_count;
+size_t version;        // bumped by every change, tells others whether the document is still what they saw
+}textbuffer;
+
+// one replacement of a batch, offsets are in the document as it was before the batch
+typedef struct{
+size_t offset;
+size_t len;            // bytes removed at offset
+const piece *ins;      // stored spans that take their place
+size_t ins_count;
+}bufedit;
+
+void buffer_init(textbuffer *buf);
+void buffer_free(textbuffer *buf);
+int buffer_add_chunk(textbuffer *buf, const char *data, size_t len);
+int buffer_take_chunk(textbuffer *buf, textbuffer *from, int chunk);
+piece buffer_chunk_piece(textbuffer *buf, int chunk, size_t start, size_t len);
+int buffer_store(textbuffer *buf, const char *text, size_t len, piece *out);
+char *buffer_reserve(textbuffer *buf, size_t len, int *chunk);
+int buffer_commit(textbuffer *buf, int chunk, size_t len);
+int buffer_insert(textbuffer *buf, size_t offset, const char *text, size_t len);
+int buffer_insert_pieces(textbuffer *buf, size_t offset, const piece *p, size_t n);
+size_t buffer_copy_pieces(textbuffer *buf, size_t offset, size_t len, piece **out);
+int buffer_delete(textbuffer *buf, size_t offset, size_t len);
+int buffer_apply(textbuffer *buf, const bufedit *edits, size_t n);
+size_t buffer_search(textbuffer *buf, size_t from, const char *needle, size_t len);
+size_t buffer_length(textbuffer *buf);
+size_t buffer_line_count(textbuffer *buf);
+size_t buffer_line_start(textbuffer *buf, size_t line);
+size_t buffer_line_length(textbuffer *buf, size_t line);
+size_t buffer_line_of(textbuffer *buf, size_t offset);
+size_t buffer_read(textbuffer *buf, size_t offset, char *out, size_t len);
+size_t buffer_line(textbuffer *buf, size_t line, char *out, size_t cap);
+size_t buffer_char_before(textbuffer *buf, size_t offset);
+size_t buffer_char_after(textbuffer *buf, size_t offset);
+
+#endif
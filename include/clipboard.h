@@ -0,0 +1,28 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include "buffer.h"
+
+#define CLIPBOARD_EAGER_MAX (16 << 20)   // bytes handed to other programs on focus loss, bigger copies when we quit
+#define CLIPBOARD_MOVE_SHARE 4           // a chunk a copy uses a quarter of moves with it, less is copied out of it
+
+// copied text kept as pieces of the buffer storage, only turned into a string when it leaves beditor
+typedef struct{
+piece *pieces;
+size_t count;
+size_t length;
+int fresh;           // still the newest clipboard content
+int exported;        // already handed to the system clipboard
+}clipboard;
+
+void clipboard_init(clipboard *clip);
+void clipboard_free(clipboard *clip);
+void clipboard_copy(clipboard *clip, textbuffer *buf, size_t offset, size_t len);
+int clipboard_paste(clipboard *clip, textbuffer *buf, size_t offset, size_t *len);
+int clipboard_pieces(clipboard *clip, const piece **pieces, size_t *count);
+void clipboard_export(clipboard *clip, textbuffer *buf);
+void clipboard_offer(clipboard *clip, textbuffer *buf);
+void clipboard_move(clipboard *clip, textbuffer *from, textbuffer *to);
+void clipboard_update(clipboard *clip, textbuffer *buf);
+
+#endif
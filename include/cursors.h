@@ -0,0 +1,18 @@
+#ifndef CURSORS_H
+#define CURSORS_H
+
+#include "beditor.h"
+#include "minimap.h"
+
+void cursors_free(sdltext *txt);
+void cursors_clear(sdltext *txt);
+void cursors_add(sdltext *txt, size_t anchor, size_t head);
+size_t cursors_from(sdltext *txt, size_t offset);
+int cursors_replace(sdltext *txt, minimap *map, const piece *ins, size_t n, int erase);
+int cursors_insert(sdltext *txt, minimap *map, const char *text, size_t len);
+void cursors_move(sdltext *txt, SDL_Keycode sym, int shift);
+void cursors_select_next(sdltext *txt);
+void cursors_split_lines(sdltext *txt);
+void cursors_block(sdltext *txt, int anchor_line, int anchor_x, int line, int x);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENCODING_UTF8 0
+#define ENCODING_LATIN1 1
+#define ENCODING_UTF16LE 2
+#define ENCODING_UTF16BE 3
+#define ENCODING_SAMPLE 4096      // bytes at the start of a file looked at to tell utf-16 without a byte order mark
+#define ENCODING_GROWTH(n) ((n) * 2 + 4)   // most utf-8 bytes n bytes of latin-1 or utf-16 turn into
+
+// what a file turned out to be while it was read, and the state to carry from one block to the next. The
+// buffer always holds utf-8, anything else is transcoded block by block as it comes in and back on save
+typedef struct{
+int kind;              // ENCODING_*
+int bom;               // the file starts with a utf-16 byte order mark, it is not part of the buffer
+int state;             // continuation bytes the utf-8 validator still expects
+int lower;             // smallest and largest byte the next continuation may be, rules out overlongs and surrogates
+int upper;
+int nonascii;          // an earlier block had non-ascii bytes, invalid ones after that do not make it latin-1
+size_t invalid;        // bytes that are not valid utf-8 in a file that stayed utf-8
+unsigned int pending;  // utf-16: a high surrogate waiting for its pair
+unsigned int odd;      // utf-16: 0x100 | the first byte of a unit the block cut in two
+unsigned char carry[4];// save: start of a utf-8 sequence the last piece cut off
+int carry_len;
+size_t lf;             // line breaks seen, every '\n'
+size_t crlf;           // the ones of them with a '\r' before
+int cr;                // the last block ended in '\r'
+}text_encoding;
+
+void encoding_init(text_encoding *e);
+size_t encoding_ascii(const char *s, size_t n);
+size_t encoding_detect(text_encoding *e, const char *s, size_t n);
+int encoding_validate(text_encoding *e, const char *s, size_t n, int last);
+size_t encoding_decode(text_encoding *e, const char *in, size_t n, char *out, int last);
+size_t encoding_encode(text_encoding *e, const char *in, size_t n, char *out);
+void encoding_line_ends(text_encoding *e, const char *s, size_t n);
+int encoding_fits_latin1(const char *s, size_t n);
+const char *encoding_name(int kind);
+uint32_t utf8_decode(const char *s, size_t n, size_t *len);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef HEXVIEW_H
+#define HEXVIEW_H
+
+#include "beditor.h"
+#include "minimap.h"
+#include "viewer.h"
+
+#define HEX_ROW 16            // bytes per row
+#define HEX_ROWS_MAX 256      // rows read per frame at most, more never fit a screen
+#define HEX_GLYPHS 95         // printable ascii from ' ' to '~', the hex digits are among them
+
+// the document as offsets, hex bytes and their ascii, or the file a view is open on. Only the rows on screen are
+// read each frame and every character is a glyph textured once, so a frame costs the same in a 10 GB file as in
+// a small one
+typedef struct{
+int active;
+SDL_Texture *glyphs[HEX_GLYPHS];
+int glyph_w[HEX_GLYPHS];
+int cell;       // pixels per character, the font is monospaced
+int row_h;      // 0 until the glyphs are made
+size_t top;     // first row on screen
+int low;        // the next hex digit typed goes into the low half of the byte at the cursor
+viewer *view;   // read-only, its bytes come from the map or the inflated spans instead of the document
+size_t at;      // the cursor in view, the document keeps its own
+}hexview;
+
+void hexview_init(hexview *h);
+void hexview_free(hexview *h);
+void hexview_open(hexview *h, sdltext *txt);
+void hexview_open_view(hexview *h, sdltext *txt, viewer *v);
+void hexview_render(hexview *h, sdlwindow *win, sdltext *txt);
+int hexview_key(hexview *h, sdltext *txt, minimap *map, SDL_Keycode sym, Uint16 mod);
+void hexview_type(hexview *h, sdltext *txt, minimap *map, const char *text, size_t len);
+void hexview_click(hexview *h, sdltext *txt, int x, int y);
+
+#endif
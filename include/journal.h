@@ -0,0 +1,82 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "buffer.h"
+#include "undo.h"
+
+#define JOURNAL_GROW (1 << 20)            // the mapping grows by at least this much at a time
+#define JOURNAL_COMPACT_SIZE (32 << 20)   // bigger than this and twice the live history gets it rewritten
+#define JOURNAL_CHECKPOINT_MS 1000       // the undo group still being typed into is written this often
+#define JOURNAL_HASH_SEED 0ULL            // hash of no bytes at all
+#define JOURNAL_HASH_BLOCK (1 << 20)      // bytes of a file per block hash, a save rehashes at most two per run
+#define JOURNAL_TEXT_MAX (4 << 20)        // text of a group copied into the journal, a bigger one is not recoverable
+#define JOURNAL_SYNC_TEXT (4 << 20)       // text copied per frame, the groups after it wait for the next one
+
+// hashes of a file in stretches one after another, the hash of what a save leaves on disk comes from them
+// and the few bytes around its edits instead of every byte of the file
+typedef struct{
+size_t len;
+uint64_t hash;
+}journal_block;
+
+typedef struct{
+journal_block *blocks;
+size_t count;
+size_t cap;
+size_t len;            // bytes of all blocks together
+}journal_blocks;
+
+// a span of the storage and where the file on disk has the same bytes
+typedef struct{
+int chunk;
+size_t start;
+size_t len;
+size_t at;
+}journal_extent;
+
+// undo history of one file, appended to a mapped file next to it so reopening the file brings it back
+// and a crash loses next to nothing
+typedef struct{
+char *path;            // the journal, .<name>.bundo in the directory of the file, or in the state directory
+int untitled;          // for a document without a file, removed when closed
+int fd;
+char *map;             // writable mapping of cap bytes, the first used hold records
+size_t cap;
+size_t used;
+size_t compact_at;
+long long saved;       // undo position the file on disk matches, -1 once later edits made it unreachable
+long long pending;     // undo position of a save still being written, tracked the same way
+uint64_t hash;         // content hash of the file on disk
+long long position;    // undo position last written, -1 when it has to be written again
+unsigned int checkpoint; // time the open group was last written
+int history;           // holds groups, a journal without any is removed when closed
+char *restored;        // read-only mapping restored undo pieces point into, lives as long as the buffer
+size_t restored_len;
+journal_extent *file;  // what the file of hash holds, sorted by storage. Text in it is written as an offset
+size_t file_count;
+int referenced;        // groups were written with offsets into the file of hash
+}journal;
+
+void journal_init(journal *j);
+void journal_free(journal *j);
+void journal_close(journal *j);
+int journal_restore(journal *j, const char *file, uint64_t hash, textbuffer *buf, undolog *u, int recover);
+size_t journal_unsaved(const char *file, uint64_t hash);
+void journal_open(journal *j, const char *file, uint64_t hash);
+void journal_untitled(journal *j);
+char *journal_crashed_untitled(void);
+int journal_recover_untitled(journal *j, const char *path, textbuffer *buf, undolog *u);
+void journal_save_start(journal *j, const char *file, textbuffer *buf, undolog *u);
+void journal_save_done(journal *j, int ok, uint64_t hash);
+void journal_file(journal *j, const piece *pieces, size_t count);
+void journal_sync(journal *j, textbuffer *buf, undolog *u, unsigned int now);
+uint64_t journal_hash_update(uint64_t h, const char *data, size_t len);
+uint64_t journal_hash_combine(uint64_t a, uint64_t b, size_t b_len);
+void journal_blocks_free(journal_blocks *b);
+int journal_blocks_add(journal_blocks *b, size_t len, uint64_t hash);
+int journal_blocks_hash(journal_blocks *b, const char *data, size_t len);
+uint64_t journal_blocks_total(const journal_blocks *b);
+char *journal_state_dir(void);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef LINECACHE_H
+#define LINECACHE_H
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#define LINECACHE_SLOTS 512   // rendered lines kept, a few screens worth so scrolling reuses them
+#define LINECACHE_WAYS 4      // slots a line can go in, the least recently drawn of them is replaced
+
+// one rendered line, found again by its text wherever it is on screen
+typedef struct{
+uint64_t hash;
+char *text;
+size_t len;
+SDL_Texture *tex;
+int w;
+int h;
+unsigned int used;    // clock of the last draw
+}linecache_entry;
+
+// textures of recently drawn lines, found by a hash of their text. A frame only renders the lines it did not
+// draw before, scrolling or a log growing at the bottom renders the new ones and nothing else
+typedef struct{
+linecache_entry slots[LINECACHE_SLOTS];
+unsigned int clock;
+}linecache;
+
+void linecache_init(linecache *c);
+void linecache_free(linecache *c);
+SDL_Texture *linecache_get(linecache *c, SDL_Renderer *renderer, TTF_Font *font, SDL_Color color,
+                           const char *line, size_t len, int *w, int *h);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define LINEINDEX_MIN_SIZE (32 << 20)   // smaller files are counted again faster than a cache is worth keeping
+#define LINEINDEX_BUDGET (64 << 20)     // bytes all cached indexes together may take, the least recently used go
+
+int lineindex_load(const char *path, const struct stat *st, size_t step, size_t **lines, size_t *marks,
+                   size_t *line_count);
+int lineindex_save(const char *path, const struct stat *st, size_t step, const size_t *lines, size_t marks,
+                   size_t line_count);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "buffer.h"
+#include "encoding.h"
+#include "journal.h"
+#include "uring.h"
+
+#define LOADER_BLOCK (4 << 20)    // bytes read into the storage per call, file offsets stay multiples of it
+#define LOADER_BUDGET_MS 8        // reading time per frame on the main thread, for the new lines of a followed file
+#define LOADER_QUEUE 4            // blocks read at once, each its own request so a fast drive gets them all together
+
+// a file being read into a buffer of its own on a thread, the open document stays until it is done. Everything
+// but state, stop and progress belongs to the thread until loader_step saw it finish
+typedef struct{
+int fd;               // -1 when nothing is loading
+char *path;
+textbuffer buf;
+size_t size;          // file size when it was opened, only for the progress
+size_t done;
+struct stat st;       // of the file when it was opened, a later save checks the file still is what was read
+uint64_t hash;        // content hash of the file once it is in, the journal matches its saves against it
+journal_blocks blocks; // the same per block, an in-place save works out the new hash from them
+text_encoding enc;    // found out from the first block on, the storage gets utf-8 whatever the file is
+char *raw;            // the blocks as read when they have to be transcoded, utf-8 goes straight into the storage
+uring ring;           // the reads of a batch go out together through it
+SDL_Thread *thread;
+SDL_atomic_t state;   // 1 while the thread reads, then 0 once the file is in or -1
+SDL_atomic_t stop;    // set to have the thread give up after the batch it is on
+SDL_atomic_t progress; // permille read so far
+}loader;
+
+void loader_init(loader *l);
+int loader_start(loader *l, const char *path);
+int loader_step(loader *l);
+void loader_cancel(loader *l);
+void loader_finish(loader *l);
+int loader_progress(loader *l);
+
+#endif
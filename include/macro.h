@@ -0,0 +1,36 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <SDL2/SDL.h>
+
+#define MACRO_KEY 0
+#define MACRO_TEXT 1
+
+// one recorded command, text steps point into the shared text of the macro
+typedef struct{
+int type;
+SDL_Keycode sym;
+Uint16 mod;
+size_t text;   // offset into macro.text
+size_t len;
+}macro_step;
+
+// keys and typed text recorded as they come through the event loop, replayed without polling or rendering
+typedef struct{
+macro_step *steps;
+size_t count;
+size_t cap;
+char *text;
+size_t text_len;
+size_t text_cap;
+int recording;
+}macro;
+
+void macro_init(macro *m);
+void macro_free(macro *m);
+void macro_start(macro *m);
+void macro_stop(macro *m);
+void macro_record_key(macro *m, SDL_Keycode sym, Uint16 mod);
+void macro_record_text(macro *m, const char *text, size_t len);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include "beditor.h"
+
+#define MINIMAP_WIDTH 64          // width of the minimap column in pixels
+#define MINIMAP_COLS 128          // text columns sampled per line
+#define MINIMAP_COLS_PER_PX (MINIMAP_COLS / MINIMAP_WIDTH)
+#define MINIMAP_LINE_PX 2         // pixel rows per line while the whole file fits
+#define MINIMAP_TILE_LINES 64     // lines per cached tile
+#define MINIMAP_BUDGET_US 500     // tile generation time allowed per frame, composing rows gets as much again
+
+// one block of lines downsampled to ink bits, plus the whole block collapsed into one row
+typedef struct{
+Uint8 bits[MINIMAP_TILE_LINES][MINIMAP_COLS / 8];
+Uint16 summary[MINIMAP_WIDTH];
+int ready;
+int dirty;
+}minimap_tile;
+
+typedef struct{
+minimap_tile *tiles;
+int tile_count;
+int dirty_count;
+int next_tile;
+int line_count;
+int height;
+int rows_used;
+Uint8 *row_dirty;    // pixel rows waiting to be composed, one flag per row of the texture
+int dirty_rows;
+int next_row;        // composing goes round from here, rows marked again and again never starve the rest
+Uint32 *pixels;
+SDL_Texture *texture;
+}minimap;
+
+void minimap_init(minimap *mm);
+void minimap_free(minimap *mm);
+void minimap_invalidate(minimap *mm, int first_line, int last_line);
+void minimap_update(minimap *mm, sdlwindow *win, sdltext *txt, int line_count);
+void minimap_render(minimap *mm, sdlwindow *win, sdltext *txt);
+int minimap_hit(sdlwindow *win, int mouse_x);
+int minimap_line_at(minimap *mm, int mouse_y);
+
+#endif
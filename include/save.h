@@ -0,0 +1,57 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "buffer.h"
+#include "encoding.h"
+#include "journal.h"
+
+#define SAVE_IOV_BATCH 1024   // pieces handed to one writev call, IOV_MAX on linux
+#define SAVE_QUEUE 8          // writev batches out at once, at most URING_DEPTH
+#define SAVE_MOVE_BLOCK (8 << 20)   // bytes moved at a time when the tail of a file shifts in place
+#define SAVE_ENCODE_BLOCK (1 << 20) // bytes transcoded at a time for a file that is not utf-8
+
+// what the file on disk holds, as the pieces of the storage it was loaded or saved from. Lets the next save
+// of the same file write only what changed since
+typedef struct{
+piece *pieces;
+size_t count;
+size_t cap;
+struct stat st;        // the file right after it was read or written, any other change makes the pieces stale
+journal_blocks blocks; // hashes of the file in blocks, empty when they are not known
+}save_base;
+
+// the document as it was when a save started, written on a thread of its own. The storage is append-only
+// so only the piece list is copied, edits made meanwhile never touch the bytes it points at
+typedef struct{
+char *path;
+piece *pieces;
+size_t count;
+char **chunks;         // data of every chunk at the time, chunk data never moves once allocated
+size_t length;
+const save_base *base; // owned by the caller, left alone until the job is finished
+text_encoding enc;     // what the file is written in, latin-1 turns into utf-8 when the text does not fit it
+struct stat st;        // the file once it is written
+int in_place;          // only the changed parts were written
+int result;            // 0 once the file is complete
+uint64_t hash;         // of the bytes written, for the undo journal
+journal_blocks blocks; // the same per block of the file, they go to the base with the pieces
+SDL_atomic_t progress; // permille written so far
+SDL_Thread *thread;
+}save_job;
+
+void save_base_init(save_base *b);
+void save_base_free(save_base *b);
+void save_base_set(save_base *b, textbuffer *buf, const struct stat *st, journal_blocks *blocks);
+void save_base_take(save_base *b, save_job *job);
+int save_base_append(save_base *b, piece p, const char *data);
+int save_base_fresh(const save_base *b, const struct stat *st);
+int save_base_same(const save_base *b, textbuffer *buf);
+Uint32 save_event_type(void);
+save_job *save_start(const char *filename, textbuffer *buf, const save_base *base, const text_encoding *enc);
+void save_wait(save_job *job);
+void save_free(save_job *job);
+
+#endif
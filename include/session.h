@@ -0,0 +1,43 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SESSION_FILES 2             // what is on top and the document under a view
+#define SESSION_PREVIEW (64 << 10)  // bytes of the last screen read from the file to paint it before it is loaded
+#define SESSION_DOCUMENT 0
+#define SESSION_VIEW 1
+
+// a file that was open when beditor quit and where it was in it. size, mtime, inode and device are the file
+// as it was then, the positions only fit that version, and they key its line index for when there is a cache
+typedef struct{
+uint32_t kind;         // SESSION_DOCUMENT or SESSION_VIEW
+uint32_t path_len;     // bytes of path after the record
+uint64_t size;         // 0 for all four when the document had unsaved edits, its positions are of those
+uint64_t mtime_sec;
+uint64_t mtime_nsec;
+uint64_t ino;
+uint64_t dev;
+uint64_t cursor;       // byte offset
+uint64_t top;          // first line on screen
+uint64_t top_offset;   // byte offset of that line in the file, -1 when it has none (a gzip file)
+}session_record;
+
+typedef struct{
+session_record files[SESSION_FILES];
+char *paths[SESSION_FILES];
+size_t count;
+}session;
+
+void session_init(session *s);
+void session_free(session *s);
+int session_add(session *s, uint32_t kind, const char *path, const struct stat *st, size_t cursor, size_t top,
+                uint64_t top_offset);
+int session_load(session *s);
+int session_save(const session *s);
+int session_fresh(const session_record *r, const struct stat *st);
+char *session_preview(const session_record *r, const char *path, size_t *len);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "buffer.h"
+
+#define UNDO_MEMORY_LIMIT (16 << 20)   // history bytes kept before the oldest groups get dropped
+#define UNDO_COALESCE_MS 1000          // keystrokes further apart than this start a new group
+
+#define UNDO_OTHER 0
+#define UNDO_TYPING 1
+#define UNDO_ERASE 2
+
+#define UNDO_INSERT 0
+#define UNDO_DELETE 1
+
+// one buffer edit, the text is kept as pieces of the append-only storage
+typedef struct{
+int type;
+size_t offset;
+size_t len;
+piece *pieces;
+size_t count;
+}undo_op;
+
+// edits undone and redone together
+typedef struct{
+undo_op *ops;
+size_t count;
+size_t cap;
+size_t cursor_before;
+size_t cursor_after;
+size_t memory;
+int kind;
+char last_char;
+unsigned int time;
+}undo_group;
+
+// groups [0, current) can be undone, [current, count) redone
+typedef struct{
+undo_group *groups;
+size_t count;
+size_t cap;
+size_t current;
+size_t memory;
+size_t limit;
+int open;        // the last group can still take more keystrokes
+int recording;   // between undo_begin/undo_continue and undo_end
+size_t stable;   // groups below this did not change since the journal last wrote them
+size_t trimmed;  // groups dropped from the front since the journal last looked
+}undolog;
+
+void undo_init(undolog *u);
+void undo_free(undolog *u);
+void undo_begin(undolog *u, size_t cursor);
+int undo_continue(undolog *u, int kind, size_t cursor, char c, unsigned int now);
+void undo_end(undolog *u, size_t cursor, int kind, char c, unsigned int now);
+void undo_break(undolog *u);
+void undo_record_insert(undolog *u, textbuffer *buf, size_t offset, size_t len);
+void undo_record_delete(undolog *u, textbuffer *buf, size_t offset, size_t len);
+void undo_record_pieces(undolog *u, int type, size_t offset, size_t len, const piece *p, size_t n);
+int undo_undo(undolog *u, textbuffer *buf, size_t *cursor, size_t *first_offset);
+int undo_redo(undolog *u, textbuffer *buf, size_t *cursor, size_t *first_offset);
+undo_group *undo_add_group(undolog *u, size_t cursor_before, size_t cursor_after, int kind);
+int undo_add_op(undolog *u, undo_group *g, int type, size_t offset, size_t len, const piece *p, size_t n);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define URING_DEPTH 16        // requests in flight at most, enough to keep an NVMe drive busy
+#define URING_READ 0
+#define URING_WRITEV 1
+
+// a finished request, tag is what it was queued with and result what pread or pwritev would have returned
+typedef struct{
+uint64_t tag;
+ssize_t result;
+}uring_done;
+
+// io_uring through its raw system calls, no liburing. On a kernel without it (or with it turned off) every
+// request runs right away with pread or pwritev and is handed back the same way, callers never see which
+typedef struct{
+int fd;                  // the ring, -1 when the synchronous fallback is used
+unsigned int *sq_head;
+unsigned int *sq_tail;
+unsigned int *sq_mask;
+unsigned int *sq_array;
+unsigned int *cq_head;
+unsigned int *cq_tail;
+unsigned int *cq_mask;
+void *sqes;              // struct io_uring_sqe[URING_DEPTH]
+void *cqes;              // struct io_uring_cqe[]
+void *sq_map;
+size_t sq_map_len;
+void *cq_map;
+size_t cq_map_len;
+size_t sqes_len;
+unsigned int queued;     // written to the ring but not submitted yet
+unsigned int in_flight;  // submitted or queued, not handed back yet
+uring_done done[URING_DEPTH];   // fallback: finished right away, waiting for uring_wait
+unsigned int done_count;
+}uring;
+
+int uring_init(uring *r);
+void uring_free(uring *r);
+int uring_queue(uring *r, int op, int fd, void *buf, size_t len, off_t offset, uint64_t tag);
+int uring_wait(uring *r, uring_done *out);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define VIEW_SPAN (1 << 21)        // uncompressed bytes between two gzip access points
+#define VIEW_WINDOW 32768          // deflate history, an access point keeps it to start inflating there
+#define VIEW_IN_BLOCK (1 << 18)    // compressed bytes read at a time
+#define VIEW_LINE_STEP 4096        // lines between two line checkpoints
+#define VIEW_CACHE 4               // decompressed spans kept around the view
+#define VIEW_BUDGET_MS 8           // indexing time per frame, the view scrolls while it runs
+#define VIEW_STARTS 256            // line starts remembered, more than a screen has lines
+#define VIEW_FIND_MAX 256          // longest text a search looks for
+#define VIEW_FIND_BLOCK (1 << 20)  // bytes a search looks through between two checks of the frame budget
+
+// a place in the compressed stream inflate can start from, zlib's zran scheme
+typedef struct{
+size_t out;            // uncompressed offset it is at
+off_t in;              // compressed offset of the first whole byte after it
+int bits;              // bits of the byte before in that still belong to it
+unsigned char *window; // the VIEW_WINDOW bytes of output before out
+}view_point;
+
+// uncompressed bytes from one access point to the next, or VIEW_SPAN bytes of a mapped file
+typedef struct{
+size_t start;
+size_t len;
+char *data;
+unsigned int used;
+}view_span;
+
+// read-only view of a file that is never loaded as a whole. One pass in the background records line
+// checkpoints (and for a gzip file access points), a line is then read from the nearest checkpoint before it.
+// A plain file is mapped, the pages of spans that drop out of the cache are given back, so only the cache and
+// the checkpoints stay in memory however big the file is. The checkpoints of a big mapped file are cached once
+// the pass is done, the next view of it unchanged starts with them and skips the pass
+typedef struct{
+int fd;                // -1 when no view is open
+char *path;
+off_t size;            // of the file as it is on disk, for the progress
+struct stat st;        // when it was opened, a mapped file's checkpoints are cached for it as it was then
+int mapped;            // a plain file read through map, not a gzip stream
+char *map;
+z_stream strm;         // the indexing pass
+int indexing;          // 1 while it runs, 0 once the whole file is indexed, -1 when the stream broke off
+off_t read_at;
+unsigned char *in;
+unsigned char *window; // output of the pass, inflate writes round and round it
+size_t length;         // uncompressed bytes indexed so far
+view_point *points;
+size_t point_count;
+size_t point_cap;
+size_t *lines;         // offset of line k * VIEW_LINE_STEP
+size_t line_marks;
+size_t line_cap;
+size_t line_count;     // lines seen so far
+view_span cache[VIEW_CACHE];
+unsigned int clock;
+size_t at_line;        // the line looked up last and where it starts
+size_t at_offset;
+size_t start_line[VIEW_STARTS];     // lines looked up or passed lately, each in slot line % VIEW_STARTS
+size_t start_offset[VIEW_STARTS];
+size_t top;            // first line on screen
+char find[VIEW_FIND_MAX + 1];   // what the running or last search looks for
+size_t find_len;
+int finding;           // 1 while a search runs, -1 once it got to the end without a match
+size_t find_at;        // where it goes on and the line that is
+size_t find_line;
+}viewer;
+
+void viewer_init(viewer *v);
+void viewer_close(viewer *v);
+int viewer_wants(const char *path);
+int viewer_open(viewer *v, const char *path);
+int viewer_step(viewer *v);
+size_t viewer_line(viewer *v, size_t line, char *out, size_t cap);
+size_t viewer_readable(viewer *v);
+size_t viewer_read(viewer *v, size_t offset, char *out, size_t len);
+int viewer_progress(viewer *v);
+void viewer_find(viewer *v, const char *text, size_t line);
+
+#endif
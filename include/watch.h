@@ -0,0 +1,60 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "buffer.h"
+#include "journal.h"
+#include "save.h"
+
+#define WATCH_COMPARE_BLOCK (1 << 16)   // bytes compared at a time while looking for what changed
+
+// inotify on the directory of the open file, so a writer that renames a new file over it is seen as well
+typedef struct{
+int fd;               // inotify instance, -1 until something is watched
+int wd;               // watch on the directory, -1 when there is none
+char *dir;
+char *name;           // the file inside dir
+int changed;          // an event for the file came in and was not looked at yet
+int follow;           // every write counts, not just complete ones, so appends are read as they come
+size_t synced;        // buffer version the document last was the file at
+}watcher;
+
+// bytes [offset, offset + old_len) of what the file held became [offset, offset + new_len) of what it holds
+typedef struct{
+size_t offset;
+size_t old_len;
+size_t new_len;
+}watch_change;
+
+// the changed file compared against the base on a thread of its own, nothing is read on the main thread. The
+// document stays as it is meanwhile, everything but state and stop belongs to the thread until watch_step
+// saw it finish
+typedef struct{
+int fd;
+struct stat st;       // of the file when the compare started
+struct stat base_st;  // the base it started from, the result only fits that base
+piece *pieces;        // of the base, their text is read through chunks
+size_t count;
+char **chunks;        // data of every chunk at the time, chunk data never moves once allocated
+journal_blocks old;   // hashes of the base, whole blocks are compared by them instead of byte by byte
+watch_change change;
+char *mid;            // the bytes the file holds in the changed range
+journal_blocks blocks; // hashes of the file, they go to the base along with the change
+SDL_Thread *thread;
+SDL_atomic_t state;   // 1 while comparing, then 0, or -1 when the file could not be read whole
+SDL_atomic_t stop;    // set to have the thread give up after the block it is on
+}watch_job;
+
+void watch_init(watcher *w);
+void watch_free(watcher *w);
+void watch_set(watcher *w, const char *path);
+void watch_follow(watcher *w, int on);
+int watch_poll(watcher *w);
+watch_job *watch_start(const save_base *b, textbuffer *buf, int fd, const struct stat *st);
+int watch_step(watch_job *job);
+void watch_job_free(watch_job *job);
+piece *watch_pieces(const save_base *b, textbuffer *buf, const watch_change *c, const piece *mid, size_t *n);
+
+#endif
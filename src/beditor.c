@@ -1,35 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include "tinyfiledialogs.h"
-
-#define MAX_TEXT_LEN 128
-#define MAX_LINES 64
-#define WINDOW_WIDTH_INITIAL 640
-#define WINDOW_HEIGHT_INITIAL 480
-
-typedef struct{
-SDL_Window *window;
-SDL_Renderer *renderer;
-int window_width;
-int window_height;
-int current_render_y;
-}sdlwindow;
-
-typedef struct{
-TTF_Font *font;
-SDL_Color color;
-char lines[MAX_LINES][MAX_TEXT_LEN];
-int cursor_location_y;
-int cursor_location_x;
-int MAX_VISIBLE_LINES;
-int text_w;
-int text_h;
-int line_height;
-}sdltext;
+#include "beditor.h"
+#include "minimap.h"
+#include "clipboard.h"
+#include "journal.h"
+#include "cursors.h"
+#include "macro.h"
+#include "loader.h"
+#include "save.h"
+#include "watch.h"
+#include "linecache.h"
+#include "viewer.h"
+#include "session.h"
+#include "hexview.h"
 
 
 
@@ -50,6 +39,35 @@ int quit_all(sdlwindow *win, sdltext *txt) {
 }
 
 
+// caches the advance of every ascii byte once per font, mouse positions map to columns without measuring text
+void measure_glyphs(sdltext *txt) {
+    int fallback = 0;
+    TTF_GlyphMetrics(txt->font, '?', NULL, NULL, NULL, NULL, &fallback);
+    for (int c = 0; c < 128; ++c) {
+        if (TTF_GlyphMetrics(txt->font, (Uint16)c, NULL, NULL, NULL, NULL, &txt->glyph_advance[c]) != 0) {
+            txt->glyph_advance[c] = fallback;
+        }
+    }
+}
+
+
+
+// pixel advance of the character at s in a NUL terminated line and its bytes in *len. Ascii comes from the
+// table, anything else is asked from the font, which caches its glyphs itself
+int char_advance(sdltext *txt, const char *s, size_t *len) {
+    unsigned char c = (unsigned char)*s;
+    *len = 1;
+    if (c < 0x80) return txt->glyph_advance[c];
+    uint32_t cp = utf8_decode(s, 4, len);   // the NUL ends a sequence cut short before the 4 bytes
+    int advance = 0;
+    if (cp > 0xFFFF || TTF_GlyphMetrics(txt->font, (Uint16)cp, NULL, NULL, NULL, NULL, &advance) != 0) {
+        advance = txt->glyph_advance['?'];
+    }
+    return advance;
+}
+
+
+
 // setup SDL code
 int setup_WIN_REN_TTF(sdlwindow *win, sdltext *txt) {
     if (SDL_Init(SDL_INIT_VIDEO) != 0 || TTF_Init() != 0) {
@@ -81,91 +99,357 @@ int setup_WIN_REN_TTF(sdlwindow *win, sdltext *txt) {
         printf("TTF_OpenFont Error: %s\n", TTF_GetError());
         return quit_all(&win, &txt);
     }
+    TTF_SetFontKerning(txt->font, 0);   // so the cached advances add up to what TTF_SizeUTF8 measures
+    measure_glyphs(txt);
 
     return 0;    
 }
 
 
 
+// maps a y pixel to a line, shared by the text area and the minimap
+int line_from_y(int y, int top, int first_line, int lines_per, int pixels_per, int line_count) {
+    if (pixels_per <= 0) pixels_per = 1;
+    if (y < top) y = top;
+    int line = first_line + (int)((long long)(y - top) * lines_per / pixels_per);
+    if (line >= line_count){
+        line = line_count - 1;
+    }
+    if (line < 0){
+        line = 0;
+    }
+    return line;
+}
+
+
+
+int text_line_count(sdltext *txt) {
+    return (int)buffer_line_count(&txt->buf);
+}
+
+
+
+int line_length(sdltext *txt, int line) {
+    return (int)buffer_line_length(&txt->buf, line);
+}
+
+
+
+// byte offset of the cursor in the buffer
+size_t cursor_offset(sdltext *txt) {
+    return buffer_line_start(&txt->buf, txt->cursor_location_y) + txt->cursor_location_x;
+}
+
+
+
+void set_cursor_offset(sdltext *txt, size_t offset) {
+    txt->cursor_location_y = (int)buffer_line_of(&txt->buf, offset);
+    txt->cursor_location_x = (int)(offset - buffer_line_start(&txt->buf, txt->cursor_location_y));
+}
+
+
+
+// scrolls the viewport so the cursor line stays visible
+void scroll_to_cursor(sdltext *txt) {
+    int visible = txt->MAX_VISIBLE_LINES > 0 ? txt->MAX_VISIBLE_LINES : 1;
+    if (txt->cursor_location_y < txt->first_visible_line) {
+        txt->first_visible_line = txt->cursor_location_y;
+    } else if (txt->cursor_location_y >= txt->first_visible_line + visible) {
+        txt->first_visible_line = txt->cursor_location_y - visible + 1;
+    }
+}
+
+
+
+// centers the viewport on line, used by minimap clicks
+void scroll_to_line(sdltext *txt, int line) {
+    int first = line - txt->MAX_VISIBLE_LINES / 2;
+    if (first > text_line_count(txt) - txt->MAX_VISIBLE_LINES) first = text_line_count(txt) - txt->MAX_VISIBLE_LINES;
+    if (first < 0) first = 0;
+    txt->first_visible_line = first;
+}
+
+
+
+// buffer edits that also go into the undo history
+int text_insert(sdltext *txt, size_t offset, const char *text, size_t len) {
+    if (buffer_insert(&txt->buf, offset, text, len) != 0) return -1;
+    undo_record_insert(&txt->undo, &txt->buf, offset, len);
+    return 0;
+}
+
+
+
+int text_delete(sdltext *txt, size_t offset, size_t len) {
+    undo_record_delete(&txt->undo, &txt->buf, offset, len);
+    return buffer_delete(&txt->buf, offset, len);
+}
+
+
+
+// deletes the character of len bytes at offset, consecutive backspaces undo as whole words
+void erase_char(sdltext *txt, size_t offset, size_t len) {
+    char c = 0;
+    buffer_read(&txt->buf, offset, &c, 1);
+    Uint32 now = SDL_GetTicks();
+    if (!undo_continue(&txt->undo, UNDO_ERASE, offset + len, c, now)) {
+        undo_begin(&txt->undo, offset + len);
+    }
+    text_delete(txt, offset, len);
+    undo_end(&txt->undo, offset, UNDO_ERASE, c, now);
+}
+
+
+
+int has_selection(sdltext *txt) {
+    return txt->sel.anchor != txt->sel.head;
+}
+
+
+
+// start and end offsets of the selection in buffer order
+void selection_range(sdltext *txt, size_t *start, size_t *end) {
+    *start = txt->sel.anchor < txt->sel.head ? txt->sel.anchor : txt->sel.head;
+    *end = txt->sel.anchor < txt->sel.head ? txt->sel.head : txt->sel.anchor;
+}
+
+
+
+// collapses the selection onto the cursor
+void clear_selection(sdltext *txt) {
+    txt->sel.anchor = txt->sel.head = cursor_offset(txt);
+}
+
+
+
+// removes the selected text and leaves the cursor where it started, returns 1 if anything was deleted
+int delete_selection(sdltext *txt, minimap *map) {
+    if (!has_selection(txt)) return 0;
+    size_t start, end;
+    selection_range(txt, &start, &end);
+    int first_line = (int)buffer_line_of(&txt->buf, start);
+    int last_line = (int)buffer_line_of(&txt->buf, end);
+    text_delete(txt, start, end - start);
+    set_cursor_offset(txt, start);
+    clear_selection(txt);
+    minimap_invalidate(map, first_line, first_line == last_line ? first_line : -1);
+    return 1;
+}
+
+
+
+// pixel width of the first n bytes of line
+int text_width(sdltext *txt, const char *line, int n) {
+    char prefix[MAX_TEXT_LEN];
+    if (n >= MAX_TEXT_LEN) n = MAX_TEXT_LEN - 1;
+    memcpy(prefix, line, n);
+    prefix[n] = '\0';
+    int w = 0;
+    TTF_SizeUTF8(txt->font, prefix, &w, NULL);
+    return w;
+}
+
+
+
+// column whose left edge is closest to x pixels into the line, always the first byte of a character
+int column_near_x(sdltext *txt, const char *line, int x) {
+    int w = 0;
+    int i = 0;
+    while (line[i]) {
+        size_t len;
+        int advance = char_advance(txt, line + i, &len);
+        if (x - w <= w + advance - x) return i;
+        w += advance;
+        i += (int)len;
+    }
+    return i;
+}
+
+
+
+// up, down and page keys, the cursor stays under the pixel column it had before the first of them
+void move_to_line(sdltext *txt, int line) {
+    char text[MAX_TEXT_LEN];
+    if (txt->preferred_x < 0 || txt->preferred_at != cursor_offset(txt)) {
+        buffer_line(&txt->buf, txt->cursor_location_y, text, sizeof(text));
+        int w = 0;
+        size_t len;
+        for (int i = 0; i < txt->cursor_location_x && text[i]; i += (int)len) {
+            w += char_advance(txt, text + i, &len);
+        }
+        txt->preferred_x = w;
+    }
+    buffer_line(&txt->buf, line, text, sizeof(text));
+    txt->cursor_location_y = line;
+    txt->cursor_location_x = column_near_x(txt, text, txt->preferred_x);
+    txt->preferred_at = cursor_offset(txt);
+}
+
+
+
+// first column whose left edge is past x pixels into the line, the line length if none is
+int column_at_x(sdltext *txt, const char *line, int x) {
+    int w = 0;
+    int i = 0;
+    while (line[i]) {
+        if (w > x) return i;
+        size_t len;
+        w += char_advance(txt, line + i, &len);
+        i += (int)len;
+    }
+    return i;
+}
+
+
+
+// line under mouse_y in the text area
+int line_at_mouse(sdltext *txt, int mouse_y) {
+    return line_from_y(mouse_y, 20, txt->first_visible_line, 1,
+        txt->line_height > 0 ? txt->line_height : 32, text_line_count(txt));
+}
+
+
+
 //mouse input function which calculates location in file
 void set_cursor_from_mouse(int mouse_x, int mouse_y, sdltext *txt) {
     // Calculate which line was clicked
-    int clicked_line = (mouse_y - 20) / (txt->line_height > 0 ? txt->line_height : 32);
-    if (clicked_line < 0){
-        clicked_line = 0;
-    }
-    if (clicked_line >= MAX_LINES){
-        clicked_line = MAX_LINES - 1;
-        
-    } 
-    txt->cursor_location_y = clicked_line;
+    txt->cursor_location_y = line_at_mouse(txt, mouse_y);
     // Find the character position in the line
-    int x = 25;
-    txt->cursor_location_x = 0;
-    int w = 0;
-    size_t len = strlen(txt->lines[txt->cursor_location_y]);
-    for (size_t i = 0; i <= len; ++i) {
-        char temp[MAX_TEXT_LEN];
-        strncpy(temp, txt->lines[txt->cursor_location_y], i);
-        temp[i] = '\0';
-        TTF_SizeText(txt->font, temp, &w, NULL);
-        if (x + w > mouse_x) {
-            txt->cursor_location_x = i;
-            break;
-        }
-        txt->cursor_location_x = i;
+    char line[MAX_TEXT_LEN];
+    buffer_line(&txt->buf, txt->cursor_location_y, line, sizeof(line));
+    txt->cursor_location_x = column_at_x(txt, line, mouse_x - 25);
+}
+
+
+
+// one highlight rectangle per visible row start..end touches, drawn in a single call
+void render_selection(sdlwindow *win, sdltext *txt, int line_count, size_t start, size_t end) {
+    SDL_Rect rects[256];
+    int count = 0;
+    int lh = txt->line_height > 0 ? txt->line_height : 32;
+    int first = (int)buffer_line_of(&txt->buf, start);
+    int last = (int)buffer_line_of(&txt->buf, end);
+    if (first < txt->first_visible_line) first = txt->first_visible_line;
+    if (last > txt->first_visible_line + txt->MAX_VISIBLE_LINES) last = txt->first_visible_line + txt->MAX_VISIBLE_LINES;
+    if (last >= line_count) last = line_count - 1;
+
+    char line[MAX_TEXT_LEN];
+    for (int i = first; i <= last && count < 256; ++i) {
+        size_t line_start = buffer_line_start(&txt->buf, i);
+        size_t len = buffer_line(&txt->buf, i, line, sizeof(line));
+        size_t a = start > line_start ? start - line_start : 0;
+        size_t b = end < line_start + len ? end - line_start : len;
+        int x0 = text_width(txt, line, (int)a);
+        int x1 = text_width(txt, line, (int)b);
+        if (end > line_start + len) x1 += lh / 3; // the newline is selected too
+        if (x1 <= x0) continue;
+        SDL_Rect r = {20 + x0, 20 + (i - txt->first_visible_line) * lh, x1 - x0, lh};
+        rects[count++] = r;
     }
+    SDL_SetRenderDrawColor(win->renderer, 180, 210, 255, 255);
+    SDL_RenderFillRects(win->renderer, rects, count);
+}
+
+
+
+// bar along the bottom with win->status on it, filled from the left as far as win->status_progress
+void render_status(sdlwindow *win, sdltext *txt) {
+    int h = txt->line_height > 0 ? txt->line_height : 32;
+    SDL_Rect bar = {0, win->window_height - h, win->window_width, h};
+    SDL_SetRenderDrawColor(win->renderer, 225, 225, 225, 255);
+    SDL_RenderFillRect(win->renderer, &bar);
+    bar.w = (int)((long long)win->window_width * win->status_progress / 1000);
+    SDL_SetRenderDrawColor(win->renderer, 180, 210, 255, 255);
+    SDL_RenderFillRect(win->renderer, &bar);
+    SDL_Surface *surf = TTF_RenderUTF8_Solid(txt->font, win->status, txt->color);
+    if (!surf) return;
+    SDL_Texture *tex = SDL_CreateTextureFromSurface(win->renderer, surf);
+    SDL_Rect dst = {5, bar.y, surf->w, surf->h};
+    SDL_RenderCopy(win->renderer, tex, NULL, &dst);
+    SDL_FreeSurface(surf);
+    SDL_DestroyTexture(tex);
 }
 
 
 
 //render function, renders all features
-void render_all(sdlwindow *win, sdltext *txt){
+void render_all(sdlwindow *win, sdltext *txt, minimap *map, linecache *lines){
     // Render background
         SDL_SetRenderDrawColor(win->renderer, 255, 255, 255, 255);
         SDL_RenderClear(win->renderer);
         
         // Render text lines
         
-        for (int i = 0; i < MAX_LINES; ++i) { 
-            if (strlen(txt->lines[i]) > 0) {
-                SDL_Surface *surf = TTF_RenderText_Solid(txt->font, txt->lines[i], txt->color);
-                SDL_Texture *tex = SDL_CreateTextureFromSurface(win->renderer, surf);
-                SDL_Rect dst = {20, win->current_render_y, surf->w, surf->h};
-                if (i == 0) txt->line_height = surf->h;
-                if (txt->line_height == 0) txt->line_height = 32;
-                if (win->current_render_y + surf->h > win->window_height - 20) {
-                    SDL_FreeSurface(surf);
-                    SDL_DestroyTexture(tex);
+        char line[MAX_TEXT_LEN];
+        int line_count = text_line_count(txt);
+        if (has_selection(txt)) {
+            size_t start, end;
+            selection_range(txt, &start, &end);
+            render_selection(win, txt, line_count, start, end);
+        }
+        // extra cursors are sorted, only the ones inside the view get looked at
+        size_t view_start = buffer_line_start(&txt->buf, txt->first_visible_line);
+        size_t view_end = buffer_line_start(&txt->buf, txt->first_visible_line + txt->MAX_VISIBLE_LINES + 1);
+        size_t first_cursor = cursors_from(txt, view_start);
+        for (size_t k = first_cursor; k < txt->cursor_count; ++k) {
+            selection *c = &txt->cursors[k];
+            size_t start = c->anchor < c->head ? c->anchor : c->head;
+            size_t end = c->anchor < c->head ? c->head : c->anchor;
+            if (start > view_end) break;
+            if (start != end) render_selection(win, txt, line_count, start, end);
+        }
+        for (int i = txt->first_visible_line; i < line_count; ++i) { 
+            size_t len = buffer_line(&txt->buf, i, line, sizeof(line));   // NUL bytes in it are shown, not where it ends
+            if (len > sizeof(line) - 1) len = sizeof(line) - 1;
+            int w, h;
+            SDL_Texture *tex = len > 0 ? linecache_get(lines, win->renderer, txt->font, txt->color, line, len, &w, &h) : NULL;
+            if (tex) {   // lines drawn in an earlier frame are not rendered again
+                SDL_Rect dst = {20, win->current_render_y, w, h};
+                if (txt->line_height == 0) txt->line_height = h;
+                if (win->current_render_y + h > win->window_height - 20) {
                     break; 
                 }
                 SDL_RenderCopy(win->renderer, tex, NULL, &dst);
-                SDL_FreeSurface(surf);
-                SDL_DestroyTexture(tex);
                 win->current_render_y += txt->line_height;
             } else {
                 win->current_render_y += (txt->line_height > 0 ? txt->line_height : 32);
+                if (win->current_render_y > win->window_height - 20) break;
             }
         }
 
+        minimap_update(map, win, txt, line_count);
+        minimap_render(map, win, txt);
+        if (win->status[0]) render_status(win, txt);
+
         // Draw blinking cursor at the correct position
-        int cursor_x = 20, cursor_y = 20 + txt->cursor_location_y * txt->line_height;
+        int cursor_x = 20, cursor_y = 20 + (txt->cursor_location_y - txt->first_visible_line) * txt->line_height;
         if (txt->cursor_location_x > 0) {
-            char cursor_prefix[MAX_TEXT_LEN];
-            strncpy(cursor_prefix, txt->lines[txt->cursor_location_y], txt->cursor_location_x);
-            cursor_prefix[txt->cursor_location_x] = '\0';
-            int w = 0, h = 0;
-            TTF_SizeText(txt->font, cursor_prefix, &w, &h);
-            cursor_x += w;
+            buffer_line(&txt->buf, txt->cursor_location_y, line, sizeof(line));
+            cursor_x += text_width(txt, line, txt->cursor_location_x);
         }
 
 
         Uint32 ticks = SDL_GetTicks();
-        if ((ticks / 500) % 2 == 0) {
+        int cursor_visible = txt->cursor_location_y >= txt->first_visible_line
+            && txt->cursor_location_y < txt->first_visible_line + txt->MAX_VISIBLE_LINES + 1;
+        if ((ticks / 500) % 2 == 0 && cursor_visible) {
             SDL_Rect cursor_rect = {cursor_x, cursor_y, 2, txt->line_height > 0 ? txt->line_height : 32};
             SDL_SetRenderDrawColor(win->renderer, 0, 0, 0, 255); // black cursor
             SDL_RenderFillRect(win->renderer, &cursor_rect);
         }
+        if ((ticks / 500) % 2 == 0) {
+            for (size_t k = first_cursor; k < txt->cursor_count && txt->cursors[k].head <= view_end; ++k) {
+                int y = (int)buffer_line_of(&txt->buf, txt->cursors[k].head);
+                int column = (int)(txt->cursors[k].head - buffer_line_start(&txt->buf, y));
+                if (y < txt->first_visible_line) continue;
+                SDL_Rect cursor_rect = {20, 20 + (y - txt->first_visible_line) * txt->line_height, 2, txt->line_height > 0 ? txt->line_height : 32};
+                if (column > 0) {
+                    buffer_line(&txt->buf, y, line, sizeof(line));
+                    cursor_rect.x += text_width(txt, line, column);
+                }
+                SDL_RenderFillRect(win->renderer, &cursor_rect);
+            }
+        }
 
         SDL_RenderPresent(win->renderer);
         SDL_Delay(10);
@@ -174,19 +458,715 @@ void render_all(sdlwindow *win, sdltext *txt){
 
 
 
-//file saving file here basic 
-void save_to_file(const char *filename, char lines[MAX_LINES][MAX_TEXT_LEN]) {
-    FILE *file = fopen(filename, "w");
-    if (!file) {
-        perror("Could not open file for writing");
+// one line of a read-only screen at current_render_y, 0 once the screen is full
+int draw_plain_line(sdlwindow *win, sdltext *txt, linecache *lines, const char *line, size_t len) {
+    int w, h;
+    SDL_Texture *tex = len > 0 ? linecache_get(lines, win->renderer, txt->font, txt->color, line, len, &w, &h) : NULL;
+    if (tex) {
+        SDL_Rect dst = {20, win->current_render_y, w, h};
+        if (txt->line_height == 0) txt->line_height = h;
+        if (win->current_render_y + h > win->window_height - 20) return 0;
+        SDL_RenderCopy(win->renderer, tex, NULL, &dst);
+    }
+    win->current_render_y += txt->line_height > 0 ? txt->line_height : 32;
+    return win->current_render_y <= win->window_height - 20;
+}
+
+
+
+// draws the open view instead of the document, read-only so there is no cursor or selection
+void render_view(sdlwindow *win, sdltext *txt, viewer *view, linecache *lines) {
+    SDL_SetRenderDrawColor(win->renderer, 255, 255, 255, 255);
+    SDL_RenderClear(win->renderer);
+    char line[MAX_TEXT_LEN];
+    for (size_t i = view->top; i < view->line_count; ++i) {
+        viewer_line(view, i, line, sizeof(line));
+        if (!draw_plain_line(win, txt, lines, line, strlen(line))) break;
+    }
+    if (win->status[0]) render_status(win, txt);
+    SDL_RenderPresent(win->renderer);
+    SDL_Delay(10);
+}
+
+
+
+// draws the last screen of the session from the text read for it, until the file it shows is in
+void render_preview(sdlwindow *win, sdltext *txt, linecache *lines, const char *text, size_t len) {
+    SDL_SetRenderDrawColor(win->renderer, 255, 255, 255, 255);
+    SDL_RenderClear(win->renderer);
+    char line[MAX_TEXT_LEN];
+    const char *p = text, *end = text + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (size_t)((nl ? nl : end) - p);
+        const char *next = nl ? nl + 1 : end;
+        if (n > 0 && p[n - 1] == '\r') n--;
+        if (n > sizeof(line) - 1) n = sizeof(line) - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        if (!draw_plain_line(win, txt, lines, line, n)) break;
+        p = next;
+    }
+    if (win->status[0]) render_status(win, txt);
+    SDL_RenderPresent(win->renderer);
+    SDL_Delay(10);
+}
+
+
+
+// the hex view is what the window shows: over the viewed file while a view is open, over the document otherwise
+int hex_showing(hexview *hex, viewer *view) {
+    return hex->active && (hex->view != NULL) == (view->fd >= 0);
+}
+
+
+
+// draws the document or the viewed file as bytes instead of lines, only the rows on screen are read
+void render_hex(sdlwindow *win, sdltext *txt, hexview *hex) {
+    SDL_SetRenderDrawColor(win->renderer, 255, 255, 255, 255);
+    SDL_RenderClear(win->renderer);
+    hexview_render(hex, win, txt);
+    if (win->status[0]) render_status(win, txt);
+    SDL_RenderPresent(win->renderer);
+    SDL_Delay(10);
+}
+
+
+
+// keys while a view is open, they only move it. 1 when esc closed it
+int view_key(sdltext *txt, viewer *view, SDL_Keycode sym, Uint16 mod) {
+    size_t page = txt->MAX_VISIBLE_LINES > 0 ? (size_t)txt->MAX_VISIBLE_LINES : 1;
+    size_t last = view->line_count > page ? view->line_count - page : 0;
+    if (view->finding < 0) view->finding = 0;   // "not found" stays up until the next key
+    if (sym == SDLK_ESCAPE) {
+        viewer_close(view);
+        return 1;
+    } else if (sym == SDLK_f && (mod & KMOD_CTRL)) {   // searched a frame at a time, the line with the match goes on top
+        const char *answer = tinyfd_inputBox("Find", "Text:", view->find);
+        if (answer) viewer_find(view, answer, view->top);
+        return 0;
+    } else if (sym == SDLK_F3) {   // the next match after the top line
+        if (view->find_len > 0) viewer_find(view, view->find, view->top + 1);
+        return 0;
+    } else if (sym == SDLK_UP) {
+        if (view->top > 0) view->top--;
+    } else if (sym == SDLK_DOWN) {
+        view->top++;
+    } else if (sym == SDLK_PAGEUP) {
+        view->top = view->top > page ? view->top - page : 0;
+    } else if (sym == SDLK_PAGEDOWN) {
+        view->top += page;
+    } else if ((sym == SDLK_HOME && (mod & KMOD_CTRL))) {
+        view->top = 0;
+    } else if ((sym == SDLK_END && (mod & KMOD_CTRL))) {
+        view->top = last;
+    } else if ((sym == SDLK_g) && (mod & KMOD_CTRL)) {   // lines not indexed yet are as far as it goes
+        const char *answer = tinyfd_inputBox("Go to line", "Line number:", "");
+        if (answer && atol(answer) > 0) {
+            size_t line = (size_t)atol(answer) - 1;
+            view->top = line > page / 2 ? line - page / 2 : 0;
+        }
+    }
+    if (view->top > last) view->top = last;
+    return 0;
+}
+
+
+
+// inserts a burst of typed text with one buffer insert and one invalidation. Lines are never too long for it,
+// what goes past the right edge or past MAX_TEXT_LEN bytes is only clipped when drawn
+void insert_text(sdltext *txt, minimap *map, const char *text, size_t len) {
+    if (len == 0 || text_insert(txt, cursor_offset(txt), text, len) != 0) return;
+    txt->cursor_location_x += (int)len;
+    minimap_invalidate(map, txt->cursor_location_y, txt->cursor_location_y);
+}
+
+
+
+// pastes our own copy by reference, or the system clipboard as one piece no matter how many lines it holds
+void paste_clipboard(sdltext *txt, minimap *map, clipboard *clip) {
+    undo_begin(&txt->undo, cursor_offset(txt));
+    if (txt->cursor_count > 0) {   // every cursor gets the same pieces, system text is stored once for all of them
+        const piece *pieces;
+        size_t count;
+        piece stored;
+        if (clipboard_pieces(clip, &pieces, &count) != 0) {
+            char *text = SDL_GetClipboardText();
+            int ok = text && text[0] && buffer_store(&txt->buf, text, strlen(text), &stored) == 0;
+            if (text) SDL_free(text);
+            pieces = &stored;
+            count = ok ? 1 : 0;
+        }
+        if (count > 0) cursors_replace(txt, map, pieces, count, 0);
+        undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
         return;
     }
-    for (int i = 0; i < MAX_LINES; ++i) {
-        if (strlen(lines[i]) > 0) {
-            fprintf(file, "%s\n", lines[i]);
+    delete_selection(txt, map);
+    size_t offset = cursor_offset(txt);
+    int first_line = txt->cursor_location_y;
+    size_t len = 0;
+    if (clipboard_paste(clip, &txt->buf, offset, &len) == 0) {
+        undo_record_insert(&txt->undo, &txt->buf, offset, len);
+    } else {
+        char *text = SDL_GetClipboardText();
+        if (text) {
+            len = strlen(text);
+            if (len > 0 && text_insert(txt, offset, text, len) != 0) len = 0;
+            SDL_free(text);
         }
     }
-    fclose(file);
+    if (len > 0) {
+        set_cursor_offset(txt, offset + len);
+        minimap_invalidate(map, first_line, txt->cursor_location_y == first_line ? first_line : -1);
+    }
+    clear_selection(txt);
+    undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
+}
+
+
+
+// ctrl+z and ctrl+y, the cursor goes back to where the change happened
+void apply_undo(sdltext *txt, minimap *map, int redo) {
+    size_t cursor, first_offset;
+    int done = redo ? undo_redo(&txt->undo, &txt->buf, &cursor, &first_offset)
+                    : undo_undo(&txt->undo, &txt->buf, &cursor, &first_offset);
+    if (done != 0) return;
+    cursors_clear(txt);
+    if (cursor > buffer_length(&txt->buf)) cursor = buffer_length(&txt->buf);
+    set_cursor_offset(txt, cursor);
+    clear_selection(txt);
+    minimap_invalidate(map, (int)buffer_line_of(&txt->buf, first_offset), -1);
+}
+
+
+
+// typed text at the cursor or at every cursor, one undo step per word like typing it by hand
+void type_text(sdltext *txt, minimap *map, const char *text, size_t len) {
+    if (len == 0) return;
+    Uint32 now = SDL_GetTicks();
+    size_t offset = cursor_offset(txt);
+    if (has_selection(txt) || !undo_continue(&txt->undo, UNDO_TYPING, offset, text[0], now)) {
+        undo_begin(&txt->undo, offset);
+    }
+    if (txt->cursor_count > 0) {
+        cursors_insert(txt, map, text, len); // one batch for all cursors, no width check per line
+    } else {
+        delete_selection(txt, map); // typing replaces the selection
+        insert_text(txt, map, text, len);
+    }
+    clear_selection(txt);
+    undo_end(&txt->undo, cursor_offset(txt), UNDO_TYPING, text[len - 1], now);
+    scroll_to_cursor(txt);
+}
+
+
+// applies everything collected from SDL_TEXTINPUT events since the last flush
+void flush_text_input(sdltext *txt, minimap *map, textinput *pending) {
+    type_text(txt, map, pending->text, pending->len);
+    pending->len = 0;
+}
+
+
+// collects the text of one SDL_TEXTINPUT event into pending. Whatever is pending goes in first when the event
+// would not fit, events are never cut so pending always ends on a character boundary (one holds 31 bytes at most)
+void collect_text_input(sdltext *txt, minimap *map, textinput *pending, macro *keys, const char *text) {
+    size_t len = strlen(text);
+    if (len > sizeof(pending->text) - pending->len) flush_text_input(txt, map, pending);
+    if (len > sizeof(pending->text)) len = sizeof(pending->text);
+    memcpy(pending->text + pending->len, text, len);
+    macro_record_text(keys, text, len);
+    pending->len += len;
+}
+
+
+// one key press, called from the event loop and by macro replay
+void handle_key(sdltext *txt, minimap *map, clipboard *clip, SDL_Keycode sym, Uint16 mod) {
+    int moving = sym == SDLK_UP || sym == SDLK_DOWN || sym == SDLK_LEFT || sym == SDLK_RIGHT ||
+        sym == SDLK_PAGEUP || sym == SDLK_PAGEDOWN || sym == SDLK_HOME || sym == SDLK_END;
+    int shift = (mod & KMOD_SHIFT) != 0;
+    if (moving && shift && !has_selection(txt)) {
+        txt->sel.anchor = cursor_offset(txt);   // shift + arrows start selecting from here
+    }
+
+    if ((sym == SDLK_v) && (mod & KMOD_CTRL)) {   // paste
+
+        paste_clipboard(txt, map, clip);
+
+    }
+    else if ((sym == SDLK_c || sym == SDLK_x) && (mod & KMOD_CTRL)) {   // copy and cut
+
+        if (has_selection(txt)) {
+            size_t start, end;
+            selection_range(txt, &start, &end);
+            clipboard_copy(clip, &txt->buf, start, end - start);  // only pieces, the text is not copied
+            if (sym == SDLK_x) {
+                undo_begin(&txt->undo, cursor_offset(txt));
+                delete_selection(txt, map);
+                undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
+            }
+        }
+
+    }
+    else if ((sym == SDLK_a) && (mod & KMOD_CTRL)) {   // select all
+
+        cursors_clear(txt);
+        txt->sel.anchor = 0;
+        set_cursor_offset(txt, buffer_length(&txt->buf));
+        txt->sel.head = buffer_length(&txt->buf);
+
+    }
+    else if ((sym == SDLK_z) && (mod & KMOD_CTRL)) {   // undo, with shift redo
+
+        apply_undo(txt, map, shift);
+
+    }
+    else if ((sym == SDLK_y) && (mod & KMOD_CTRL)) {   // redo
+
+        apply_undo(txt, map, 1);
+
+    }
+    else if ((sym == SDLK_d) && (mod & KMOD_CTRL)) {   // select the next occurrence too
+
+        cursors_select_next(txt);
+
+    }
+    else if ((sym == SDLK_i) && (mod & KMOD_ALT) && shift) {   // a cursor on every selected line
+
+        cursors_split_lines(txt);
+
+    }
+    else if ((sym == SDLK_g) && (mod & KMOD_CTRL)) {   // go to line
+
+        const char *answer = tinyfd_inputBox("Go to line", "Line number:", "");
+        if (answer && atol(answer) > 0) {
+            long line = atol(answer) - 1;
+            if (line > text_line_count(txt) - 1) line = text_line_count(txt) - 1;
+            cursors_clear(txt);
+            clear_selection(txt);
+            undo_break(&txt->undo);
+            txt->cursor_location_y = (int)line;
+            txt->cursor_location_x = 0;
+            scroll_to_line(txt, txt->cursor_location_y);   // centered, scroll_to_cursor below leaves it there
+        }
+
+    }
+    else if (sym == SDLK_ESCAPE) {
+
+        cursors_clear(txt);
+
+    }
+    else if (sym == SDLK_BACKSPACE && txt->cursor_count > 0) {
+
+        undo_begin(&txt->undo, cursor_offset(txt));
+        cursors_replace(txt, map, NULL, 0, 1);
+        undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
+
+    }
+    else if ((sym == SDLK_RETURN || sym == SDLK_KP_ENTER) && txt->cursor_count > 0) {
+
+        undo_begin(&txt->undo, cursor_offset(txt));
+        cursors_insert(txt, map, txt->line_break, strlen(txt->line_break));
+        undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, '\n', SDL_GetTicks());
+
+    }
+    else if (sym == SDLK_BACKSPACE && has_selection(txt)) {
+
+        undo_begin(&txt->undo, cursor_offset(txt));
+        delete_selection(txt, map);
+        undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
+
+    }
+    else if (sym == SDLK_BACKSPACE && txt->cursor_location_x > 0) {
+
+        size_t offset = cursor_offset(txt), start = buffer_char_before(&txt->buf, offset);
+        erase_char(txt, start, offset - start);                // backspace behavior for more than 1 word
+        txt->cursor_location_x -= (int)(offset - start); // the whole character goes, not just its last byte
+        minimap_invalidate(map, txt->cursor_location_y, txt->cursor_location_y);
+        
+    } else if (sym == SDLK_BACKSPACE && txt->cursor_location_x == 0) {
+        if (txt->cursor_location_y > 0) {                //backspace at the 0th coloumn joins the line onto the one above
+
+            size_t offset = cursor_offset(txt), start = buffer_char_before(&txt->buf, offset);
+            txt->cursor_location_y--;
+            txt->cursor_location_x = line_length(txt, txt->cursor_location_y);
+            erase_char(txt, start, offset - start);   // all of the line break, "\r\n" too
+            minimap_invalidate(map, txt->cursor_location_y, -1); // every line below moved
+          
+        }
+    } else if (sym == SDLK_RETURN || sym == SDLK_KP_ENTER) {
+        undo_begin(&txt->undo, cursor_offset(txt));
+        delete_selection(txt, map);
+        // Clamp cursor_location_x to the end of the line
+        if (txt->cursor_location_x > line_length(txt, txt->cursor_location_y)) {
+
+            txt->cursor_location_x = line_length(txt, txt->cursor_location_y);
+
+        }
+        // text after the cursor ends up on the new line
+        if (text_insert(txt, cursor_offset(txt), txt->line_break, strlen(txt->line_break)) == 0) {
+            minimap_invalidate(map, txt->cursor_location_y, -1); // every line below moved
+            txt->cursor_location_y++;
+            txt->cursor_location_x = 0;
+        } 
+        undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, '\n', SDL_GetTicks());
+        // arrow key movement :
+    } else if (sym == SDLK_UP) {
+        if (txt->cursor_location_y > 0) {
+            move_to_line(txt, txt->cursor_location_y - 1);       //if more rows than the first then just move up
+        }
+    } else if (sym == SDLK_DOWN) {
+        if (txt->cursor_location_y < text_line_count(txt) - 1) {
+            move_to_line(txt, txt->cursor_location_y + 1);       // if less rows than the max move down
+        }
+    } else if (sym == SDLK_PAGEUP || sym == SDLK_PAGEDOWN) {
+        int page = txt->MAX_VISIBLE_LINES > 1 ? txt->MAX_VISIBLE_LINES - 1 : 1;   // one line of the old page stays in view
+        int line = txt->cursor_location_y + (sym == SDLK_PAGEUP ? -page : page);
+        if (line < 0) line = 0;
+        if (line > text_line_count(txt) - 1) line = text_line_count(txt) - 1;
+        cursors_clear(txt);
+        txt->first_visible_line += line - txt->cursor_location_y;   // the view moves with the cursor
+        if (txt->first_visible_line > text_line_count(txt) - txt->MAX_VISIBLE_LINES) {
+            txt->first_visible_line = text_line_count(txt) - txt->MAX_VISIBLE_LINES;
+        }
+        if (txt->first_visible_line < 0) txt->first_visible_line = 0;
+        move_to_line(txt, line);
+    } else if ((sym == SDLK_HOME || sym == SDLK_END) && (mod & KMOD_CTRL)) {   // start or end of the document
+        cursors_clear(txt);
+        set_cursor_offset(txt, sym == SDLK_HOME ? 0 : buffer_length(&txt->buf));
+    } else if (sym == SDLK_HOME) {
+        txt->cursor_location_x = 0;
+    } else if (sym == SDLK_END) {
+        txt->cursor_location_x = line_length(txt, txt->cursor_location_y);
+    } else if (sym == SDLK_RIGHT) {   // a character at a time, over all of its bytes
+        if (txt->cursor_location_x < line_length(txt, txt->cursor_location_y)) {
+            size_t offset = cursor_offset(txt);
+            txt->cursor_location_x += (int)(buffer_char_after(&txt->buf, offset) - offset);
+        }
+    } else if (sym == SDLK_LEFT) {
+        if (txt->cursor_location_x > 0) {
+            size_t offset = cursor_offset(txt);
+            txt->cursor_location_x -= (int)(offset - buffer_char_before(&txt->buf, offset));
+        }
+    }
+    if (moving) {
+        undo_break(&txt->undo);   // typing somewhere else is a new undo step
+    }
+    if (moving && shift) {
+        txt->sel.head = cursor_offset(txt);
+    } else if (moving || sym == SDLK_RETURN || sym == SDLK_KP_ENTER || sym == SDLK_BACKSPACE) {
+        clear_selection(txt);
+    }
+    if (moving && txt->cursor_count > 0) {
+        cursors_move(txt, sym, shift);
+    }
+    scroll_to_cursor(txt);
+}
+
+
+// runs the recorded steps count times back to back, nothing is polled or drawn until the last run is done.
+// Stops early once a run leaves the text and the cursor where they were, it would not do anything anymore
+void play_macro(sdltext *txt, minimap *map, clipboard *clip, macro *m, long count) {
+    if (m->recording || m->count == 0) return;
+    for (long run = 0; run < count; ++run) {
+        size_t length = buffer_length(&txt->buf), cursor = cursor_offset(txt), undo_at = txt->undo.current;
+        for (size_t k = 0; k < m->count; ++k) {
+            macro_step *step = &m->steps[k];
+            if (step->type == MACRO_TEXT) {
+                type_text(txt, map, m->text + step->text, step->len);
+            } else {
+                handle_key(txt, map, clip, step->sym, step->mod);
+            }
+        }
+        undo_break(&txt->undo);   // typing of the next run is its own undo step
+        if (buffer_length(&txt->buf) == length && cursor_offset(txt) == cursor && txt->undo.current == undo_at) break;
+    }
+}
+
+
+// asks whether to bring back what a crashed session left in a journal
+int ask_recover(const char *what) {
+    char message[512];
+    snprintf(message, sizeof(message), "%s has unsaved edits from a session that crashed. Bring them back?", what);
+    return tinyfd_messageBox("beditor", message, "yesno", "question", 1) == 1;
+}
+
+
+// after a recovery the cursor goes where the last replayed edit left it
+void place_recovered(sdltext *txt) {
+    size_t cursor = txt->undo.current > 0 ? txt->undo.groups[txt->undo.current - 1].cursor_after : 0;
+    if (cursor > buffer_length(&txt->buf)) cursor = buffer_length(&txt->buf);
+    set_cursor_offset(txt, cursor);
+    scroll_to_cursor(txt);
+}
+
+
+// puts the loaded file in place of the document, everything pointing into the old storage goes with it.
+// 1 when edits a crashed session left for it came back
+int open_document(sdltext *txt, minimap *map, clipboard *clip, journal *jr, save_base *base, loader *l) {
+    clipboard_move(clip, &txt->buf, &l->buf);   // what was copied can still be pasted in the new one
+    cursors_clear(txt);
+    undo_free(&txt->undo);
+    buffer_free(&txt->buf);
+    journal_free(jr);   // after the buffer, restored pieces point into it
+    txt->buf = l->buf;
+    txt->encoding = l->enc;
+    txt->line_break = l->enc.crlf * 2 > l->enc.lf ? "\r\n" : "\n";
+    if (l->enc.kind == ENCODING_UTF8) {
+        save_base_set(base, &txt->buf, &l->st, &l->blocks);   // the next save only writes and hashes what changed
+    } else {
+        save_base_free(base);   // the storage holds the transcoded text, not the bytes of the file
+    }
+    free(txt->path);
+    txt->path = l->path;
+    l->path = NULL;
+    uint64_t hash = l->hash;
+    loader_finish(l);
+    txt->cursor_location_x = txt->cursor_location_y = 0;
+    txt->first_visible_line = 0;
+    txt->sel.anchor = txt->sel.head = 0;
+    txt->preferred_x = -1;
+    minimap_invalidate(map, 0, -1);
+    const char *slash = strrchr(txt->path, '/');
+    int recover = journal_unsaved(txt->path, hash) > 0 && ask_recover(slash ? slash + 1 : txt->path);
+    // the history comes back if the file did not change, a fresh journal starts if there is none
+    int replayed = journal_restore(jr, txt->path, hash, &txt->buf, &txt->undo, recover);
+    if (replayed < 0) journal_open(jr, txt->path, hash);
+    journal_file(jr, base->pieces, base->count);   // text deleted from the file is not copied
+    if (replayed > 0) place_recovered(txt);
+    return replayed > 0;
+}
+
+
+
+// brings back what the last run had open, the file on top first. Its last screen is read on its own to be
+// painted right away, everything else loads in the background. Returns that screen's text or NULL
+char *restore_session(session *s, viewer *view, loader *load, size_t *preview_len) {
+    char *preview = NULL;
+    for (size_t i = 0; i < s->count; ++i) {   // at most SESSION_FILES, nothing here reads a whole file
+        session_record *r = &s->files[i];
+        int opened = r->kind == SESSION_VIEW ? viewer_open(view, s->paths[i]) : loader_start(load, s->paths[i]);
+        if (opened != 0) continue;
+        if (r->kind == SESSION_VIEW) view->top = (size_t)r->top;
+        if (i == 0) preview = session_preview(r, s->paths[i], preview_len);
+    }
+    return preview;
+}
+
+
+
+// puts the cursor and the scroll position back where the session had them, if the loaded file (st) is still
+// the one they were in
+void place_session(sdltext *txt, session *s, const struct stat *st) {
+    for (size_t i = 0; i < s->count; ++i) {
+        session_record *r = &s->files[i];
+        if (r->kind != SESSION_DOCUMENT || strcmp(s->paths[i], txt->path) != 0 || !session_fresh(r, st)) continue;
+        size_t length = buffer_length(&txt->buf), lines = buffer_line_count(&txt->buf);
+        set_cursor_offset(txt, r->cursor < length ? (size_t)r->cursor : length);
+        txt->sel.anchor = txt->sel.head = cursor_offset(txt);
+        txt->first_visible_line = (int)(r->top < lines ? r->top : lines - 1);
+    }
+}
+
+
+
+// writes what is open for the next start: the view if there is one, it is on top, then the document under it
+void remember_session(sdltext *txt, viewer *view, save_base *base) {
+    session s;
+    session_init(&s);
+    struct stat st;
+    if (view->fd >= 0 && stat(view->path, &st) == 0) {
+        char c;
+        viewer_line(view, view->top, &c, 1);
+        uint64_t top_offset = view->mapped && view->at_line == view->top ? view->at_offset : UINT64_MAX;
+        session_add(&s, SESSION_VIEW, view->path, &st, 0, view->top, top_offset);
+    }
+    if (txt->path) {   // unsaved edits moved things around, the positions are kept but not the file they fit
+        size_t top = (size_t)txt->first_visible_line;
+        const struct stat *disk = save_base_same(base, &txt->buf) ? &base->st : NULL;
+        session_add(&s, SESSION_DOCUMENT, txt->path, disk, cursor_offset(txt), top, buffer_line_start(&txt->buf, top));
+    }
+    session_save(&s);
+    session_free(&s);
+}
+
+
+// snapshots the document and starts writing it to filename, NULL if that could not start
+save_job *start_save(sdltext *txt, journal *jr, save_base *base, const char *filename) {
+    undo_break(&txt->undo);   // undo stops right at the saved state
+    journal_save_start(jr, filename, &txt->buf, &txt->undo);
+    save_job *job = save_start(filename, &txt->buf, base, &txt->encoding);
+    if (!job) {
+        journal_save_done(jr, 0, 0);
+        journal_file(jr, base->pieces, base->count);
+    }
+    return job;
+}
+
+
+// a background save is over, the journal only marks the saved state once the file is complete
+void finish_save(sdltext *txt, journal *jr, save_base *base, save_job *job) {
+    save_wait(job);
+    journal_save_done(jr, job->result == 0, job->hash);
+    save_base_take(base, job);
+    journal_file(jr, base->pieces, base->count);
+    if (job->result == 0) txt->encoding.kind = job->enc.kind;   // latin-1 that had to become utf-8
+    if (job->result == 0 && (!txt->path || strcmp(txt->path, job->path) != 0)) {
+        free(txt->path);
+        txt->path = strdup(job->path);
+    }
+    save_free(job);
+}
+
+
+// where an offset of the document ends up once c happened to it, inside the changed range it keeps its
+// distance from the start as far as the new text allows
+size_t reload_offset(size_t offset, const watch_change *c) {
+    if (offset <= c->offset) return offset;
+    if (offset >= c->offset + c->old_len) return offset - c->old_len + c->new_len;
+    return c->offset + (offset - c->offset < c->new_len ? offset - c->offset : c->new_len);
+}
+
+
+// another program changed the open file, it is compared with what was last read or saved on a thread of its
+// own. NULL when there is nothing to compare
+watch_job *reload_start(sdltext *txt, save_base *base) {
+    if (txt->encoding.kind != ENCODING_UTF8) return NULL;   // a transcoded file cannot be compared with the storage
+    int fd = txt->path ? open(txt->path, O_RDONLY) : -1;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || save_base_fresh(base, &st)) {   // gone, or our own save
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    return watch_start(base, &txt->buf, fd, &st);
+}
+
+
+
+// the compare is done. Only the bytes that differ from what was last read or saved are taken over, as one
+// undo step, and the cursor and view stay on the text they were on. With unsaved edits it asks first, the
+// whole document then becomes the new file and undo brings the edits back. Frees job
+void reload_finish(sdltext *txt, minimap *map, save_base *base, watch_job *job) {
+    if (watch_step(job) != 0 || !save_base_fresh(base, &job->base_st)) {   // unreadable, or saved over since
+        watch_job_free(job);
+        return;
+    }
+    watch_change c = job->change;
+    size_t len = (size_t)job->st.st_size;
+    int clean = save_base_same(base, &txt->buf);
+    if (c.old_len == 0 && c.new_len == 0) {   // only touched
+        base->st = job->st;
+        watch_job_free(job);
+        return;
+    }
+    const char *slash = strrchr(txt->path, '/');
+    char message[512];
+    snprintf(message, sizeof(message), "%s changed on disk. Load the new version? Undo brings your edits back.",
+        slash ? slash + 1 : txt->path);
+    if (!clean && tinyfd_messageBox("beditor", message, "yesno", "question", 1) != 1) {
+        watch_job_free(job);
+        save_base_free(base);   // the next save writes the whole file
+        return;
+    }
+    piece mid = {0};
+    if (c.new_len && buffer_store(&txt->buf, job->mid, c.new_len, &mid) != 0) {
+        watch_job_free(job);
+        return;
+    }
+
+    // the edit on the document, the range itself when it still is the file, otherwise all of it
+    watch_change edit = c;
+    piece *ins = &mid;
+    size_t n = c.new_len ? 1 : 0;
+    if (!clean) {
+        ins = watch_pieces(base, &txt->buf, &c, &mid, &n);
+        if (!ins) {
+            watch_job_free(job);
+            return;
+        }
+        edit.offset = 0;
+        edit.old_len = buffer_length(&txt->buf);
+        edit.new_len = len;
+    }
+    size_t cursor = cursor_offset(txt);
+    int first_line = (int)buffer_line_of(&txt->buf, edit.offset);
+    int old_end = (int)buffer_line_of(&txt->buf, edit.offset + edit.old_len);
+    cursors_clear(txt);
+    undo_break(&txt->undo);
+    undo_begin(&txt->undo, cursor);
+    if (edit.old_len) text_delete(txt, edit.offset, edit.old_len);
+    if (n && buffer_insert_pieces(&txt->buf, edit.offset, ins, n) == 0) {
+        undo_record_pieces(&txt->undo, UNDO_INSERT, edit.offset, edit.new_len, ins, n);
+    }
+    if (ins != &mid) free(ins);
+    set_cursor_offset(txt, reload_offset(cursor, &edit));
+    txt->sel.anchor = reload_offset(txt->sel.anchor, &edit);
+    txt->sel.head = reload_offset(txt->sel.head, &edit);
+    undo_end(&txt->undo, cursor_offset(txt), UNDO_OTHER, 0, SDL_GetTicks());
+    undo_break(&txt->undo);
+    txt->preferred_x = -1;
+
+    // lines below the change moved by as many as it added or removed
+    int new_end = (int)buffer_line_of(&txt->buf, edit.offset + edit.new_len);
+    if (txt->first_visible_line > first_line) {
+        txt->first_visible_line += new_end - old_end;
+        if (txt->first_visible_line < first_line) txt->first_visible_line = first_line;
+    }
+    minimap_invalidate(map, first_line, first_line == old_end && first_line == new_end ? first_line : -1);
+    save_base_set(base, &txt->buf, &job->st, &job->blocks);   // the hashes of the file came with the compare
+    watch_job_free(job);
+}
+
+
+// follow mode. While the file only grows and the document still is what was read, the new bytes are read
+// straight into the storage and added at the end, each block costing the same however long the file got.
+// The view stays at the bottom if it was there. Returns 1 while more is left for the next frame, -1 when the
+// file changed some other way and is compared like without follow mode
+int follow_document(sdltext *txt, minimap *map, save_base *base, watcher *w) {
+    if (w->synced != txt->buf.version && !save_base_same(base, &txt->buf)) {   // edited here, stop following
+        watch_follow(w, 0);
+        return -1;
+    }
+    struct stat st;
+    int fd = txt->path ? open(txt->path, O_RDONLY) : -1;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    size_t have = buffer_length(&txt->buf);
+    if (st.st_dev != base->st.st_dev || st.st_ino != base->st.st_ino || (size_t)st.st_size < have) {
+        close(fd);   // rotated or truncated, compared like any other change
+        return -1;
+    }
+    int line_count = text_line_count(txt);
+    int at_bottom = txt->first_visible_line + txt->MAX_VISIBLE_LINES >= line_count;
+    int at_end = cursor_offset(txt) == have;
+    size_t read_to = have;
+    Uint32 start = SDL_GetTicks();
+    while (read_to < (size_t)st.st_size && SDL_GetTicks() - start < LOADER_BUDGET_MS) {
+        size_t want = (size_t)st.st_size - read_to;
+        if (want > LOADER_BLOCK) want = LOADER_BLOCK;
+        int chunk;
+        char *dst = buffer_reserve(&txt->buf, want, &chunk);
+        ssize_t n = dst ? pread(fd, dst, want, (off_t)read_to) : -1;
+        if (n <= 0) break;
+        size_t from = (size_t)(dst - txt->buf.chunks[chunk].data);
+        if (buffer_commit(&txt->buf, chunk, (size_t)n) != 0) break;
+        save_base_append(base, buffer_chunk_piece(&txt->buf, chunk, from, (size_t)n), dst);
+        read_to += (size_t)n;
+    }
+    close(fd);
+    base->st = st;
+    base->st.st_size = (off_t)read_to;   // what the pieces hold, the rest comes next frame
+    w->synced = txt->buf.version;
+    if (read_to > have) {
+        if (at_end) set_cursor_offset(txt, read_to);
+        if (at_bottom) {
+            int first = text_line_count(txt) - txt->MAX_VISIBLE_LINES;
+            txt->first_visible_line = first > 0 ? first : 0;
+        }
+        minimap_invalidate(map, line_count - 1, -1);
+    }
+    return read_to < (size_t)st.st_size;
 }
 
 
@@ -194,6 +1174,9 @@ int main(int argc, char *argv[])
 {
     sdlwindow win;
     sdltext txt;
+    minimap map;
+    textinput pending;
+    clipboard clip;
 
     win.window = NULL;
     win.renderer = NULL;
@@ -206,8 +1189,11 @@ int main(int argc, char *argv[])
     win.window_width = WINDOW_WIDTH_INITIAL;
     win.window_height = WINDOW_HEIGHT_INITIAL;
     win.current_render_y = 0;
+    win.status[0] = '\0';
+    win.status_progress = 0;
 
-    memset(txt.lines, 0, sizeof(txt.lines));
+    buffer_init(&txt.buf);
+    undo_init(&txt.undo);
     txt.line_height = 0;
     txt.color.r = 0;
     txt.color.g = 0;
@@ -218,14 +1204,80 @@ int main(int argc, char *argv[])
     txt.text_h = 0;
     txt.cursor_location_y = 0;
     txt.cursor_location_x = 0;
+    txt.first_visible_line = 0;
+    txt.sel.anchor = txt.sel.head = 0;
+    txt.path = NULL;
+    encoding_init(&txt.encoding);
+    txt.line_break = "\n";
+    txt.cursors = NULL;
+    txt.preferred_x = -1;
+    txt.preferred_at = 0;
+    txt.cursor_count = txt.cursor_cap = 0;
+    pending.len = 0;
+    clipboard_init(&clip);
+    int text_drag = 0;
+    minimap_init(&map);
+    int minimap_drag = 0;
+    blockdrag block = {0};
+    journal undo_journal;
+    journal_init(&undo_journal);
+    macro keys;
+    macro_init(&keys);
+    loader load;
+    loader_init(&load);
+    save_job *saving = NULL;
+    char *save_next = NULL;   // ctrl+s while a save or a compare was still running
+    save_base base;
+    save_base_init(&base);
+    watcher watch;
+    watch_init(&watch);
+    watch_job *comparing = NULL;   // the open file changed on disk and is being compared with the document
+    linecache lines;
+    linecache_init(&lines);
+    viewer view;   // a gzip file, or any file with --view, opened read-only on top of the document
+    viewer_init(&view);
+    session last;   // what the last run had open, until the document of it is loaded
+    session_init(&last);
+    char *preview = NULL;   // its last screen, painted until the file it shows is ready
+    size_t preview_len = 0;
+    int preview_view = 0;
+    hexview hex;   // the document as bytes, ctrl+h switches
+    hexview_init(&hex);
     
     setup_WIN_REN_TTF(&win,&txt); // call setup 
 
+    int view_only = argc > 2 && strcmp(argv[1], "--view") == 0;   // beditor --view <file> shows any file read-only
+    const char *open_path = view_only ? argv[2] : argc > 1 ? argv[1] : NULL;
+    char *crashed = open_path ? NULL : journal_crashed_untitled();
+    int recovered = 0;
+    if (crashed) {   // typing that never made it into a file
+        if (ask_recover("An untitled document") &&
+            journal_recover_untitled(&undo_journal, crashed, &txt.buf, &txt.undo) > 0) {
+            place_recovered(&txt);
+            recovered = 1;
+        } else {
+            unlink(crashed);
+        }
+        free(crashed);
+    }
+    if (undo_journal.fd < 0) journal_untitled(&undo_journal);
+    if (open_path && (view_only || viewer_wants(open_path))) {
+        viewer_open(&view, open_path);   // mapped, never read in as a whole
+    } else if (open_path) {
+        loader_start(&load, open_path);   // beditor <file> opens it like ctrl+o would
+    } else if (!recovered && session_load(&last) == 0) {
+        preview = restore_session(&last, &view, &load, &preview_len);
+        preview_view = last.count > 0 && last.files[0].kind == SESSION_VIEW;
+    }
+
     while (running) {
     txt.MAX_VISIBLE_LINES = (win.window_height - 95) / (txt.line_height > 0 ? txt.line_height : 32); // calcultes visible lines
     win.current_render_y = 20;
 
         while (SDL_PollEvent(&event)) {
+            if (event.type != SDL_TEXTINPUT) {
+                flush_text_input(&txt, &map, &pending); // keep typed text ordered before keys and clicks
+            }
             if (event.type == SDL_QUIT) {
 
                 running = 0;  // stop program if you exit via SDL_quit
@@ -236,121 +1288,289 @@ int main(int argc, char *argv[])
                     win.window_width = event.window.data1;
                     win.window_height = event.window.data2;
                     
+                } else if (event.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
+
+                    clipboard_offer(&clip, &txt.buf); // another program could paste now
+
                 }
-            } else if (event.type == SDL_KEYDOWN) {  // if button is pressed
-                if ((event.key.keysym.sym == SDLK_s) && (event.key.keysym.mod & KMOD_CTRL)) {   // for saving with tinyfiledialog
+            } else if (saving && event.type == save_event_type() && event.user.data1 == saving) {
+
+                finish_save(&txt, &undo_journal, &base, saving);
+                watch_set(&watch, txt.path);   // a save to a new name moves the watch along
+                saving = save_next ? start_save(&txt, &undo_journal, &base, save_next) : NULL;
+                free(save_next);
+                save_next = NULL;
 
-                    const char *filename = tinyfd_saveFileDialog("Save As", "output.txt", 0, NULL, NULL);
+            } else if (event.type == SDL_CLIPBOARDUPDATE) {
 
-                if (filename) {
+                clipboard_update(&clip, &txt.buf);
 
-                save_to_file(filename, txt.lines);  // calls function above
+            } else if (event.type == SDL_KEYDOWN) {  // if button is pressed
+                SDL_Keycode sym = event.key.keysym.sym;
+                Uint16 mod = event.key.keysym.mod;
+                if (load.fd >= 0) {   // the document is about to be replaced, only esc does something
 
+                    if (sym == SDLK_ESCAPE) {
+                        loader_cancel(&load);
                     }
-                }
-                else if (event.key.keysym.sym == SDLK_BACKSPACE && txt.cursor_location_x > 0) {
 
-                    size_t len = strlen(txt.lines[txt.cursor_location_y]);                // backspace behavior for more than 1 word
-                    memmove(&txt.lines[txt.cursor_location_y][txt.cursor_location_x - 1],&txt.lines[txt.cursor_location_y][txt.cursor_location_x],len - txt.cursor_location_x + 1);  // move location x+1 and x-1 to accomodate deletion 
-                    txt.cursor_location_x--; // decrement location on backspace
-                    
-                } else if (event.key.keysym.sym == SDLK_BACKSPACE && txt.cursor_location_x == 0) {
-                    if (txt.cursor_location_y > 0) {                //backspace behavior for going up reaching the 0th coloumn
+                } else if (view.fd >= 0 && !(sym == SDLK_o && (mod & KMOD_CTRL))) {   // the view is on top, the document waits under it
 
-                        txt.cursor_location_y--;
-                        txt.cursor_location_x = strlen(txt.lines[txt.cursor_location_y]);
-                      
+                    if ((sym == SDLK_h && (mod & KMOD_CTRL)) || (hex_showing(&hex, &view) && sym == SDLK_ESCAPE)) {
+                        if (hex_showing(&hex, &view)) {   // back to its lines where they were
+                            hex.active = 0;
+                            hex.view = NULL;
+                        } else {
+                            hexview_open_view(&hex, &txt, &view);   // the file's bytes, read-only
+                        }
+                    } else if (hex_showing(&hex, &view)) {
+                        hexview_key(&hex, &txt, &map, sym, mod);
+                    } else {
+                        view_key(&txt, &view, sym, mod);
                     }
-                } else if (event.key.keysym.sym == SDLK_RETURN || event.key.keysym.sym == SDLK_KP_ENTER) {
-                    // Clamp cursor_location_x to the end of the line
-                    if (txt.cursor_location_x > strlen(txt.lines[txt.cursor_location_y])) {
 
-                        txt.cursor_location_x = strlen(txt.lines[txt.cursor_location_y]);
+                } else if (sym == SDLK_s && (mod & KMOD_CTRL)) {   // save, written in the background while typing goes on
 
+                    const char *filename = tinyfd_saveFileDialog("Save As", txt.path ? txt.path : "output.txt", 0, NULL, NULL);
+                    if (filename && (saving || comparing)) {
+                        free(save_next);   // one save at a time, this one starts when the running one is done
+                        save_next = strdup(filename);   // or once a change on disk is taken in, not saved over
+                    } else if (filename) {
+                        saving = start_save(&txt, &undo_journal, &base, filename);
                     }
-                    if (txt.cursor_location_y < MAX_LINES - 1 && txt.cursor_location_y < txt.MAX_VISIBLE_LINES) { // Shift all lines below down by one to make space
-                        for (int i = MAX_LINES - 1; i > txt.cursor_location_y + 1; --i) {
 
-                            strncpy(txt.lines[i], txt.lines[i - 1], MAX_TEXT_LEN);
-                            txt.lines[i][MAX_TEXT_LEN - 1] = '\0';
+                } else if (sym == SDLK_o && (mod & KMOD_CTRL)) {   // open a file, it loads while the window keeps drawing
 
-                        }
-                        // Move text after cursor to new line
-                        size_t len = strlen(txt.lines[txt.cursor_location_y]); // length of txt at line[y]
-                        size_t tail_len = len - txt.cursor_location_x; // length of line[y] with current location in that line
+                    const char *filename = tinyfd_openFileDialog("Open", txt.path ? txt.path : "", 0, NULL, NULL, 0);
+                    if (filename) {   // the last session's screen is not what comes next
+                        free(preview);
+                        preview = NULL;
+                    }
+                    if (filename && hex.view) {   // the bytes of the view go with it
+                        hex.active = 0;
+                        hex.view = NULL;
+                    }
+                    if (filename && viewer_wants(filename)) {
+                        viewer_open(&view, filename);   // never loaded as a whole, it is read where it is looked at
+                    } else if (filename) {
+                        viewer_close(&view);
+                        loader_start(&load, filename);
+                    }
 
-                        if (tail_len > 0) {
+                } else if (sym == SDLK_t && (mod & KMOD_CTRL)) {   // follow mode, like tail -f
 
-                            strncpy(txt.lines[txt.cursor_location_y + 1], txt.lines[txt.cursor_location_y] + txt.cursor_location_x, MAX_TEXT_LEN - 1);
-                            txt.lines[txt.cursor_location_y + 1][MAX_TEXT_LEN - 1] = '\0';
-                            txt.lines[txt.cursor_location_y][txt.cursor_location_x] = '\0';
+                    watch_follow(&watch, !watch.follow && txt.path && txt.encoding.kind == ENCODING_UTF8);
+                    if (watch.follow) {
+                        watch.synced = (size_t)-1;   // checked against the file once before anything is appended
+                        watch.changed = 1;
+                        set_cursor_offset(&txt, buffer_length(&txt.buf));
+                        scroll_to_cursor(&txt);
+                    }
 
-                        } else {
+                } else if (sym == SDLK_r && (mod & KMOD_CTRL)) {   // starts or stops recording the macro
 
-                            txt.lines[txt.cursor_location_y + 1][0] = '\0';
+                    if (keys.recording) {
+                        macro_stop(&keys);
+                    } else {
+                        macro_start(&keys);
+                    }
 
-                        }
+                } else if ((sym == SDLK_h && (mod & KMOD_CTRL)) || (hex.active && sym == SDLK_ESCAPE)) {   // hex view
 
-                        txt.cursor_location_y++;
-                        txt.cursor_location_x = 0;
-                    } 
-                    // arrow key movement :
-                } else if (event.key.keysym.sym == SDLK_UP) {
-                    if (txt.cursor_location_y > 0) {
-                        txt.cursor_location_y--;       //if more rows than the first then just move up
-                        if (txt.cursor_location_x > strlen(txt.lines[txt.cursor_location_y])) {
-                             txt.cursor_location_x = strlen(txt.lines[txt.cursor_location_y]); 
-                        }
-                        
-                    }
-                } else if (event.key.keysym.sym == SDLK_DOWN) {
-                    if (txt.cursor_location_y < MAX_LINES - 1 && txt.cursor_location_y < txt.MAX_VISIBLE_LINES) {
-                        txt.cursor_location_y++;                    // if less rows than the max move down
-                        if (txt.cursor_location_x > strlen(txt.lines[txt.cursor_location_y]))
-                            txt.cursor_location_x = strlen(txt.lines[txt.cursor_location_y]);
+                    if (hex.active) {
+                        hex.active = 0;
+                        scroll_to_cursor(&txt);
+                    } else {
+                        hexview_open(&hex, &txt);
                     }
-                } else if (event.key.keysym.sym == SDLK_RIGHT) {
-                    if (txt.cursor_location_x < strlen(txt.lines[txt.cursor_location_y])) {
-                        txt.cursor_location_x++;
+
+                } else if (hex.active && hexview_key(&hex, &txt, &map, sym, mod)) {   // moves and edits bytes
+
+                } else if (sym == SDLK_p && (mod & KMOD_CTRL)) {   // plays the macro, with shift it asks how many times
+
+                    long count = 1;
+                    if (mod & KMOD_SHIFT) {
+                        const char *answer = tinyfd_inputBox("Run macro", "How many times?", "100");
+                        count = answer ? atol(answer) : 0;
                     }
-                } else if (event.key.keysym.sym == SDLK_LEFT) {
-                    if (txt.cursor_location_x > 0) {
-                        txt.cursor_location_x--;
+                    play_macro(&txt, &map, &clip, &keys, count);
+
+                } else {
+                    if (!(sym == SDLK_g && (mod & KMOD_CTRL))) {
+                        macro_record_key(&keys, sym, mod);   // dialogs are not part of a macro
                     }
+                    handle_key(&txt, &map, &clip, sym, mod);
                 }
-                
+
             }else if (event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT) {
 
+                if (hex_showing(&hex, &view)) {
+                    hexview_click(&hex, &txt, event.button.x, event.button.y);
+                } else if (minimap_hit(&win, event.button.x)) {   // minimap click jumps the viewport, the cursor stays
+                    minimap_drag = 1;
+                    scroll_to_line(&txt, minimap_line_at(&map, event.button.y));
+                } else if (SDL_GetModState() & KMOD_ALT) {   // alt + drag selects a block of columns, with shift it grows the last one
+                    block.active = 1;
+                    block.line = line_at_mouse(&txt, event.button.y);
+                    block.x = event.button.x - 25;
+                    if (!(SDL_GetModState() & KMOD_SHIFT)) {
+                        block.anchor_line = block.line;
+                        block.anchor_x = block.x;
+                    }
+                    cursors_block(&txt, block.anchor_line, block.anchor_x, block.line, block.x);
+                    undo_break(&txt.undo);
+                } else {
+                    if ((SDL_GetModState() & KMOD_SHIFT) && !has_selection(&txt)) {
+                        txt.sel.anchor = cursor_offset(&txt);   // shift + click extends from the old cursor
+                    }
+                    size_t old_anchor = txt.sel.anchor, old_head = cursor_offset(&txt);
                     set_cursor_from_mouse(event.button.x, event.button.y,&txt);
-
-            }else if (event.type == SDL_TEXTINPUT) {
-                size_t curr_len = strlen(txt.lines[txt.cursor_location_y]);
-                size_t input_len = strlen(event.text.text);
-                size_t max_copy = MAX_TEXT_LEN - 1 - curr_len;
-                if (input_len > max_copy) input_len = max_copy;
-
-                // Prepare temp with insertion
-                char temp[MAX_TEXT_LEN];
-                strncpy(temp, txt.lines[txt.cursor_location_y], txt.cursor_location_x);
-                temp[txt.cursor_location_x] = '\0';
-                strncat(temp, event.text.text, input_len);
-                strncat(temp, txt.lines[txt.cursor_location_y] + txt.cursor_location_x, MAX_TEXT_LEN - strlen(temp) - 1);
-
-                
-                TTF_SizeText(txt.font, temp, &txt.text_w, &txt.text_h);
-                if (txt.text_w < win.window_width - 40 && curr_len + input_len < MAX_TEXT_LEN - 1) {
-                    // Insert new text at cursor_location_x
-                    memmove(&txt.lines[txt.cursor_location_y][txt.cursor_location_x + input_len],
-                            &txt.lines[txt.cursor_location_y][txt.cursor_location_x],
-                            curr_len - txt.cursor_location_x + 1);
-                    memcpy(&txt.lines[txt.cursor_location_y][txt.cursor_location_x],
-                           event.text.text, input_len);
-                    txt.cursor_location_x += input_len;
+                    undo_break(&txt.undo);
+                    txt.sel.head = cursor_offset(&txt);
+                    if (!(SDL_GetModState() & KMOD_SHIFT)) {
+                        txt.sel.anchor = txt.sel.head;
+                    }
+                    if (SDL_GetModState() & KMOD_CTRL) {   // ctrl + click adds a cursor, the old one stays
+                        size_t head = txt.sel.head;
+                        txt.sel.anchor = old_anchor;
+                        set_cursor_offset(&txt, old_head);
+                        cursors_add(&txt, head, head);
+                    } else {
+                        cursors_clear(&txt);
+                    }
+                    text_drag = 1;
                 }
+
+            }else if (event.type == SDL_MOUSEBUTTONUP && event.button.button == SDL_BUTTON_LEFT) {
+
+                minimap_drag = 0;
+                text_drag = 0;
+                block.active = 0;
+
+            }else if (event.type == SDL_MOUSEMOTION && text_drag && (event.motion.state & SDL_BUTTON_LMASK)) {
+
+                set_cursor_from_mouse(event.motion.x, event.motion.y, &txt);   // dragging selects
+                txt.sel.head = cursor_offset(&txt);
+
+            }else if (event.type == SDL_MOUSEMOTION && block.active && (event.motion.state & SDL_BUTTON_LMASK)) {
+
+                block.line = line_at_mouse(&txt, event.motion.y);
+                block.x = event.motion.x - 25;
+                block.dirty = 1;
+
+            }else if (event.type == SDL_MOUSEMOTION && minimap_drag && (event.motion.state & SDL_BUTTON_LMASK)) {
+
+                scroll_to_line(&txt, minimap_line_at(&map, event.motion.y));
+
+            }else if (event.type == SDL_TEXTINPUT && load.fd < 0 && view.fd < 0 && hex.active) {   // hex digits
+
+                hexview_type(&hex, &txt, &map, event.text.text, strlen(event.text.text));
+
+            }else if (event.type == SDL_TEXTINPUT && load.fd < 0 && view.fd < 0) {   // only collected here, applied once per burst
+                collect_text_input(&txt, &map, &pending, &keys, event.text.text);
             } 
         }
+        flush_text_input(&txt, &map, &pending);
+        if (load.fd >= 0 && !saving) {   // a few blocks per frame, the swap happens once the whole file is in and saved
+            int state = loader_step(&load);
+            if (state == 0) {
+                watch_job_free(comparing);   // it reads the storage that goes now
+                comparing = NULL;
+                struct stat loaded = load.st;
+                if (!open_document(&txt, &map, &clip, &undo_journal, &base, &load)) {
+                    place_session(&txt, &last, &loaded);
+                }
+                watch_set(&watch, txt.path);
+                watch.synced = (size_t)-1;
+                if (hex.active) hexview_open(&hex, &txt);   // the new document's bytes around its cursor
+            } else if (state < 0) {
+                loader_cancel(&load);
+            }
+        }
+        if (load.fd < 0 && last.count > 0) {   // the session's document is in, or its load was cancelled
+            session_free(&last);
+        }
+        if (load.fd < 0 && !saving && !comparing && watch_poll(&watch)) {   // a running save would look like someone else's
+            watch.changed = 0;
+            int more = watch.follow ? follow_document(&txt, &map, &base, &watch) : -1;
+            if (more < 0) {
+                comparing = reload_start(&txt, &base);
+                if (!comparing && watch.follow) watch.synced = txt.buf.version;   // nothing to take in
+            } else {
+                watch.changed = more;
+            }
+        }
+        if (comparing && !saving && watch_step(comparing) != 1) {   // the base is the save's until it is done
+            reload_finish(&txt, &map, &base, comparing);
+            comparing = NULL;
+            if (watch.follow) watch.synced = txt.buf.version;
+            if (save_next) {
+                saving = start_save(&txt, &undo_journal, &base, save_next);
+                free(save_next);
+                save_next = NULL;
+            }
+        }
+        if (view.fd >= 0) {   // indexed a little every frame, like a file loads
+            viewer_step(&view);
+        }
+        if (saving) {
+            const char *slash = strrchr(saving->path, '/');
+            win.status_progress = SDL_AtomicGet(&saving->progress);
+            snprintf(win.status, sizeof(win.status), "Saving %s %d%%", slash ? slash + 1 : saving->path, win.status_progress / 10);
+        } else if (load.fd >= 0) {
+            const char *slash = strrchr(load.path, '/');
+            win.status_progress = loader_progress(&load);
+            snprintf(win.status, sizeof(win.status), "Opening %s %d%% (esc cancels)",
+                slash ? slash + 1 : load.path, win.status_progress / 10);
+        } else if (hex_showing(&hex, &view)) {
+            int growing = view.indexing == 1 && !view.mapped;   // a gzip file has as many bytes as are inflated
+            win.status_progress = growing ? viewer_progress(&view) : 0;
+            snprintf(win.status, sizeof(win.status), "Offset 0x%zx of 0x%zx, read-only%s (ctrl+h or esc goes back)",
+                hex.at, viewer_readable(&view), growing ? ", indexing" : "");
+        } else if (view.fd >= 0) {
+            const char *slash = strrchr(view.path, '/');
+            const char *find = view.finding > 0 ? ", searching" : view.finding < 0 ? ", not found" : "";
+            win.status_progress = view.indexing == 1 ? viewer_progress(&view) : 0;
+            if (view.indexing == 1) {
+                snprintf(win.status, sizeof(win.status), "%s line %zu of %zu, indexing %d%%%s (esc closes)",
+                    slash ? slash + 1 : view.path, view.top + 1, view.line_count, win.status_progress / 10, find);
+            } else {   // a broken stream stays viewable up to where it broke
+                snprintf(win.status, sizeof(win.status), "%s line %zu of %zu%s%s (esc closes)",
+                    slash ? slash + 1 : view.path, view.top + 1, view.line_count, view.indexing < 0 ? ", damaged" : "",
+                    find);
+            }
+        } else if (hex.active) {
+            win.status_progress = 0;
+            snprintf(win.status, sizeof(win.status), "Offset 0x%zx of 0x%zx%s%s (ctrl+h or esc goes back to text)",
+                cursor_offset(&txt), buffer_length(&txt.buf), hex.low ? ", low half" : "",
+                txt.encoding.kind != ENCODING_UTF8 ? ", as UTF-8" : "");   // the bytes of the buffer, not the file
+        } else if (watch.follow) {
+            const char *slash = strrchr(txt.path, '/');
+            win.status_progress = 0;
+            snprintf(win.status, sizeof(win.status), "Following %s (ctrl+t stops)", slash ? slash + 1 : txt.path);
+        } else {
+            win.status[0] = '\0';
+        }
+        if (block.dirty) {
+            cursors_block(&txt, block.anchor_line, block.anchor_x, block.line, block.x);
+            block.dirty = 0;
+        }
+        journal_sync(&undo_journal, &txt.buf, &txt.undo, SDL_GetTicks());   // one batch per frame, never per keystroke
 
-        render_all(&win,&txt);
+        if (preview && (preview_view ? view.fd < 0 || view.indexing != 1 ||
+                        view.line_count > view.top + (size_t)txt.MAX_VISIBLE_LINES : load.fd < 0)) {
+            free(preview);   // what it stood in for can be drawn now
+            preview = NULL;
+        }
+        if (preview) {
+            render_preview(&win, &txt, &lines, preview, preview_len);
+        } else if (hex_showing(&hex, &view)) {
+            render_hex(&win, &txt, &hex);
+        } else if (view.fd >= 0) {
+            render_view(&win, &txt, &view, &lines);
+        } else {
+            render_all(&win,&txt,&map,&lines);
+        }
         
         
     }
@@ -358,6 +1578,39 @@ int main(int argc, char *argv[])
     // exit and destroy when loop ends
     SDL_StopTextInput();
 
+    watch_job_free(comparing);   // it reads the storage too
+    if (save_next && !saving) {   // it waited for the compare, saved as the document is now
+        saving = start_save(&txt, &undo_journal, &base, save_next);
+        free(save_next);
+        save_next = NULL;
+    }
+    while (saving) {   // the snapshot points into the buffer
+        finish_save(&txt, &undo_journal, &base, saving);
+        saving = save_next ? start_save(&txt, &undo_journal, &base, save_next) : NULL;
+        free(save_next);
+        save_next = NULL;
+    }
+
+    if (last.count == 0) {   // quit while its document still loaded, the next start tries that session again
+        remember_session(&txt, &view, &base);   // before anything it looks at is freed
+    }
+    clipboard_export(&clip, &txt.buf); // clipboard managers can still take it after we exit
+    clipboard_free(&clip);
+    minimap_free(&map);
+    cursors_free(&txt);
+    undo_free(&txt.undo);
+    buffer_free(&txt.buf);
+    journal_free(&undo_journal);   // after the buffer, restored pieces point into it
+    macro_free(&keys);
+    loader_cancel(&load);
+    save_base_free(&base);
+    watch_free(&watch);
+    viewer_close(&view);
+    session_free(&last);
+    free(preview);
+    linecache_free(&lines);   // before the renderer goes
+    hexview_free(&hex);
+    free(txt.path);
     quit_all(&win, &txt);
 
     return 0;
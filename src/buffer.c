@@ -0,0 +1,605 @@
+#define _GNU_SOURCE   // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+
+void buffer_init(textbuffer *buf) {
+    memset(buf, 0, sizeof(*buf));
+    buf->append_chunk = -1;
+}
+
+
+void buffer_free(textbuffer *buf) {
+    for (int c = 0; c < buf->chunk_count; ++c) {
+        if (!buf->chunks[c].external) free(buf->chunks[c].data);
+        free(buf->chunks[c].newlines);
+    }
+    free(buf->chunks);
+    free(buf->pieces);
+    free(buf->piece_offset);
+    free(buf->piece_line);
+    buffer_init(buf);
+}
+
+
+// first index in the sorted array a[0..n) that is >= value
+static size_t lower_bound(const size_t *a, size_t n, size_t value) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// newlines stored in chunk bytes [from, to)
+static size_t chunk_newlines_between(bufchunk *c, size_t from, size_t to) {
+    return lower_bound(c->newlines, c->newline_count, to) - lower_bound(c->newlines, c->newline_count, from);
+}
+
+
+static bufchunk *buffer_chunk_slot(textbuffer *buf) {
+    if (buf->chunk_count == buf->chunk_cap) {
+        int new_cap = buf->chunk_cap ? buf->chunk_cap * 2 : 8;
+        bufchunk *chunks = realloc(buf->chunks, (size_t)new_cap * sizeof(bufchunk));
+        if (!chunks) return NULL;
+        buf->chunks = chunks;
+        buf->chunk_cap = new_cap;
+    }
+    bufchunk *c = &buf->chunks[buf->chunk_count];
+    memset(c, 0, sizeof(*c));
+    return c;
+}
+
+
+static int buffer_new_chunk(textbuffer *buf, size_t cap) {
+    bufchunk *c = buffer_chunk_slot(buf);
+    if (!c) return -1;
+    c->data = malloc(cap ? cap : 1);
+    if (!c->data) {
+        perror("Could not allocate buffer chunk");
+        return -1;
+    }
+    c->cap = cap;
+    return buf->chunk_count++;
+}
+
+
+// indexes the newlines of the len bytes after the end of the chunk
+static int chunk_index_newlines(bufchunk *c, size_t len) {
+    const char *p = c->data + c->len;
+    const char *end = p + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        if (c->newline_count == c->newline_cap) {
+            size_t new_cap = c->newline_cap ? c->newline_cap * 2 : 64;
+            size_t *nl = realloc(c->newlines, new_cap * sizeof(size_t));
+            if (!nl) return -1;
+            c->newlines = nl;
+            c->newline_cap = new_cap;
+        }
+        c->newlines[c->newline_count++] = p - c->data;
+        p++;
+    }
+    c->len += len;
+    return 0;
+}
+
+
+// copies text to the end of a chunk and indexes its newlines in the same pass
+static int chunk_append(bufchunk *c, const char *text, size_t len) {
+    memcpy(c->data + c->len, text, len);
+    return chunk_index_newlines(c, len);
+}
+
+
+// adds len bytes the caller keeps alive as read-only storage, returns the chunk pieces can point into
+int buffer_add_chunk(textbuffer *buf, const char *data, size_t len) {
+    bufchunk *c = buffer_chunk_slot(buf);
+    if (!c) return -1;
+    c->data = (char *)data;
+    c->cap = len;
+    c->external = 1;
+    if (chunk_index_newlines(c, len) != 0) {
+        free(c->newlines);
+        return -1;
+    }
+    return buf->chunk_count++;
+}
+
+
+// moves a chunk of from, its bytes and newlines, over to buf without copying them. from is left with an empty
+// chunk in its place so its other chunks keep their numbers. Returns the chunk in buf
+int buffer_take_chunk(textbuffer *buf, textbuffer *from, int chunk) {
+    bufchunk *c = buffer_chunk_slot(buf);
+    if (!c) return -1;
+    *c = from->chunks[chunk];
+    memset(&from->chunks[chunk], 0, sizeof(bufchunk));
+    if (from->append_chunk == chunk) from->append_chunk = -1;
+    return buf->chunk_count++;
+}
+
+
+// picks the chunk len new bytes go to, big blocks get a chunk of their own
+static int buffer_storage_for(textbuffer *buf, size_t len) {
+    if (buf->append_chunk >= 0) {
+        bufchunk *c = &buf->chunks[buf->append_chunk];
+        if (c->cap - c->len >= len) return buf->append_chunk;
+    }
+    if (len >= BUFFER_CHUNK_SIZE / 4) {
+        return buffer_new_chunk(buf, len);
+    }
+    int c = buffer_new_chunk(buf, BUFFER_CHUNK_SIZE);
+    if (c >= 0) buf->append_chunk = c;
+    return c;
+}
+
+
+static int buffer_reserve_pieces(textbuffer *buf, size_t count) {
+    if (count <= buf->piece_cap && buf->piece_offset) return 0;
+    size_t new_cap = buf->piece_cap ? buf->piece_cap : 16;
+    while (new_cap < count) new_cap *= 2;
+    piece *pieces = realloc(buf->pieces, new_cap * sizeof(piece));
+    if (!pieces) return -1;
+    buf->pieces = pieces;
+    size_t *offsets = realloc(buf->piece_offset, (new_cap + 1) * sizeof(size_t));
+    if (!offsets) return -1;
+    buf->piece_offset = offsets;
+    size_t *lines = realloc(buf->piece_line, (new_cap + 1) * sizeof(size_t));
+    if (!lines) return -1;
+    buf->piece_line = lines;
+    if (buf->piece_cap == 0) {
+        buf->piece_offset[0] = 0;
+        buf->piece_line[0] = 0;
+    }
+    buf->piece_cap = new_cap;
+    return 0;
+}
+
+
+static void buffer_invalidate_from(textbuffer *buf, size_t i) {
+    if (i < buf->index_valid) buf->index_valid = i;
+    buf->version++;
+}
+
+
+// brings the prefix offsets and line counts up to date from the first edited piece on
+static void buffer_reindex(textbuffer *buf) {
+    if (!buf->piece_offset) return;
+    for (size_t i = buf->index_valid; i < buf->piece_count; ++i) {
+        buf->piece_offset[i + 1] = buf->piece_offset[i] + buf->pieces[i].len;
+        buf->piece_line[i + 1] = buf->piece_line[i] + buf->pieces[i].newlines;
+    }
+    buf->index_valid = buf->piece_count;
+}
+
+
+// piece holding offset and the offset inside it, piece_count when offset is the end
+static size_t buffer_find(textbuffer *buf, size_t offset, size_t *inner) {
+    *inner = 0;
+    if (offset >= buf->length) return buf->piece_count;
+    buffer_reindex(buf);
+    size_t lo = 0, hi = buf->piece_count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (buf->piece_offset[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *inner = offset - buf->piece_offset[lo];
+    return lo;
+}
+
+
+static int buffer_insert_pieces_at(textbuffer *buf, size_t i, const piece *p, size_t n) {
+    if (buffer_reserve_pieces(buf, buf->piece_count + n) != 0) return -1;
+    memmove(&buf->pieces[i + n], &buf->pieces[i], (buf->piece_count - i) * sizeof(piece));
+    memcpy(&buf->pieces[i], p, n * sizeof(piece));
+    buf->piece_count += n;
+    buffer_invalidate_from(buf, i);
+    return 0;
+}
+
+
+// cuts piece i in two at inner bytes
+static int buffer_split(textbuffer *buf, size_t i, size_t inner) {
+    piece right = buf->pieces[i];
+    bufchunk *c = &buf->chunks[right.chunk];
+    size_t left_newlines = chunk_newlines_between(c, right.start, right.start + inner);
+    right.start += inner;
+    right.len -= inner;
+    right.newlines -= left_newlines;
+    if (buffer_insert_pieces_at(buf, i + 1, &right, 1) != 0) return -1;
+    buf->pieces[i].len = inner;
+    buf->pieces[i].newlines = left_newlines;
+    buffer_invalidate_from(buf, i);
+    return 0;
+}
+
+
+// piece for bytes [start, start + len) of a chunk
+piece buffer_chunk_piece(textbuffer *buf, int chunk, size_t start, size_t len) {
+    piece p = {chunk, start, len, chunk_newlines_between(&buf->chunks[chunk], start, start + len)};
+    return p;
+}
+
+
+// places an already stored span into the document at offset
+static int buffer_insert_piece(textbuffer *buf, size_t offset, piece p) {
+    size_t inner;
+    size_t i = buffer_find(buf, offset, &inner);
+    if (inner == 0 && i > 0) {
+        piece *prev = &buf->pieces[i - 1];
+        if (prev->chunk == p.chunk && prev->start + prev->len == p.start) {   // typing right after the last insert just grows it
+            prev->len += p.len;
+            prev->newlines += p.newlines;
+            buffer_invalidate_from(buf, i - 1);
+            buf->length += p.len;
+            buf->newline_count += p.newlines;
+            return 0;
+        }
+    }
+    if (inner > 0) {
+        if (buffer_split(buf, i, inner) != 0) return -1;
+        i++;
+    }
+    if (buffer_insert_pieces_at(buf, i, &p, 1) != 0) return -1;
+    buf->length += p.len;
+    buf->newline_count += p.newlines;
+    return 0;
+}
+
+
+// appends text to the storage without placing it, the returned piece can go into the document many times
+int buffer_store(textbuffer *buf, const char *text, size_t len, piece *out) {
+    int c = buffer_storage_for(buf, len);
+    if (c < 0) return -1;
+    bufchunk *chunk = &buf->chunks[c];
+    size_t start = chunk->len;
+    size_t newlines_before = chunk->newline_count;
+    if (chunk_append(chunk, text, len) != 0) return -1;
+    piece p = {c, start, len, chunk->newline_count - newlines_before};
+    *out = p;
+    return 0;
+}
+
+
+// room for len bytes at the end of the storage, the caller writes into it (a file read goes straight in)
+// and buffer_commit appends what was written to the document without copying it again
+char *buffer_reserve(textbuffer *buf, size_t len, int *chunk) {
+    int c = buffer_storage_for(buf, len);
+    if (c < 0) return NULL;
+    *chunk = c;
+    return buf->chunks[c].data + buf->chunks[c].len;
+}
+
+
+int buffer_commit(textbuffer *buf, int chunk, size_t len) {
+    if (len == 0) return 0;
+    bufchunk *c = &buf->chunks[chunk];
+    size_t start = c->len;
+    size_t newlines_before = c->newline_count;
+    if (chunk_index_newlines(c, len) != 0) return -1;
+    piece p = {chunk, start, len, c->newline_count - newlines_before};
+    return buffer_insert_piece(buf, buf->length, p);
+}
+
+
+// inserts len bytes at offset as a single piece, newlines are indexed in one pass over the text
+int buffer_insert(textbuffer *buf, size_t offset, const char *text, size_t len) {
+    if (len == 0) return 0;
+    if (offset > buf->length) offset = buf->length;
+    piece p;
+    if (buffer_store(buf, text, len, &p) != 0) return -1;
+    return buffer_insert_piece(buf, offset, p);
+}
+
+
+// places already stored spans at offset in one go, used to paste text without copying it
+int buffer_insert_pieces(textbuffer *buf, size_t offset, const piece *p, size_t n) {
+    if (n == 0) return 0;
+    if (offset > buf->length) offset = buf->length;
+    size_t inner;
+    size_t i = buffer_find(buf, offset, &inner);
+    if (inner > 0) {
+        if (buffer_split(buf, i, inner) != 0) return -1;
+        i++;
+    }
+    if (buffer_insert_pieces_at(buf, i, p, n) != 0) return -1;
+    for (size_t k = 0; k < n; ++k) {
+        buf->length += p[k].len;
+        buf->newline_count += p[k].newlines;
+    }
+    return 0;
+}
+
+
+// describes bytes [offset, offset + len) as pieces into the storage, no text is copied
+size_t buffer_copy_pieces(textbuffer *buf, size_t offset, size_t len, piece **out) {
+    *out = NULL;
+    if (offset >= buf->length || len == 0) return 0;
+    if (len > buf->length - offset) len = buf->length - offset;
+    size_t inner, last_inner;
+    size_t first = buffer_find(buf, offset, &inner);
+    size_t last = buffer_find(buf, offset + len - 1, &last_inner);
+    size_t n = last - first + 1;
+    piece *p = malloc(n * sizeof(piece));
+    if (!p) return 0;
+    memcpy(p, &buf->pieces[first], n * sizeof(piece));
+    // trim the partial pieces at both ends
+    size_t end = offset + len - buf->piece_offset[last];
+    if (end < p[n - 1].len) {
+        p[n - 1].len = end;
+        p[n - 1].newlines = chunk_newlines_between(&buf->chunks[p[n - 1].chunk], p[n - 1].start, p[n - 1].start + end);
+    }
+    if (inner > 0) {
+        p[0].newlines -= chunk_newlines_between(&buf->chunks[p[0].chunk], p[0].start, p[0].start + inner);
+        p[0].start += inner;
+        p[0].len -= inner;
+    }
+    *out = p;
+    return n;
+}
+
+
+int buffer_delete(textbuffer *buf, size_t offset, size_t len) {
+    if (offset >= buf->length || len == 0) return 0;
+    if (len > buf->length - offset) len = buf->length - offset;
+    size_t inner;
+    size_t i = buffer_find(buf, offset, &inner);
+    if (inner > 0) {
+        if (buffer_split(buf, i, inner) != 0) return -1;
+        i++;
+    }
+    size_t j = i, removed = 0, newlines = 0;
+    while (j < buf->piece_count && removed + buf->pieces[j].len <= len) {
+        removed += buf->pieces[j].len;
+        newlines += buf->pieces[j].newlines;
+        j++;
+    }
+    if (removed < len) {   // the range ends inside piece j, drop its front
+        piece *p = &buf->pieces[j];
+        size_t cut = len - removed;
+        size_t cut_newlines = chunk_newlines_between(&buf->chunks[p->chunk], p->start, p->start + cut);
+        p->start += cut;
+        p->len -= cut;
+        p->newlines -= cut_newlines;
+        newlines += cut_newlines;
+    }
+    memmove(&buf->pieces[i], &buf->pieces[j], (buf->piece_count - j) * sizeof(piece));
+    buf->piece_count -= j - i;
+    buffer_invalidate_from(buf, i);
+    buf->length -= len;
+    buf->newline_count -= newlines;
+    return 0;
+}
+
+
+// adds p to the end of out, gluing it onto the last piece when they are neighbours in storage
+static void piece_push(piece *out, size_t *n, piece p) {
+    if (p.len == 0) return;
+    if (*n > 0) {
+        piece *prev = &out[*n - 1];
+        if (prev->chunk == p.chunk && prev->start + prev->len == p.start) {
+            prev->len += p.len;
+            prev->newlines += p.newlines;
+            return;
+        }
+    }
+    out[(*n)++] = p;
+}
+
+
+// bytes [inner, inner + len) of p
+static piece piece_part(textbuffer *buf, const piece *p, size_t inner, size_t len) {
+    if (inner == 0 && len == p->len) return *p;
+    return buffer_chunk_piece(buf, p->chunk, p->start + inner, len);
+}
+
+
+// applies edits sorted by offset and not overlapping in a single walk over the pieces, the line index
+// is rebuilt once from the first edit on instead of once per edit
+int buffer_apply(textbuffer *buf, const bufedit *edits, size_t n) {
+    if (n == 0) return 0;
+    size_t extra = 1;
+    for (size_t k = 0; k < n; ++k) extra += edits[k].ins_count + 1;
+    piece *out = malloc((buf->piece_count + extra) * sizeof(piece));
+    if (!out) return -1;
+
+    size_t old_length = buf->length;
+    size_t inner;
+    size_t first = buffer_find(buf, edits[0].offset < old_length ? edits[0].offset : old_length, &inner);
+    memcpy(out, buf->pieces, first * sizeof(piece));
+    size_t count = first;
+    size_t i = first;
+    size_t at = 0;   // bytes of piece i already kept or dropped
+    size_t pos = first < buf->piece_count ? buf->piece_offset[first] : old_length;   // document offset of piece i
+    size_t length = old_length, newlines = buf->newline_count;
+
+    for (size_t k = 0; k < n; ++k) {
+        const bufedit *e = &edits[k];
+        size_t offset = e->offset < old_length ? e->offset : old_length;
+        size_t end = e->len < old_length - offset ? offset + e->len : old_length;
+        // keep everything up to the edit
+        while (i < buf->piece_count && pos + buf->pieces[i].len <= offset) {
+            piece_push(out, &count, piece_part(buf, &buf->pieces[i], at, buf->pieces[i].len - at));
+            pos += buf->pieces[i++].len;
+            at = 0;
+        }
+        if (i < buf->piece_count && offset - pos > at) {
+            piece_push(out, &count, piece_part(buf, &buf->pieces[i], at, offset - pos - at));
+            at = offset - pos;
+        }
+        for (size_t m = 0; m < e->ins_count; ++m) {
+            piece_push(out, &count, e->ins[m]);
+            length += e->ins[m].len;
+            newlines += e->ins[m].newlines;
+        }
+        // and drop the removed bytes
+        while (i < buf->piece_count && pos + buf->pieces[i].len <= end) {
+            newlines -= piece_part(buf, &buf->pieces[i], at, buf->pieces[i].len - at).newlines;
+            pos += buf->pieces[i++].len;
+            at = 0;
+        }
+        if (i < buf->piece_count && end - pos > at) {
+            newlines -= piece_part(buf, &buf->pieces[i], at, end - pos - at).newlines;
+            at = end - pos;
+        }
+        length -= end - offset;
+    }
+    if (i < buf->piece_count) {
+        piece_push(out, &count, piece_part(buf, &buf->pieces[i], at, buf->pieces[i].len - at));
+        i++;
+    }
+    for (; i < buf->piece_count; ++i) piece_push(out, &count, buf->pieces[i]);
+
+    if (buffer_reserve_pieces(buf, count) != 0) {
+        free(out);
+        return -1;
+    }
+    memcpy(buf->pieces, out, count * sizeof(piece));
+    free(out);
+    buf->piece_count = count;
+    buffer_invalidate_from(buf, first > 0 ? first - 1 : 0);   // the first new piece may have been glued onto the one before
+    buf->length = length;
+    buf->newline_count = newlines;
+    return 0;
+}
+
+
+// first offset at or after from where needle starts, BUFFER_NOT_FOUND when there is none
+size_t buffer_search(textbuffer *buf, size_t from, const char *needle, size_t len) {
+    if (len == 0 || len > BUFFER_SEARCH_BLOCK) return BUFFER_NOT_FOUND;
+    size_t want = BUFFER_SEARCH_BLOCK + len - 1;   // blocks overlap so matches across them are found
+    char *block = malloc(want);
+    if (!block) return BUFFER_NOT_FOUND;
+    size_t found = BUFFER_NOT_FOUND;
+    for (size_t offset = from; offset + len <= buf->length; offset += BUFFER_SEARCH_BLOCK) {
+        size_t n = buffer_read(buf, offset, block, want);
+        char *hit = memmem(block, n, needle, len);
+        if (hit) {
+            found = offset + (hit - block);
+            break;
+        }
+        if (n < want) break;
+    }
+    free(block);
+    return found;
+}
+
+
+size_t buffer_length(textbuffer *buf) {
+    return buf->length;
+}
+
+
+size_t buffer_line_count(textbuffer *buf) {
+    return buf->newline_count + 1;
+}
+
+
+// offset of the first byte of line, O(log n) through the piece and chunk newline indexes
+size_t buffer_line_start(textbuffer *buf, size_t line) {
+    if (line == 0) return 0;
+    if (line > buf->newline_count) return buf->length;
+    buffer_reindex(buf);
+    // last piece that starts before the line-th newline
+    size_t lo = 0, hi = buf->piece_count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (buf->piece_line[mid] < line) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    piece *p = &buf->pieces[lo];
+    bufchunk *c = &buf->chunks[p->chunk];
+    size_t k = line - buf->piece_line[lo] - 1;
+    size_t pos = c->newlines[lower_bound(c->newlines, c->newline_count, p->start) + k];
+    return buf->piece_offset[lo] + (pos - p->start) + 1;
+}
+
+
+// line length without its line break, the '\r' of a "\r\n" is part of the break
+size_t buffer_line_length(textbuffer *buf, size_t line) {
+    size_t start = buffer_line_start(buf, line);
+    if (line >= buf->newline_count) return buf->length - start;
+    size_t end = buffer_line_start(buf, line + 1) - 1;
+    char c = 0;
+    if (end > start) buffer_read(buf, end - 1, &c, 1);
+    return end - start - (c == '\r');
+}
+
+
+size_t buffer_line_of(textbuffer *buf, size_t offset) {
+    size_t inner;
+    size_t i = buffer_find(buf, offset, &inner);
+    if (i >= buf->piece_count) return buf->newline_count;
+    piece *p = &buf->pieces[i];
+    return buf->piece_line[i] + chunk_newlines_between(&buf->chunks[p->chunk], p->start, p->start + inner);
+}
+
+
+// copies up to len bytes starting at offset, returns how many were copied
+size_t buffer_read(textbuffer *buf, size_t offset, char *out, size_t len) {
+    size_t inner;
+    size_t i = buffer_find(buf, offset, &inner);
+    size_t copied = 0;
+    while (i < buf->piece_count && copied < len) {
+        piece *p = &buf->pieces[i];
+        size_t n = p->len - inner;
+        if (n > len - copied) n = len - copied;
+        memcpy(out + copied, buf->chunks[p->chunk].data + p->start + inner, n);
+        copied += n;
+        inner = 0;
+        i++;
+    }
+    return copied;
+}
+
+
+// copies a line without its line break into out as a C string cut at cap - 1 bytes, returns the full length.
+// NUL bytes turn into BUFFER_NUL_SHOWN, the copy keeps its length and columns stay byte offsets
+size_t buffer_line(textbuffer *buf, size_t line, char *out, size_t cap) {
+    size_t len = buffer_line_length(buf, line);
+    size_t n = len < cap - 1 ? len : cap - 1;
+    n = buffer_read(buf, buffer_line_start(buf, line), out, n);
+    for (char *z = out; (z = memchr(z, '\0', n - (size_t)(z - out))) != NULL; ++z) *z = BUFFER_NUL_SHOWN;
+    out[n] = '\0';
+    return len;
+}
+
+
+// start of the utf-8 character that ends at offset, offset - 1 unless continuation bytes come before it.
+// A "\r\n" line break counts as one character
+size_t buffer_char_before(textbuffer *buf, size_t offset) {
+    if (offset == 0) return 0;
+    char c[4];
+    size_t n = offset < 4 ? offset : 4;
+    buffer_read(buf, offset - n, c, n);
+    if (n >= 2 && c[n - 1] == '\n' && c[n - 2] == '\r') return offset - 2;
+    size_t back = 1;
+    while (back < n && ((unsigned char)c[n - back] & 0xC0) == 0x80) back++;
+    return (unsigned char)c[n - back] >= 0xC0 ? offset - back : offset - 1;   // stray continuations go one by one
+}
+
+
+// end of the utf-8 character that starts at offset, the continuation bytes after its first one go with it
+size_t buffer_char_after(textbuffer *buf, size_t offset) {
+    char c[4];
+    size_t n = buffer_read(buf, offset, c, 4);
+    if (n == 0) return offset;
+    if (n >= 2 && c[0] == '\r' && c[1] == '\n') return offset + 2;
+    size_t len = 1;
+    while ((unsigned char)c[0] >= 0xC0 && len < n && ((unsigned char)c[len] & 0xC0) == 0x80) len++;
+    return offset + len;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "clipboard.h"
+
+
+void clipboard_init(clipboard *clip) {
+    memset(clip, 0, sizeof(*clip));
+}
+
+
+void clipboard_free(clipboard *clip) {
+    free(clip->pieces);
+    clipboard_init(clip);
+}
+
+
+// remembers the range as pieces, the storage is append-only so they stay valid after later edits
+void clipboard_copy(clipboard *clip, textbuffer *buf, size_t offset, size_t len) {
+    clipboard_free(clip);
+    clip->count = buffer_copy_pieces(buf, offset, len, &clip->pieces);
+    if (clip->count == 0) return;
+    for (size_t i = 0; i < clip->count; ++i) {
+        clip->length += clip->pieces[i].len;
+    }
+    clip->fresh = 1;
+}
+
+
+// inserts our own copied pieces, returns -1 when the system clipboard has to be used instead
+int clipboard_paste(clipboard *clip, textbuffer *buf, size_t offset, size_t *len) {
+    if (!clip->fresh) return -1;
+    if (buffer_insert_pieces(buf, offset, clip->pieces, clip->count) != 0) return -1;
+    *len = clip->length;
+    return 0;
+}
+
+
+// our own copy for pastes that place it more than once, -1 when the system clipboard has to be used
+int clipboard_pieces(clipboard *clip, const piece **pieces, size_t *count) {
+    if (!clip->fresh) return -1;
+    *pieces = clip->pieces;
+    *count = clip->count;
+    return 0;
+}
+
+
+// materializes the copy for other programs, called when they could ask for it (focus lost, quit)
+void clipboard_export(clipboard *clip, textbuffer *buf) {
+    if (!clip->fresh || clip->exported) return;
+    char *text = malloc(clip->length + 1);
+    if (!text) {
+        perror("Could not export clipboard");
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < clip->count; ++i) {
+        piece *p = &clip->pieces[i];
+        memcpy(text + n, buf->chunks[p->chunk].data + p->start, p->len);
+        n += p->len;
+    }
+    text[n] = '\0';
+    SDL_SetClipboardText(text);
+    free(text);
+    clip->exported = 1;
+}
+
+
+// focus lost, another program could paste now. A copy bigger than CLIPBOARD_EAGER_MAX is not built as text
+// every time the window loses focus, only on quit or when it is smaller again
+void clipboard_offer(clipboard *clip, textbuffer *buf) {
+    if (clip->length <= CLIPBOARD_EAGER_MAX) clipboard_export(clip, buf);
+}
+
+
+// the document in from is replaced by the one in to, the copy can still be pasted without ever being turned
+// into text. A chunk it uses a good part of moves over with it, from the others only its bytes are copied so
+// a few lines copied do not keep a whole block of the old file alive. So is a copy out of a mapped file, the
+// map goes away with the old document
+void clipboard_move(clipboard *clip, textbuffer *from, textbuffer *to) {
+    if (!clip->fresh) return;
+    size_t chunks = (size_t)(from->chunk_count ? from->chunk_count : 1);
+    int *moved = malloc(chunks * sizeof(int));
+    size_t *used = calloc(chunks, sizeof(size_t));
+    int ok = moved && used;
+    for (size_t i = 0; ok && i < clip->count; ++i) used[clip->pieces[i].chunk] += clip->pieces[i].len;
+    for (int c = 0; ok && c < from->chunk_count; ++c) {
+        bufchunk *chunk = &from->chunks[c];
+        moved[c] = used[c] > 0 && !chunk->external && used[c] * CLIPBOARD_MOVE_SHARE >= chunk->cap ? -1 : -2;
+    }
+    for (size_t i = 0; ok && i < clip->count; ++i) {
+        piece *p = &clip->pieces[i];
+        int c = p->chunk;
+        if (moved[c] == -2) {   // copied out
+            ok = buffer_store(to, from->chunks[c].data + p->start, p->len, p) == 0;
+            continue;
+        }
+        if (moved[c] == -1) moved[c] = buffer_take_chunk(to, from, c);
+        ok = moved[c] >= 0;
+        p->chunk = moved[c];
+    }
+    if (!ok) {
+        perror("Could not keep the clipboard");
+        clipboard_free(clip);
+    }
+    free(moved);
+    free(used);
+}
+
+
+// the copy holds text, the same bytes
+static int clipboard_same(clipboard *clip, textbuffer *buf, const char *text) {
+    if (strlen(text) != clip->length) return 0;
+    for (size_t i = 0; i < clip->count; ++i) {
+        piece *p = &clip->pieces[i];
+        if (memcmp(buf->chunks[p->chunk].data + p->start, text, p->len) != 0) return 0;
+        text += p->len;
+    }
+    return 1;
+}
+
+
+// the system clipboard changed, pastes have to come from it again unless it holds our own export. That one
+// is told apart by its text, its update can come frames later or not at all
+void clipboard_update(clipboard *clip, textbuffer *buf) {
+    if (!clip->fresh) return;
+    if (clip->exported) {
+        char *text = SDL_GetClipboardText();
+        int own = text && clipboard_same(clip, buf, text);
+        SDL_free(text);
+        if (own) return;
+    }
+    clip->fresh = 0;
+}
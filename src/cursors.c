@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cursors.h"
+
+// a cursor while a batch sorts and merges them, main is the one the view follows
+typedef struct{
+selection sel;
+int main;
+}cursor_entry;
+
+
+static size_t sel_start(const selection *s) {
+    return s->anchor < s->head ? s->anchor : s->head;
+}
+
+
+static size_t sel_end(const selection *s) {
+    return s->anchor < s->head ? s->head : s->anchor;
+}
+
+
+static int cursor_compare(const void *a, const void *b) {
+    size_t x = sel_start(&((const cursor_entry *)a)->sel);
+    size_t y = sel_start(&((const cursor_entry *)b)->sel);
+    return x < y ? -1 : x > y;
+}
+
+
+static int cursors_reserve(sdltext *txt, size_t count) {
+    if (count <= txt->cursor_cap) return 0;
+    size_t new_cap = txt->cursor_cap ? txt->cursor_cap : 16;
+    while (new_cap < count) new_cap *= 2;
+    selection *cursors = realloc(txt->cursors, new_cap * sizeof(selection));
+    if (!cursors) return -1;
+    txt->cursors = cursors;
+    txt->cursor_cap = new_cap;
+    return 0;
+}
+
+
+void cursors_free(sdltext *txt) {
+    free(txt->cursors);
+    txt->cursors = NULL;
+    txt->cursor_count = 0;
+    txt->cursor_cap = 0;
+}
+
+
+// back to the main cursor alone
+void cursors_clear(sdltext *txt) {
+    txt->cursor_count = 0;
+}
+
+
+// cursors sitting on the same spot or with overlapping selections become one, e must be sorted
+static void cursors_merge(cursor_entry *e, size_t *count) {
+    size_t n = 0;
+    for (size_t k = 0; k < *count; ++k) {
+        if (n > 0) {
+            cursor_entry *prev = &e[n - 1];
+            size_t start = sel_start(&e[k].sel);
+            if (start < sel_end(&prev->sel) || start == sel_start(&prev->sel)) {
+                size_t end = sel_end(&e[k].sel) > sel_end(&prev->sel) ? sel_end(&e[k].sel) : sel_end(&prev->sel);
+                prev->sel.anchor = sel_start(&prev->sel);
+                prev->sel.head = end;
+                prev->main |= e[k].main;
+                continue;
+            }
+        }
+        e[n++] = e[k];
+    }
+    *count = n;
+}
+
+
+// every cursor including the main one, sorted and merged
+static cursor_entry *cursors_collect(sdltext *txt, size_t *count) {
+    *count = txt->cursor_count + 1;
+    cursor_entry *e = malloc(*count * sizeof(cursor_entry));
+    if (!e) return NULL;
+    for (size_t k = 0; k < txt->cursor_count; ++k) {
+        e[k].sel = txt->cursors[k];
+        e[k].main = 0;
+    }
+    e[txt->cursor_count].sel.anchor = txt->sel.anchor;
+    e[txt->cursor_count].sel.head = cursor_offset(txt);
+    e[txt->cursor_count].main = 1;
+    qsort(e, *count, sizeof(cursor_entry), cursor_compare);
+    cursors_merge(e, count);
+    return e;
+}
+
+
+// writes the entries back, the main one into the cursor position and selection of txt
+static void cursors_store(sdltext *txt, cursor_entry *e, size_t count) {
+    txt->cursor_count = 0;
+    if (cursors_reserve(txt, count) != 0) return;
+    int have_main = 0;
+    for (size_t k = 0; k < count; ++k) {
+        if (e[k].main && !have_main) {
+            txt->sel = e[k].sel;
+            set_cursor_offset(txt, e[k].sel.head);
+            have_main = 1;
+        } else {
+            txt->cursors[txt->cursor_count++] = e[k].sel;
+        }
+    }
+}
+
+
+static void cursors_normalize(sdltext *txt) {
+    size_t count;
+    cursor_entry *e = cursors_collect(txt, &count);
+    if (!e) return;
+    cursors_store(txt, e, count);
+    free(e);
+}
+
+
+// makes anchor..head the main cursor, the old main one stays as an extra cursor
+void cursors_add(sdltext *txt, size_t anchor, size_t head) {
+    if (cursors_reserve(txt, txt->cursor_count + 1) != 0) return;
+    selection old = {txt->sel.anchor, cursor_offset(txt)};
+    txt->cursors[txt->cursor_count++] = old;
+    txt->sel.anchor = anchor;
+    txt->sel.head = head;
+    set_cursor_offset(txt, head);
+    cursors_normalize(txt);
+}
+
+
+// first extra cursor that ends at or after offset, lets rendering skip everything above the view
+size_t cursors_from(sdltext *txt, size_t offset) {
+    size_t lo = 0, hi = txt->cursor_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sel_end(&txt->cursors[mid]) < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// replaces what every cursor selects with the same stored pieces as one batch: the edits go through the
+// buffer in one pass and into the current undo group, and the minimap is invalidated once. With erase an
+// empty selection loses the character before it instead
+int cursors_replace(sdltext *txt, minimap *map, const piece *ins, size_t n, int erase) {
+    size_t count;
+    cursor_entry *all = cursors_collect(txt, &count);
+    bufedit *edits = malloc(count * sizeof(bufedit));
+    if (!all || !edits) {
+        free(all);
+        free(edits);
+        return -1;
+    }
+    size_t ins_len = 0, ins_newlines = 0;
+    for (size_t m = 0; m < n; ++m) {
+        ins_len += ins[m].len;
+        ins_newlines += ins[m].newlines;
+    }
+
+    size_t prev_end = 0;
+    for (size_t k = 0; k < count; ++k) {
+        size_t start = sel_start(&all[k].sel), end = sel_end(&all[k].sel);
+        if (erase && start == end && start > prev_end) {
+            start = buffer_char_before(&txt->buf, start);
+            if (start < prev_end) start = prev_end;
+        }
+        edits[k].offset = start;
+        edits[k].len = end - start;
+        edits[k].ins = ins;
+        edits[k].ins_count = n;
+        prev_end = end;
+    }
+
+    // undo ops in the order they would apply one after another, the deleted text is taken before the batch
+    size_t added = 0, removed = 0;
+    for (size_t k = 0; k < count; ++k) {
+        size_t at = edits[k].offset + added - removed;
+        if (edits[k].len > 0) {
+            piece *p;
+            size_t pn = buffer_copy_pieces(&txt->buf, edits[k].offset, edits[k].len, &p);
+            undo_record_pieces(&txt->undo, UNDO_DELETE, at, edits[k].len, p, pn);
+            free(p);
+        }
+        undo_record_pieces(&txt->undo, UNDO_INSERT, at, ins_len, ins, n);
+        all[k].sel.anchor = all[k].sel.head = at + ins_len;
+        added += ins_len;
+        removed += edits[k].len;
+    }
+
+    size_t lines_before = buffer_line_count(&txt->buf);
+    int first_line = (int)buffer_line_of(&txt->buf, edits[0].offset);
+    int result = buffer_apply(&txt->buf, edits, count);
+    if (result == 0) {
+        int same_lines = ins_newlines == 0 && buffer_line_count(&txt->buf) == lines_before;
+        minimap_invalidate(map, first_line, same_lines ? (int)buffer_line_of(&txt->buf, all[count - 1].sel.head) : -1);
+        cursors_merge(all, &count);
+        cursors_store(txt, all, count);
+    }
+    free(edits);
+    free(all);
+    return result;
+}
+
+
+// typed text at every cursor, stored once and shared by all of them
+int cursors_insert(sdltext *txt, minimap *map, const char *text, size_t len) {
+    piece p;
+    if (len == 0 || buffer_store(&txt->buf, text, len, &p) != 0) return -1;
+    return cursors_replace(txt, map, &p, 1, 0);
+}
+
+
+// moves the extra cursors like the arrow, home and end keys move the main one, shift keeps their anchors
+void cursors_move(sdltext *txt, SDL_Keycode sym, int shift) {
+    textbuffer *buf = &txt->buf;
+    for (size_t k = 0; k < txt->cursor_count; ++k) {
+        selection *c = &txt->cursors[k];
+        size_t line = buffer_line_of(buf, c->head);
+        size_t column = c->head - buffer_line_start(buf, line);
+        size_t target = line;
+        if (sym == SDLK_LEFT && column > 0) {
+            c->head = buffer_char_before(buf, c->head);
+        } else if (sym == SDLK_RIGHT && column < buffer_line_length(buf, line)) {
+            c->head = buffer_char_after(buf, c->head);
+        } else if (sym == SDLK_UP && line > 0) {
+            target = line - 1;
+        } else if (sym == SDLK_DOWN && line + 1 < buffer_line_count(buf)) {
+            target = line + 1;
+        } else if (sym == SDLK_HOME) {
+            c->head -= column;
+        } else if (sym == SDLK_END) {
+            c->head += buffer_line_length(buf, line) - column;
+        }
+        if (target != line) {
+            size_t len = buffer_line_length(buf, target);
+            c->head = buffer_line_start(buf, target) + (column < len ? column : len);
+            if (column < len) c->head = buffer_char_before(buf, c->head + 1);   // back to the start of a character it cut
+        }
+        if (!shift) c->anchor = c->head;
+    }
+    cursors_normalize(txt);
+}
+
+
+static int is_word(char c) {
+    return isalnum((unsigned char)c) || c == '_' || (c & 0x80);
+}
+
+
+// true if some cursor already selects [start, end)
+static int cursors_cover(sdltext *txt, size_t start, size_t end) {
+    if (sel_start(&txt->sel) == start && sel_end(&txt->sel) == end) return 1;
+    size_t k = cursors_from(txt, end);
+    return k < txt->cursor_count && sel_start(&txt->cursors[k]) == start && sel_end(&txt->cursors[k]) == end;
+}
+
+
+// ctrl+d, selects the word under the cursor first and then adds a cursor on each next occurrence of it
+void cursors_select_next(sdltext *txt) {
+    textbuffer *buf = &txt->buf;
+    size_t start = sel_start(&txt->sel), end = sel_end(&txt->sel);
+    if (start == end) {
+        char line[MAX_TEXT_LEN];
+        buffer_line(buf, txt->cursor_location_y, line, sizeof(line));
+        int a = txt->cursor_location_x, b = txt->cursor_location_x;
+        if (a >= (int)strlen(line)) return;
+        while (a > 0 && is_word(line[a - 1])) a--;
+        while (line[b] && is_word(line[b])) b++;
+        if (a == b) return;
+        size_t line_start = buffer_line_start(buf, txt->cursor_location_y);
+        txt->sel.anchor = line_start + a;
+        txt->sel.head = line_start + b;
+        set_cursor_offset(txt, txt->sel.head);
+        return;
+    }
+
+    size_t len = end - start;
+    char *needle = malloc(len);
+    if (!needle) return;
+    buffer_read(buf, start, needle, len);
+    size_t from = end, found;
+    int wrapped = 0;
+    for (;;) {
+        found = buffer_search(buf, from, needle, len);
+        if (found == BUFFER_NOT_FOUND) {
+            if (wrapped) break;
+            wrapped = 1;
+            from = 0;
+            continue;
+        }
+        if (wrapped && found >= start) {   // all the way around
+            found = BUFFER_NOT_FOUND;
+            break;
+        }
+        if (!cursors_cover(txt, found, found + len)) break;
+        from = found + 1;
+    }
+    free(needle);
+    if (found != BUFFER_NOT_FOUND) cursors_add(txt, found, found + len);
+}
+
+
+// shift+alt+i, a cursor at the end of every line the selection touches
+void cursors_split_lines(sdltext *txt) {
+    textbuffer *buf = &txt->buf;
+    size_t start = sel_start(&txt->sel), end = sel_end(&txt->sel);
+    size_t first = buffer_line_of(buf, start), last = buffer_line_of(buf, end);
+    if (first == last) return;
+    txt->cursor_count = 0;
+    if (cursors_reserve(txt, last - first) != 0) return;
+    for (size_t line = first; line < last; ++line) {
+        size_t line_end = buffer_line_start(buf, line + 1) - 1;
+        selection c = {line_end, line_end};
+        txt->cursors[txt->cursor_count++] = c;
+    }
+    txt->sel.anchor = txt->sel.head = end;
+    set_cursor_offset(txt, end);
+}
+
+
+// alt + drag, a cursor on every row between the two lines selecting the columns between the two x positions.
+// Columns come from the cached glyph advances in one walk over each row, no text gets measured
+void cursors_block(sdltext *txt, int anchor_line, int anchor_x, int line, int x) {
+    textbuffer *buf = &txt->buf;
+    int first = anchor_line < line ? anchor_line : line;
+    int last = anchor_line < line ? line : anchor_line;
+    txt->cursor_count = 0;
+    if (cursors_reserve(txt, (size_t)(last - first)) != 0) return;
+    char text[MAX_TEXT_LEN];
+    for (int l = first; l <= last; ++l) {
+        buffer_line(buf, l, text, sizeof(text));
+        size_t start = buffer_line_start(buf, l);
+        selection c = {start + column_at_x(txt, text, anchor_x), start + column_at_x(txt, text, x)};
+        if (l == line) {
+            txt->sel = c;
+            set_cursor_offset(txt, c.head);
+        } else {
+            txt->cursors[txt->cursor_count++] = c;
+        }
+    }
+}
@@ -0,0 +1,454 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#endif
+#include "encoding.h"
+
+
+void encoding_init(text_encoding *e) {
+    memset(e, 0, sizeof(*e));
+    e->kind = ENCODING_UTF8;
+}
+
+
+// bytes before the first non-ascii one. 64 bytes are checked at a time, their top bits or'd together, so
+// plain text goes by at memory speed and only the bytes around a multibyte character are looked at one by one
+size_t encoding_ascii(const char *s, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(s + i + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)))) break;
+    }
+    for (; i + 16 <= n; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, s + i, 8);
+        if (w & 0x8080808080808080ULL) break;
+    }
+#endif
+    while (i < n && !(s[i] & 0x80)) ++i;
+    return i;
+}
+
+
+// looks at the start of a file for what it is, the bytes of a byte order mark to skip are returned.
+// Without a mark utf-16 shows itself by the zero half of every ascii character, anything else starts as
+// utf-8 and encoding_validate finds out about latin-1. Zero bytes that are not utf-16 make it binary, never latin-1
+size_t encoding_detect(text_encoding *e, const char *s, size_t n) {
+    encoding_init(e);
+    const unsigned char *u = (const unsigned char *)s;
+    if (n >= 2 && u[0] == 0xFF && u[1] == 0xFE) {
+        e->kind = ENCODING_UTF16LE;
+        e->bom = 1;
+        return 2;
+    }
+    if (n >= 2 && u[0] == 0xFE && u[1] == 0xFF) {
+        e->kind = ENCODING_UTF16BE;
+        e->bom = 1;
+        return 2;
+    }
+    size_t sample = n < ENCODING_SAMPLE ? n & ~(size_t)1 : ENCODING_SAMPLE;
+    size_t even = 0, odd = 0;
+    for (size_t i = 0; i < sample; i += 2) {
+        even += u[i] == 0;
+        odd += u[i + 1] == 0;
+    }
+    if (sample >= 4 && odd * 4 > sample && even * 16 < odd) e->kind = ENCODING_UTF16LE;
+    if (sample >= 4 && even * 4 > sample && odd * 16 < even) e->kind = ENCODING_UTF16BE;
+    if (e->kind == ENCODING_UTF8 && memchr(s, '\0', n < ENCODING_SAMPLE ? n : ENCODING_SAMPLE)) {
+        e->nonascii = 1;   // binary, its bytes stay as they are and the ones that are no utf-8 are only counted
+    }
+    return 0;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+// the lookup validator of Keiser and Lemire: every byte pair is classified by three 16 entry tables on the
+// high and low nibbles, any bit they agree on is an error, and the bytes that must be a 2nd or 3rd continuation
+// are checked against the pairs. 16 bytes per step without a branch. Only SSSE3 has the shuffle the lookups
+// need, so it is built for that alone and picked at run time. Returns 0 unless [0, n) holds only whole, valid
+// characters, 2 when some of them are multibyte. The caller makes sure it starts and ends on a boundary
+__attribute__((target("ssse3"))) static int utf8_valid_ssse3(const unsigned char *s, size_t n) {
+    enum {
+        TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2, TOO_LARGE = 1 << 3, SURROGATE = 1 << 4,
+        OVERLONG_2 = 1 << 5, TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6, TWO_CONTS = 1 << 7,
+        CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+    };
+    const __m128i byte_1_high = _mm_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte_1_low = _mm_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+        CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte_2_high = _mm_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i incomplete_max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                 (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m128i prev = _mm_setzero_si128(), error = _mm_setzero_si128(), incomplete = _mm_setzero_si128();
+    int multibyte = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i in;
+        if (n - i >= 16) {
+            in = _mm_loadu_si128((const __m128i *)(s + i));
+        } else {   // zeros after the end are ascii, a character cut there shows up as too short
+            unsigned char tail[16] = {0};
+            memcpy(tail, s + i, n - i);
+            in = _mm_loadu_si128((const __m128i *)tail);
+        }
+        if (_mm_movemask_epi8(in) == 0) {   // ascii, only a character the last 16 bytes left open is wrong
+            error = _mm_or_si128(error, incomplete);
+            incomplete = _mm_setzero_si128();
+            prev = _mm_setzero_si128();   // any ascii classifies the same
+            i += (encoding_ascii((const char *)s + i, n - i) & ~(size_t)15) - 16 * (n - i >= 16);
+            continue;
+        }
+        multibyte = 1;
+        __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+        __m128i special = _mm_and_si128(
+            _mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                          _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+            _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+        __m128i third = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), _mm_set1_epi8((char)(0xE0 - 0x80)));
+        __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), _mm_set1_epi8((char)(0xF0 - 0x80)));
+        __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+        error = _mm_or_si128(error, _mm_xor_si128(must23, special));
+        incomplete = _mm_subs_epu8(in, incomplete_max);
+        prev = in;
+    }
+    error = _mm_or_si128(error, incomplete);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) return 0;
+    return 1 + multibyte;
+}
+#endif
+
+
+// where the last character of the n bytes starts when the block cuts it off, n when it ends whole
+static size_t utf8_complete(const unsigned char *s, size_t n) {
+    for (size_t back = 1; back <= 3 && back <= n; ++back) {
+        unsigned char c = s[n - back];
+        if ((c & 0xC0) == 0x80) continue;
+        size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        return need > back ? n - back : n;
+    }
+    return n;
+}
+
+
+// byte by byte, for what the vector check does not take: the ends of a block and a block with an error in it.
+// Stops at the first character boundary at or after stop. -1 when the file turned out to be latin-1
+static long utf8_scan(text_encoding *e, const unsigned char *u, size_t i, size_t n, size_t stop, int *valid) {
+    while (i < n) {
+        if (e->state == 0) {
+            if (i >= stop) break;
+            i += encoding_ascii((const char *)u + i, n - i);
+            if (i >= n) break;
+            unsigned char c = u[i++];
+            e->lower = 0x80;
+            e->upper = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF) {
+                e->state = 1;
+            } else if (c >= 0xE0 && c <= 0xEF) {
+                e->state = 2;
+                if (c == 0xE0) e->lower = 0xA0;   // overlong
+                if (c == 0xED) e->upper = 0x9F;   // surrogates
+            } else if (c >= 0xF0 && c <= 0xF4) {
+                e->state = 3;
+                if (c == 0xF0) e->lower = 0x90;
+                if (c == 0xF4) e->upper = 0x8F;   // past U+10FFFF
+            } else if (!e->nonascii && !*valid) {
+                return -1;
+            } else {
+                e->invalid++;
+            }
+            continue;
+        }
+        unsigned char c = u[i];
+        e->state = c < e->lower || c > e->upper ? 0 : e->state - 1;
+        if (c < e->lower || c > e->upper) {   // cut short, the byte starts over as a character of its own
+            if (!e->nonascii && !*valid) return -1;
+            e->invalid++;
+            continue;
+        }
+        e->lower = 0x80;
+        e->upper = 0xBF;
+        if (e->state == 0) *valid = 1;
+        ++i;
+    }
+    return (long)i;
+}
+
+
+// checks the next block of a file that is utf-8 so far, a sequence may go on into the next block. 1 while it
+// stays utf-8. 0 when its first non-ascii bytes are not valid utf-8, it is latin-1 then and everything before
+// this block was ascii, the same in both. Invalid bytes after valid ones are only counted
+int encoding_validate(text_encoding *e, const char *s, size_t n, int last) {
+    const unsigned char *u = (const unsigned char *)s;
+    int valid = 0;
+    long i = utf8_scan(e, u, 0, n, 0, &valid);   // the rest of a character the last block started
+    if (i < 0) {
+        e->kind = ENCODING_LATIN1;
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    size_t end = utf8_complete(u, n);
+    int simd = (size_t)i < end && __builtin_cpu_supports("ssse3") ? utf8_valid_ssse3(u + i, end - (size_t)i) : 0;
+    if (simd) {   // otherwise the bytes below find the error and decide what it means
+        if (simd == 2) valid = 1;
+        i = (long)end;
+    }
+#endif
+    i = utf8_scan(e, u, (size_t)i, n, n, &valid);
+    if (i >= 0 && last && e->state > 0) {
+        if (!e->nonascii && !valid) i = -1;
+        e->invalid++;
+        e->state = 0;
+    }
+    if (i < 0) {
+        e->kind = ENCODING_LATIN1;
+        return 0;
+    }
+    e->nonascii = e->nonascii || valid || e->invalid > 0 || e->state > 0;
+    return 1;
+}
+
+
+// cp as utf-8 into out, the bytes it took
+static size_t utf8_put(uint32_t cp, char *out) {
+    unsigned char *o = (unsigned char *)out;
+    if (cp < 0x80) {
+        o[0] = (unsigned char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        o[0] = (unsigned char)(0xC0 | (cp >> 6));
+        o[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        o[0] = (unsigned char)(0xE0 | (cp >> 12));
+        o[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        o[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    o[0] = (unsigned char)(0xF0 | (cp >> 18));
+    o[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+    o[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    o[3] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+
+// code point of the utf-8 sequence at s and its length in *len, U+FFFD for one invalid byte. A NUL or the end
+// of the n bytes cuts a sequence short like any other byte that is not a continuation
+uint32_t utf8_decode(const char *s, size_t n, size_t *len) {
+    const unsigned char *u = (const unsigned char *)s;
+    *len = 1;
+    if (n == 0) return 0xFFFD;
+    if (u[0] < 0x80) return u[0];
+    int need = u[0] >= 0xF0 ? 3 : u[0] >= 0xE0 ? 2 : u[0] >= 0xC2 ? 1 : -1;
+    if (need < 0 || u[0] > 0xF4 || (size_t)need >= n) return 0xFFFD;
+    uint32_t cp = u[0] & (0x3F >> need);
+    for (int k = 1; k <= need; ++k) {
+        if ((u[k] & 0xC0) != 0x80) return 0xFFFD;
+        cp = (cp << 6) | (u[k] & 0x3F);
+    }
+    static const uint32_t least[4] = {0, 0x80, 0x800, 0x10000};
+    if (cp < least[need] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0xFFFD;
+    *len = (size_t)need + 1;
+    return cp;
+}
+
+
+// the next n bytes of a latin-1 or utf-16 file as utf-8 into out, which has room for ENCODING_GROWTH(n).
+// A utf-16 pair or unit cut by the end of the block waits in e for the next one, last flushes it
+size_t encoding_decode(text_encoding *e, const char *in, size_t n, char *out, int last) {
+    const unsigned char *u = (const unsigned char *)in;
+    size_t o = 0, i = 0;
+    if (e->kind == ENCODING_LATIN1) {
+        while (i < n) {
+            size_t ascii = encoding_ascii(in + i, n - i);
+            memcpy(out + o, in + i, ascii);
+            i += ascii;
+            o += ascii;
+            if (i < n) o += utf8_put(u[i++], out + o);
+        }
+        return o;
+    }
+    int be = e->kind == ENCODING_UTF16BE;
+    while (i < n) {
+        unsigned int unit;
+        if (e->odd) {   // the first byte came with the last block
+            unsigned int first = e->odd & 0xFF;
+            unit = be ? (first << 8) | u[i] : first | ((unsigned int)u[i] << 8);
+            e->odd = 0;
+            i += 1;
+        } else if (i + 1 < n) {
+            unit = be ? ((unsigned int)u[i] << 8) | u[i + 1] : u[i] | ((unsigned int)u[i + 1] << 8);
+            i += 2;
+        } else {
+            e->odd = 0x100 | u[i++];
+            break;
+        }
+        unsigned int high = e->pending;
+        e->pending = 0;
+        if (high && unit >= 0xDC00 && unit <= 0xDFFF) {
+            o += utf8_put(0x10000 + ((high - 0xD800) << 10) + (unit - 0xDC00), out + o);
+            continue;
+        }
+        if (high) o += utf8_put(0xFFFD, out + o);   // a lone high surrogate
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            e->pending = unit;
+        } else {
+            o += utf8_put(unit >= 0xDC00 && unit <= 0xDFFF ? 0xFFFD : unit, out + o);
+        }
+    }
+    if (last && (e->pending || e->odd)) {
+        o += utf8_put(0xFFFD, out + o);
+        e->pending = e->odd = 0;
+    }
+    return o;
+}
+
+
+// one character in a latin-1 or utf-16 file, '?' for what latin-1 does not have
+static size_t encode_char(int kind, uint32_t cp, unsigned char *o) {
+    if (kind == ENCODING_LATIN1) {
+        o[0] = cp < 0x100 ? (unsigned char)cp : '?';
+        return 1;
+    }
+    unsigned int units[2] = {cp, 0};
+    int count = 1;
+    if (cp >= 0x10000) {
+        units[0] = 0xD800 + ((cp - 0x10000) >> 10);
+        units[1] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+        count = 2;
+    }
+    for (int k = 0; k < count; ++k) {
+        o[2 * k] = (unsigned char)(kind == ENCODING_UTF16BE ? units[k] >> 8 : units[k] & 0xFF);
+        o[2 * k + 1] = (unsigned char)(kind == ENCODING_UTF16BE ? units[k] & 0xFF : units[k] >> 8);
+    }
+    return (size_t)count * 2;
+}
+
+
+// bytes of the utf-8 sequence lead starts
+static size_t utf8_need(unsigned char lead) {
+    return lead >= 0xF0 && lead <= 0xF4 ? 4 : lead >= 0xE0 && lead <= 0xEF ? 3 : lead >= 0xC2 && lead <= 0xDF ? 2 : 1;
+}
+
+
+// the next n bytes of the buffer in the file's encoding into out, which has room for ENCODING_GROWTH(n).
+// A character cut by the end of a piece waits in e for the piece after it, n == 0 flushes it.
+// Latin-1 writes '?' for what does not fit, a save checks with encoding_fits_latin1 before
+size_t encoding_encode(text_encoding *e, const char *in, size_t n, char *out) {
+    unsigned char *o = (unsigned char *)out;
+    size_t w = 0, i = 0, len;
+    if (e->carry_len > 0) {
+        char seq[4];
+        size_t have = (size_t)e->carry_len;
+        memcpy(seq, e->carry, have);
+        while (have < 4 && i < n && ((unsigned char)in[i] & 0xC0) == 0x80) seq[have++] = in[i++];
+        if (i == n && n > 0 && have < utf8_need((unsigned char)seq[0])) {
+            memcpy(e->carry, seq, have);
+            e->carry_len = (int)have;
+            return 0;
+        }
+        e->carry_len = 0;
+        w += encode_char(e->kind, utf8_decode(seq, have, &len), o);
+        for (; len < have; ++len) w += encode_char(e->kind, 0xFFFD, o + w);
+    }
+    while (i < n) {
+        if (e->kind == ENCODING_LATIN1) {   // ascii is the same in latin-1
+            size_t ascii = encoding_ascii(in + i, n - i);
+            memcpy(o + w, in + i, ascii);
+            w += ascii;
+            i += ascii;
+            if (i == n) break;
+        }
+        size_t need = utf8_need((unsigned char)in[i]);
+        if (need > n - i) {
+            size_t k = 1;
+            while (i + k < n && ((unsigned char)in[i + k] & 0xC0) == 0x80) ++k;
+            if (i + k == n) {
+                memcpy(e->carry, in + i, k);
+                e->carry_len = (int)k;
+                break;
+            }
+        }
+        uint32_t cp = utf8_decode(in + i, n - i, &len);
+        i += len;
+        w += encode_char(e->kind, cp, o + w);
+    }
+    return w;
+}
+
+
+// counts the line breaks of the next n bytes of the text and how many are "\r\n". 16 bytes are compared at a
+// time, a '\n' with the bit of a '\r' right before it is a crlf, the top '\r' carries over to the next 16
+void encoding_line_ends(text_encoding *e, const char *s, size_t n) {
+    size_t i = 0;
+    unsigned int cr = (unsigned int)e->cr;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n'), ret = _mm_set1_epi8('\r');
+    for (; i + 16 <= n; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned int lf = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(in, nl));
+        unsigned int r = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(in, ret));
+        e->lf += (size_t)__builtin_popcount(lf);
+        e->crlf += (size_t)__builtin_popcount(lf & ((r << 1) | cr));
+        cr = r >> 15;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (s[i] == '\n') {
+            e->lf++;
+            e->crlf += cr;
+        }
+        cr = s[i] == '\r';
+    }
+    e->cr = (int)cr;
+}
+
+
+// every character of the n utf-8 bytes is one latin-1 can hold, only 0xC2 and 0xC3 start any of them
+int encoding_fits_latin1(const char *s, size_t n) {
+    size_t i = 0;
+    while ((i += encoding_ascii(s + i, n - i)) < n) {
+        unsigned char c = (unsigned char)s[i++];
+        if (c != 0xC2 && c != 0xC3 && (c & 0xC0) != 0x80) return 0;
+    }
+    return 1;
+}
+
+
+const char *encoding_name(int kind) {
+    switch (kind) {
+    case ENCODING_LATIN1: return "Latin-1";
+    case ENCODING_UTF16LE: return "UTF-16LE";
+    case ENCODING_UTF16BE: return "UTF-16BE";
+    default: return "UTF-8";
+    }
+}
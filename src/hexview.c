@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyfiledialogs.h"
+#include "hexview.h"
+#include "cursors.h"
+
+#define HEX_GAP 2   // cells between the offsets, the hex bytes and the ascii
+
+
+void hexview_init(hexview *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+
+void hexview_free(hexview *h) {
+    for (int i = 0; i < HEX_GLYPHS; ++i) {
+        if (h->glyphs[i]) SDL_DestroyTexture(h->glyphs[i]);
+    }
+    hexview_init(h);
+}
+
+
+// one texture per printable character, made the first time the view is drawn and kept for the font's lifetime
+static void hexview_glyphs(hexview *h, SDL_Renderer *renderer, sdltext *txt) {
+    for (int i = 0; i < HEX_GLYPHS; ++i) {
+        int c = ' ' + i;
+        if (txt->glyph_advance[c] > h->cell) h->cell = txt->glyph_advance[c];
+        SDL_Surface *surf = c == ' ' ? NULL : TTF_RenderGlyph_Solid(txt->font, (Uint16)c, txt->color);
+        if (!surf) continue;
+        h->glyphs[i] = SDL_CreateTextureFromSurface(renderer, surf);
+        h->glyph_w[i] = surf->w;
+        if (surf->h > h->row_h) h->row_h = surf->h;
+        SDL_FreeSurface(surf);
+    }
+    if (h->cell == 0) h->cell = 16;
+    if (h->row_h == 0) h->row_h = 32;
+}
+
+
+// hex digits of the offsets, 8 until the document needs more
+static int hexview_digits(size_t length) {
+    int digits = 8;
+    while (digits < 16 && (length >> (4 * digits)) != 0) digits++;
+    return digits;
+}
+
+
+static int hexview_row_height(hexview *h, sdltext *txt) {
+    return txt->line_height > 0 ? txt->line_height : h->row_h > 0 ? h->row_h : 32;
+}
+
+
+static size_t hexview_rows(sdltext *txt) {
+    return txt->MAX_VISIBLE_LINES > 0 ? (size_t)txt->MAX_VISIBLE_LINES : 1;
+}
+
+
+static size_t hexview_length(hexview *h, sdltext *txt) {
+    return h->view ? viewer_readable(h->view) : buffer_length(&txt->buf);
+}
+
+
+static size_t hexview_cursor(hexview *h, sdltext *txt) {
+    return h->view ? h->at : cursor_offset(txt);
+}
+
+
+static size_t hexview_read(hexview *h, sdltext *txt, size_t offset, char *out, size_t len) {
+    return h->view ? viewer_read(h->view, offset, out, len) : buffer_read(&txt->buf, offset, out, len);
+}
+
+
+// left edge of the hex pair of byte i in a row, the second half of the row sits one cell further right
+static int hexview_hex_x(hexview *h, int digits, int i) {
+    return 20 + (digits + HEX_GAP + i * 3 + (i >= HEX_ROW / 2)) * h->cell;
+}
+
+
+static int hexview_ascii_x(hexview *h, int digits, int i) {
+    return 20 + (digits + HEX_GAP + HEX_ROW * 3 + HEX_GAP + i) * h->cell;
+}
+
+
+static void hexview_glyph(hexview *h, SDL_Renderer *renderer, unsigned char c, int x, int y) {
+    if (c <= ' ' || c > '~' || !h->glyphs[c - ' ']) return;
+    SDL_Rect dst = {x + (h->cell - h->glyph_w[c - ' ']) / 2, y, h->glyph_w[c - ' '], h->row_h};
+    SDL_RenderCopy(renderer, h->glyphs[c - ' '], NULL, &dst);
+}
+
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+
+// moves the cursor to offset, clamped to the document, and scrolls it onto the screen
+static void hexview_move(hexview *h, sdltext *txt, size_t offset) {
+    size_t length = hexview_length(h, txt);
+    if (offset > length) offset = length;
+    if (h->view) {
+        h->at = offset;
+    } else {
+        set_cursor_offset(txt, offset);
+        txt->sel.anchor = txt->sel.head = offset;
+    }
+    h->low = 0;
+    size_t row = offset / HEX_ROW, rows = hexview_rows(txt);
+    if (row < h->top) {
+        h->top = row;
+    } else if (row >= h->top + rows) {
+        h->top = row - rows + 1;
+    }
+}
+
+
+// switches the window to bytes, the cursor stays on the byte it was on and extra cursors go
+void hexview_open(hexview *h, sdltext *txt) {
+    size_t offset = cursor_offset(txt), rows = hexview_rows(txt);
+    cursors_clear(txt);
+    h->active = 1;
+    h->view = NULL;
+    h->top = offset / HEX_ROW > rows / 2 ? offset / HEX_ROW - rows / 2 : 0;
+    hexview_move(h, txt, offset);
+}
+
+
+// switches a view to the bytes of its file, read-only, starting at the line on top of the screen. The document
+// under the view is left alone
+void hexview_open_view(hexview *h, sdltext *txt, viewer *v) {
+    char c;
+    viewer_line(v, v->top, &c, 1);   // finds where the top line starts
+    h->active = 1;
+    h->view = v;
+    h->top = v->at_line == v->top ? v->at_offset / HEX_ROW : 0;
+    hexview_move(h, txt, h->top * HEX_ROW);
+}
+
+
+// the rows on screen, read with one buffer_read or viewer_read whatever the file holds. The caller clears and
+// presents
+void hexview_render(hexview *h, sdlwindow *win, sdltext *txt) {
+    static const char hex[] = "0123456789abcdef";
+    if (h->row_h == 0) hexview_glyphs(h, win->renderer, txt);
+    if (txt->line_height == 0) txt->line_height = h->row_h;
+    unsigned char bytes[HEX_ROWS_MAX * HEX_ROW];
+    size_t length = hexview_length(h, txt);
+    size_t rows = hexview_rows(txt);
+    if (rows > HEX_ROWS_MAX) rows = HEX_ROWS_MAX;
+    size_t start = h->top * HEX_ROW;
+    size_t n = start < length ? hexview_read(h, txt, start, (char *)bytes, rows * HEX_ROW) : 0;
+    int digits = hexview_digits(length);
+    int lh = hexview_row_height(h, txt);
+
+    size_t cursor = hexview_cursor(h, txt);
+    int cursor_y = 20 + (int)(cursor / HEX_ROW - h->top) * lh;
+    int cursor_i = (int)(cursor % HEX_ROW);
+    int cursor_visible = cursor / HEX_ROW >= h->top && cursor / HEX_ROW < h->top + rows;
+    if (cursor_visible) {   // the byte is marked in both columns
+        SDL_Rect marks[2] = {{hexview_hex_x(h, digits, cursor_i), cursor_y, 2 * h->cell, lh},
+                             {hexview_ascii_x(h, digits, cursor_i), cursor_y, h->cell, lh}};
+        SDL_SetRenderDrawColor(win->renderer, 180, 210, 255, 255);
+        SDL_RenderFillRects(win->renderer, marks, 2);
+    }
+
+    for (size_t r = 0; r < rows && (r == 0 || r * HEX_ROW < n); ++r) {   // an empty document still has its one row
+        int y = 20 + (int)r * lh;
+        size_t row_offset = start + r * HEX_ROW;
+        for (int d = 0; d < digits; ++d) {
+            hexview_glyph(h, win->renderer, hex[(row_offset >> (4 * (digits - 1 - d))) & 15], 20 + d * h->cell, y);
+        }
+        for (int i = 0; i < HEX_ROW && r * HEX_ROW + i < n; ++i) {
+            unsigned char c = bytes[r * HEX_ROW + i];
+            int x = hexview_hex_x(h, digits, i);
+            hexview_glyph(h, win->renderer, hex[c >> 4], x, y);
+            hexview_glyph(h, win->renderer, hex[c & 15], x + h->cell, y);
+            hexview_glyph(h, win->renderer, c >= ' ' && c <= '~' ? c : '.', hexview_ascii_x(h, digits, i), y);
+        }
+    }
+
+    if (cursor_visible && (SDL_GetTicks() / 500) % 2 == 0) {   // in front of the half a hex digit goes into
+        SDL_Rect bar = {hexview_hex_x(h, digits, cursor_i) + h->low * h->cell, cursor_y, 2, lh};
+        SDL_SetRenderDrawColor(win->renderer, 0, 0, 0, 255);
+        SDL_RenderFillRect(win->renderer, &bar);
+    }
+}
+
+
+// keys while bytes are shown, 0 for the ones the document handles as usual (undo, redo)
+int hexview_key(hexview *h, sdltext *txt, minimap *map, SDL_Keycode sym, Uint16 mod) {
+    size_t cursor = hexview_cursor(h, txt);
+    size_t rows = hexview_rows(txt), page = rows * HEX_ROW, length = hexview_length(h, txt);
+    int ctrl = (mod & KMOD_CTRL) != 0;
+    if (ctrl && (sym == SDLK_z || sym == SDLK_y)) return 0;
+    if (sym == SDLK_LEFT) {
+        hexview_move(h, txt, cursor > 0 ? cursor - 1 : 0);
+    } else if (sym == SDLK_RIGHT) {
+        hexview_move(h, txt, cursor + 1);
+    } else if (sym == SDLK_UP) {
+        hexview_move(h, txt, cursor >= HEX_ROW ? cursor - HEX_ROW : cursor);
+    } else if (sym == SDLK_DOWN) {
+        hexview_move(h, txt, cursor + HEX_ROW <= length ? cursor + HEX_ROW : cursor);
+    } else if (sym == SDLK_PAGEUP) {   // the screen moves with the cursor
+        h->top = h->top > rows ? h->top - rows : 0;
+        hexview_move(h, txt, cursor > page ? cursor - page : cursor % HEX_ROW);
+    } else if (sym == SDLK_PAGEDOWN) {
+        if ((h->top + rows) * HEX_ROW <= length) h->top += rows;
+        hexview_move(h, txt, cursor + page <= length ? cursor + page : length);
+    } else if (sym == SDLK_HOME) {
+        hexview_move(h, txt, ctrl ? 0 : cursor - cursor % HEX_ROW);
+    } else if (sym == SDLK_END) {
+        hexview_move(h, txt, ctrl ? length : cursor - cursor % HEX_ROW + HEX_ROW - 1);
+    } else if (sym == SDLK_g && ctrl) {   // decimal, or hex with 0x in front
+        const char *answer = tinyfd_inputBox("Go to offset", "Offset (0x for hex):", "");
+        if (answer && answer[0]) {
+            hexview_move(h, txt, (size_t)strtoull(answer, NULL, 0));
+            size_t row = hexview_cursor(h, txt) / HEX_ROW;
+            h->top = row > rows / 2 ? row - rows / 2 : 0;
+        }
+    } else if ((sym == SDLK_DELETE || sym == SDLK_BACKSPACE) && !ctrl && !h->view) {   // takes the byte out
+        if (sym == SDLK_BACKSPACE && cursor == 0) return 1;
+        size_t at = sym == SDLK_DELETE ? cursor : cursor - 1;
+        if (at >= length) return 1;
+        char c = 0;
+        buffer_read(&txt->buf, at, &c, 1);
+        int line = (int)buffer_line_of(&txt->buf, at);
+        undo_begin(&txt->undo, cursor);
+        text_delete(txt, at, 1);
+        undo_end(&txt->undo, at, UNDO_OTHER, 0, SDL_GetTicks());
+        hexview_move(h, txt, at);
+        minimap_invalidate(map, line, c == '\n' ? -1 : line);
+    }
+    return 1;   // everything else would edit the document as text
+}
+
+
+// typed hex digits overwrite the byte at the cursor a half at a time, past the end they add one. Other text is
+// ignored. Every byte is replaced in the piece buffer like any edit, so undo, the journal and saves see it
+void hexview_type(hexview *h, sdltext *txt, minimap *map, const char *text, size_t len) {
+    if (h->view) return;   // a view is read-only
+    size_t cursor = cursor_offset(txt);
+    int edited = 0, first_line = (int)buffer_line_of(&txt->buf, cursor), lines = 0;
+    for (size_t k = 0; k < len; ++k) {
+        int d = hex_digit(text[k]);
+        if (d < 0) continue;
+        char old = 0;
+        int have = cursor < buffer_length(&txt->buf);
+        if (have) buffer_read(&txt->buf, cursor, &old, 1);
+        char c = (char)(h->low ? ((unsigned char)old & 0xF0) | d : (d << 4) | ((unsigned char)old & 0x0F));
+        if (!edited) undo_begin(&txt->undo, cursor);
+        edited = 1;
+        if (have) text_delete(txt, cursor, 1);
+        text_insert(txt, cursor, &c, 1);
+        if (old == '\n' || c == '\n') lines = 1;
+        if (h->low) cursor++;
+        h->low = !h->low;
+    }
+    if (!edited) return;
+    undo_end(&txt->undo, cursor, UNDO_OTHER, 0, SDL_GetTicks());
+    int low = h->low;
+    hexview_move(h, txt, cursor);
+    h->low = low;
+    minimap_invalidate(map, first_line, lines ? -1 : (int)buffer_line_of(&txt->buf, cursor));
+}
+
+
+// a click on a hex digit or an ascii character puts the cursor on its byte
+void hexview_click(hexview *h, sdltext *txt, int x, int y) {
+    if (h->row_h == 0 || y < 20) return;
+    int digits = hexview_digits(hexview_length(h, txt));
+    size_t row = h->top + (size_t)((y - 20) / hexview_row_height(h, txt));
+    int i, low = 0;
+    if (x >= hexview_ascii_x(h, digits, 0)) {
+        i = (x - hexview_ascii_x(h, digits, 0)) / h->cell;
+    } else if (x >= hexview_hex_x(h, digits, 0)) {
+        int slot = (x - hexview_hex_x(h, digits, 0)) / h->cell;
+        if (slot >= HEX_ROW / 2 * 3) slot--;   // the gap in the middle of the row
+        i = slot / 3;
+        low = slot % 3 == 1;
+    } else {
+        i = 0;
+    }
+    if (i >= HEX_ROW) i = HEX_ROW - 1;
+    hexview_move(h, txt, row * HEX_ROW + (size_t)i);
+    h->low = low && hexview_cursor(h, txt) == row * HEX_ROW + (size_t)i;
+}
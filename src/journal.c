@@ -0,0 +1,1015 @@
+#define _GNU_SOURCE   // mremap
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC "BUNDO04"   // 8 bytes with the terminator
+
+#define JOURNAL_GROUP 1
+#define JOURNAL_TRIM 2
+#define JOURNAL_SAVE 3
+#define JOURNAL_POSITION 4
+#define JOURNAL_LOST 5       // a group too big to journal, history is cut there
+
+#define JOURNAL_INLINE UINT64_MAX   // a part whose bytes follow it
+
+// the file is a header and then records, everything 8 byte aligned
+typedef struct{
+char magic[8];
+uint64_t used;         // bytes of records, the rest of the file is room to grow
+uint32_t pid;          // process writing it
+uint32_t clean;        // set when that process closed it, a journal left at 0 outlived a crash
+}journal_header;
+
+typedef struct{
+uint32_t type;
+uint32_t pad;
+uint64_t size;         // payload bytes following, padded to 8
+}journal_record;
+
+typedef struct{
+uint64_t index;        // position in the history at the time it was written, later groups from here are gone
+uint64_t cursor_before;
+uint64_t cursor_after;
+uint32_t kind;
+uint32_t op_count;
+uint64_t file_hash;    // of the file parts at an offset point into, JOURNAL_INLINE when no part does
+}journal_group;
+
+typedef struct{
+uint32_t type;
+uint32_t parts;
+uint64_t offset;
+uint64_t len;          // text bytes of all its parts
+}journal_op;
+
+// a stretch of an op's text, either the bytes themselves or where the file has them
+typedef struct{
+uint64_t at;           // offset in the file, JOURNAL_INLINE when len bytes follow, padded to 8
+uint64_t len;
+}journal_part;
+
+typedef struct{
+uint64_t hash;
+uint64_t current;
+}journal_mark;
+
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+
+void journal_init(journal *j) {
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    j->saved = -1;
+    j->pending = -1;
+    j->position = -1;
+}
+
+
+// stops writing, the restored mapping stays since undo pieces may still point into it
+void journal_close(journal *j) {
+    if (j->fd >= 0) {
+        if (j->map) {
+            ((journal_header *)j->map)->used = j->used;
+            ((journal_header *)j->map)->clean = 1;
+            munmap(j->map, j->cap);
+        }
+        if (ftruncate(j->fd, (off_t)j->used) != 0) perror("Could not trim undo journal");
+        close(j->fd);
+        if ((j->untitled || !j->history) && j->path) unlink(j->path);   // nothing worth keeping around
+    }
+    free(j->path);
+    free(j->file);
+    char *restored = j->restored;
+    size_t restored_len = j->restored_len;
+    journal_init(j);
+    j->restored = restored;
+    j->restored_len = restored_len;
+}
+
+
+// call after the buffer and undo log holding restored pieces are freed
+void journal_free(journal *j) {
+    journal_close(j);
+    if (j->restored) munmap(j->restored, j->restored_len);
+    journal_init(j);
+}
+
+
+// .<name>.bundo next to file
+static char *journal_path(const char *file) {
+    const char *slash = strrchr(file, '/');
+    const char *base = slash ? slash + 1 : file;
+    size_t dir = base - file;
+    char *path = malloc(dir + strlen(base) + 8);
+    if (!path) return NULL;
+    memcpy(path, file, dir);
+    sprintf(path + dir, ".%s.bundo", base);
+    return path;
+}
+
+
+// crc-32 of the bytes in the low half and how many there were in the high one. zlib's crc goes a word at a
+// time, several times faster than a byte at a time, and saves hash what they write with it while they write it
+uint64_t journal_hash_update(uint64_t h, const char *data, size_t len) {
+    uLong crc = crc32_z((uLong)(uint32_t)h, (const Bytef *)data, len);
+    return ((h >> 32) + len) << 32 | (uint32_t)crc;
+}
+
+
+// hash of a followed by b, b_len bytes long, without either of them being read again
+uint64_t journal_hash_combine(uint64_t a, uint64_t b, size_t b_len) {
+    uLong crc = crc32_combine((uLong)(uint32_t)a, (uLong)(uint32_t)b, (z_off_t)b_len);
+    return ((a >> 32) + (b >> 32)) << 32 | (uint32_t)crc;
+}
+
+
+void journal_blocks_free(journal_blocks *b) {
+    free(b->blocks);
+    memset(b, 0, sizeof(*b));
+}
+
+
+// len more bytes of the file that hash to hash, glued onto the last block while that stays within
+// JOURNAL_HASH_BLOCK
+int journal_blocks_add(journal_blocks *b, size_t len, uint64_t hash) {
+    if (len == 0) return 0;
+    b->len += len;
+    journal_block *last = b->count ? &b->blocks[b->count - 1] : NULL;
+    if (last && last->len + len <= JOURNAL_HASH_BLOCK) {
+        last->hash = journal_hash_combine(last->hash, hash, len);
+        last->len += len;
+        return 0;
+    }
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        journal_block *blocks = realloc(b->blocks, cap * sizeof(journal_block));
+        if (!blocks) return -1;
+        b->blocks = blocks;
+        b->cap = cap;
+    }
+    b->blocks[b->count].len = len;
+    b->blocks[b->count].hash = hash;
+    b->count++;
+    return 0;
+}
+
+
+// hashes len more bytes of the file, the last block is filled up first and the rest goes in whole blocks
+int journal_blocks_hash(journal_blocks *b, const char *data, size_t len) {
+    while (len > 0) {
+        size_t room = b->count ? JOURNAL_HASH_BLOCK - b->blocks[b->count - 1].len : 0;
+        size_t n = room ? room : JOURNAL_HASH_BLOCK;
+        if (n > len) n = len;
+        if (journal_blocks_add(b, n, journal_hash_update(JOURNAL_HASH_SEED, data, n)) != 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+// hash of the whole file
+uint64_t journal_blocks_total(const journal_blocks *b) {
+    uint64_t hash = JOURNAL_HASH_SEED;
+    for (size_t i = 0; i < b->count; ++i) hash = journal_hash_combine(hash, b->blocks[i].hash, b->blocks[i].len);
+    return hash;
+}
+
+
+// makes room for n more bytes, the file grows in big steps so appends are plain memory writes
+static int journal_reserve(journal *j, size_t n) {
+    if (j->map && j->used + n <= j->cap) return 0;
+    size_t new_cap = j->cap * 2;
+    if (new_cap < j->used + n + JOURNAL_GROW) new_cap = j->used + n + JOURNAL_GROW;
+    if (ftruncate(j->fd, (off_t)new_cap) != 0) return -1;
+    char *map = j->map ? mremap(j->map, j->cap, new_cap, MREMAP_MAYMOVE)
+                       : mmap(NULL, new_cap, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+    if (map == MAP_FAILED) return -1;
+    j->map = map;
+    j->cap = new_cap;
+    return 0;
+}
+
+
+// reserves a record of size payload bytes and returns where the payload goes
+static char *journal_append(journal *j, uint32_t type, size_t size) {
+    size_t total = sizeof(journal_record) + pad8(size);
+    if (journal_reserve(j, total) != 0) return NULL;
+    journal_record *r = (journal_record *)(j->map + j->used);
+    r->type = type;
+    r->pad = 0;
+    r->size = size;
+    memset((char *)(r + 1) + size, 0, pad8(size) - size);
+    j->used += total;
+    return (char *)(r + 1);
+}
+
+
+static int extent_compare(const void *a, const void *b) {
+    const journal_extent *x = a, *y = b;
+    if (x->chunk != y->chunk) return x->chunk < y->chunk ? -1 : 1;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+
+// the file of j->hash holds pieces one after another, NULL when that is not known. Call whenever the hash
+// changes, the text of groups written from then on refers to it instead of being copied
+void journal_file(journal *j, const piece *pieces, size_t count) {
+    free(j->file);
+    j->file = NULL;
+    j->file_count = 0;
+    if (count == 0 || !(j->file = malloc(count * sizeof(journal_extent)))) return;
+    size_t at = 0;
+    for (size_t i = 0; i < count; ++i) {
+        journal_extent x = {pieces[i].chunk, pieces[i].start, pieces[i].len, at};
+        j->file[i] = x;
+        at += x.len;
+    }
+    qsort(j->file, count, sizeof(journal_extent), extent_compare);
+    j->file_count = count;
+}
+
+
+// first extent at or after (chunk, start)
+static size_t extent_find(const journal_extent *e, size_t n, int chunk, size_t start) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[mid].chunk < chunk || (e[mid].chunk == chunk && e[mid].start + e[mid].len <= start)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// a part of an op's text on its way into the journal, data is NULL for one the file has
+typedef struct{
+const char *data;
+size_t at;
+size_t len;
+}text_part;
+
+typedef struct{
+text_part *parts;
+size_t count;
+size_t cap;
+size_t text;           // bytes of the parts that are copied
+}part_list;
+
+
+static int part_push(part_list *l, const char *data, size_t at, size_t len) {
+    text_part *last = l->count ? &l->parts[l->count - 1] : NULL;
+    if (!data && last && !last->data && last->at + last->len == at) {   // the file goes on
+        last->len += len;
+        return 0;
+    }
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 16;
+        text_part *parts = realloc(l->parts, cap * sizeof(text_part));
+        if (!parts) return -1;
+        l->parts = parts;
+        l->cap = cap;
+    }
+    text_part p = {data, data ? JOURNAL_INLINE : at, len};
+    l->parts[l->count++] = p;
+    if (data) l->text += len;
+    return 0;
+}
+
+
+// splits the pieces of op into what the file on disk has, by offset, and what has to be copied
+static int op_parts(journal *j, textbuffer *buf, undo_op *op, part_list *l) {
+    for (size_t k = 0; k < op->count; ++k) {
+        piece p = op->pieces[k];
+        while (p.len > 0) {
+            size_t x = extent_find(j->file, j->file_count, p.chunk, p.start);
+            const journal_extent *e = x < j->file_count && j->file[x].chunk == p.chunk ? &j->file[x] : NULL;
+            size_t n = p.len;
+            int ok;
+            if (e && e->start <= p.start) {
+                size_t inner = p.start - e->start;
+                if (n > e->len - inner) n = e->len - inner;
+                ok = part_push(l, NULL, e->at + inner, n) == 0;
+            } else {
+                if (e && e->start - p.start < n) n = e->start - p.start;   // copied up to where the file's bytes start
+                ok = part_push(l, buf->chunks[p.chunk].data + p.start, 0, n) == 0;
+            }
+            if (!ok) return -1;
+            p.start += n;
+            p.len -= n;
+        }
+    }
+    return 0;
+}
+
+
+// a group whose text is more than JOURNAL_TEXT_MAX, it stays undoable in this session but history does not
+// come back across it
+static int journal_write_lost(journal *j, size_t index) {
+    uint64_t *n = (uint64_t *)journal_append(j, JOURNAL_LOST, sizeof(uint64_t));
+    if (!n) return -1;
+    *n = index;
+    j->history = 1;
+    return 0;
+}
+
+
+// text the file on disk holds is written as its offset there, the rest is copied since the pieces it comes
+// from can be gone next session. Adds the bytes copied to *text
+static int journal_write_group(journal *j, textbuffer *buf, undo_group *g, size_t index, size_t *text) {
+    part_list l;
+    memset(&l, 0, sizeof(l));
+    size_t *ends = malloc((g->count ? g->count : 1) * sizeof(size_t));   // where the parts of each op end
+    int ok = ends != NULL;
+    for (size_t i = 0; ok && i < g->count; ++i) {
+        ok = op_parts(j, buf, &g->ops[i], &l) == 0;
+        ends[i] = l.count;
+    }
+    if (ok && l.text > JOURNAL_TEXT_MAX) {
+        free(ends);
+        free(l.parts);
+        return journal_write_lost(j, index);
+    }
+    size_t size = sizeof(journal_group) + g->count * sizeof(journal_op) + l.count * sizeof(journal_part);
+    for (size_t k = 0; k < l.count; ++k) {
+        if (l.parts[k].data) size += pad8(l.parts[k].len);
+    }
+    char *out = ok ? journal_append(j, JOURNAL_GROUP, size) : NULL;
+    if (!out) {
+        free(ends);
+        free(l.parts);
+        return -1;
+    }
+    journal_group *jg = (journal_group *)out;
+    jg->index = index;
+    jg->cursor_before = g->cursor_before;
+    jg->cursor_after = g->cursor_after;
+    jg->kind = (uint32_t)g->kind;
+    jg->op_count = (uint32_t)g->count;
+    jg->file_hash = JOURNAL_INLINE;
+    out += sizeof(journal_group);
+    size_t k = 0;
+    for (size_t i = 0; i < g->count; ++i) {
+        undo_op *op = &g->ops[i];
+        journal_op *jo = (journal_op *)out;
+        jo->type = (uint32_t)op->type;
+        jo->parts = (uint32_t)(ends[i] - k);
+        for (size_t m = k; m < ends[i]; ++m) {
+            if (!l.parts[m].data) jg->file_hash = j->hash;
+        }
+        if (jg->file_hash != JOURNAL_INLINE) j->referenced = 1;
+        jo->offset = op->offset;
+        jo->len = op->len;
+        out += sizeof(journal_op);
+        for (; k < ends[i]; ++k) {
+            text_part *t = &l.parts[k];
+            journal_part *jp = (journal_part *)out;
+            jp->at = t->at;
+            jp->len = t->len;
+            out += sizeof(journal_part);
+            if (!t->data) continue;
+            memcpy(out, t->data, t->len);
+            memset(out + t->len, 0, pad8(t->len) - t->len);
+            out += pad8(t->len);
+        }
+    }
+    *text += l.text;
+    free(ends);
+    free(l.parts);
+    j->history = 1;
+    return 0;
+}
+
+
+static void journal_write_mark(journal *j) {
+    journal_mark *m = (journal_mark *)journal_append(j, JOURNAL_SAVE, sizeof(journal_mark));
+    if (!m) return;
+    m->hash = j->hash;
+    m->current = (uint64_t)j->saved;
+}
+
+
+static void journal_write_header(journal *j) {
+    if (j->map) ((journal_header *)j->map)->used = j->used;
+}
+
+
+// starts an empty journal at path, a journal already there is unlinked first so mappings of it stay valid
+static int journal_create(journal *j, const char *path) {
+    unlink(path);
+    j->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (j->fd < 0) return -1;
+    j->used = 0;
+    if (journal_reserve(j, sizeof(journal_header)) != 0) return -1;
+    journal_header *h = (journal_header *)j->map;
+    memcpy(h->magic, JOURNAL_MAGIC, 8);
+    h->pid = (uint32_t)getpid();
+    h->clean = 0;
+    j->used = sizeof(journal_header);
+    journal_write_header(j);
+    j->compact_at = JOURNAL_COMPACT_SIZE;
+    return 0;
+}
+
+
+// rewrites the history groups [0, final) into a fresh journal and swaps it in, the old file keeps
+// existing for as long as the restored mapping needs it
+static void journal_compact(journal *j, textbuffer *buf, undolog *u, size_t final) {
+    char *tmp = malloc(strlen(j->path) + 5);
+    if (!tmp) return;
+    sprintf(tmp, "%s.tmp", j->path);
+    journal fresh;
+    journal_init(&fresh);
+    fresh.hash = j->hash;
+    fresh.file = j->file;   // the groups refer to the same file
+    fresh.file_count = j->file_count;
+    j->file = NULL;
+    int ok = journal_create(&fresh, tmp) == 0;
+    size_t text = 0;
+    for (size_t i = 0; ok && i < final; ++i) {
+        ok = journal_write_group(&fresh, buf, &u->groups[i], i, &text) == 0;
+    }
+    if (ok && j->saved >= 0 && (size_t)j->saved <= final) {
+        fresh.saved = j->saved;
+        journal_write_mark(&fresh);
+    }
+    journal_write_header(&fresh);
+    if (!ok || rename(tmp, j->path) != 0) {
+        perror("Could not compact undo journal");
+        j->file = fresh.file;
+        fresh.file = NULL;
+        journal_close(&fresh);
+        unlink(tmp);
+        free(tmp);
+        j->compact_at = j->used * 2;   // do not retry every frame
+        return;
+    }
+    free(tmp);
+    free(fresh.path);
+    fresh.path = j->path;
+    fresh.saved = j->saved >= 0 && (size_t)j->saved <= final ? j->saved : -1;
+    fresh.pending = j->pending >= 0 && (size_t)j->pending <= final ? j->pending : -1;
+    fresh.untitled = j->untitled;
+    fresh.history = j->history;
+    fresh.checkpoint = j->checkpoint;
+    fresh.restored = j->restored;
+    fresh.restored_len = j->restored_len;
+    j->path = NULL;
+    journal_close(j);
+    *j = fresh;
+    if (j->compact_at < j->used * 2) j->compact_at = j->used * 2;
+}
+
+
+// writes the groups that changed since the last call, those after budget bytes of copied text wait for the
+// next call
+static void journal_write(journal *j, textbuffer *buf, undolog *u, unsigned int now, size_t budget) {
+    if (j->fd < 0) return;
+    if (u->trimmed > 0) {
+        uint64_t *n = (uint64_t *)journal_append(j, JOURNAL_TRIM, sizeof(uint64_t));
+        if (n) *n = u->trimmed;
+        if (j->saved >= 0) j->saved = j->saved >= (long long)u->trimmed ? j->saved - (long long)u->trimmed : -1;
+        if (j->pending >= 0) j->pending = j->pending >= (long long)u->trimmed ? j->pending - (long long)u->trimmed : -1;
+        j->position = -1;
+        u->trimmed = 0;
+    }
+    size_t final = u->open && u->count > 0 ? u->count - 1 : u->count;   // the open group can still grow
+    if (u->stable > final) u->stable = final;
+    if (u->open && u->count > 0 && now - j->checkpoint >= JOURNAL_CHECKPOINT_MS) {
+        final = u->count;   // written now and again once it closes, the later record wins
+        j->checkpoint = now;
+    }
+    size_t text = 0;
+    int behind = 0;
+    for (size_t i = u->stable; i < final; ++i) {
+        if (text >= budget) {
+            final = i;
+            behind = 1;
+            break;
+        }
+        if (j->saved >= 0 && i < (size_t)j->saved) j->saved = -1;   // history went another way before the save
+        if (j->pending >= 0 && i < (size_t)j->pending) j->pending = -1;
+        if (journal_write_group(j, buf, &u->groups[i], i, &text) != 0) {
+            final = i;
+            break;
+        }
+    }
+    u->stable = u->open && final == u->count ? final - 1 : final;
+    if (!behind && j->position != (long long)u->current) {   // undo and redo move it without writing a group
+        uint64_t *p = (uint64_t *)journal_append(j, JOURNAL_POSITION, sizeof(uint64_t));
+        if (p) {
+            *p = u->current;
+            j->position = (long long)u->current;
+        }
+    }
+    journal_write_header(j);
+    if (j->used > j->compact_at) journal_compact(j, buf, u, u->stable);
+}
+
+
+// writes the groups that changed since the last call, once per frame, the kernel flushes the mapping
+// on its own so nothing here waits for the disk. Every JOURNAL_CHECKPOINT_MS the group still open is
+// written too, a crash then loses at most that much typing. A frame copies up to JOURNAL_SYNC_TEXT of
+// text, a paste of a whole file goes in over a few frames
+void journal_sync(journal *j, textbuffer *buf, undolog *u, unsigned int now) {
+    journal_write(j, buf, u, now, JOURNAL_SYNC_TEXT);
+}
+
+
+// a save of the buffer to file started, with the journal moving along when it goes somewhere new. The
+// mark is only written by journal_save_done once the file is complete
+void journal_save_start(journal *j, const char *file, textbuffer *buf, undolog *u) {
+    char *path = journal_path(file);
+    if (!path) return;
+    if (j->fd >= 0 && strcmp(path, j->path) == 0) {
+        free(path);
+    } else {
+        journal_close(j);
+        j->path = path;
+        if (journal_create(j, path) != 0) {
+            perror("Could not create undo journal");
+            journal_close(j);
+            return;
+        }
+        u->stable = 0;
+        u->trimmed = 0;
+    }
+    journal_write(j, buf, u, 0, SIZE_MAX);   // the mark comes after every group
+    j->pending = (long long)u->current;
+    journal_file(j, NULL, 0);   // the file is being rewritten, text is copied until the save is done
+}
+
+
+// the save finished, hash is what it wrote. journal_file tells what the new file holds
+void journal_save_done(journal *j, int ok, uint64_t hash) {
+    if (ok && j->fd >= 0 && j->pending >= 0) {
+        // the bytes groups point at are gone from disk, the next sync writes them again with their text
+        if (j->referenced && hash != j->hash) j->compact_at = 0;
+        j->hash = hash;
+        j->saved = j->pending;
+        journal_write_mark(j);
+        journal_write_header(j);
+    }
+    j->pending = -1;
+}
+
+
+// what the records of a journal leave behind: the history at its end and as of the last save matching
+// the file, each as the journal offsets of its groups
+typedef struct{
+size_t *slots;
+size_t count;
+size_t cap;
+size_t trimmed;         // groups dropped from the front before slots[0]
+size_t current;
+size_t *match;
+size_t match_count;
+size_t match_trimmed;
+long long match_current; // -1 when no save matches
+size_t match_end;        // journal offset right after that save
+}journal_scan;
+
+
+static void journal_scan_free(journal_scan *sc) {
+    free(sc->slots);
+    free(sc->match);
+}
+
+
+// one pass over the records, the latest record of each history index wins
+static void journal_scan_records(journal_scan *sc, const char *map, size_t used, uint64_t hash) {
+    memset(sc, 0, sizeof(*sc));
+    sc->match_current = -1;
+    size_t pos = sizeof(journal_header);
+    while (pos + sizeof(journal_record) <= used) {
+        journal_record *r = (journal_record *)(map + pos);
+        if (r->size > used - pos - sizeof(journal_record)) break;   // cut off by a crash
+        size_t next = pos + sizeof(journal_record) + pad8(r->size);
+        int group = r->type == JOURNAL_GROUP && r->size >= sizeof(journal_group);
+        if (group || (r->type == JOURNAL_LOST && r->size >= sizeof(uint64_t))) {
+            size_t index = *(uint64_t *)(r + 1);   // first in both
+            if (index > sc->count) break;
+            if (index == sc->cap) {
+                sc->cap = sc->cap ? sc->cap * 2 : 64;
+                size_t *s = realloc(sc->slots, sc->cap * sizeof(size_t));
+                if (!s) break;
+                sc->slots = s;
+            }
+            sc->slots[index] = pos;
+            sc->count = index + 1;
+            sc->current = sc->count;
+        } else if (r->type == JOURNAL_TRIM && r->size >= sizeof(uint64_t)) {
+            uint64_t n = *(uint64_t *)(r + 1);
+            if (n > sc->count) n = sc->count;
+            memmove(sc->slots, sc->slots + n, (sc->count - n) * sizeof(size_t));
+            sc->count -= n;
+            sc->trimmed += n;
+            sc->current = sc->current > n ? sc->current - n : 0;
+        } else if (r->type == JOURNAL_POSITION && r->size >= sizeof(uint64_t)) {
+            uint64_t at = *(uint64_t *)(r + 1);
+            sc->current = at < sc->count ? at : sc->count;
+        } else if (r->type == JOURNAL_SAVE && r->size >= sizeof(journal_mark)) {
+            journal_mark *m = (journal_mark *)(r + 1);
+            if (m->current <= sc->count) sc->current = m->current;
+            if (m->hash == hash && m->current <= sc->count) {
+                size_t *s = realloc(sc->match, (sc->count ? sc->count : 1) * sizeof(size_t));
+                if (!s) break;
+                sc->match = s;
+                if (sc->count) memcpy(sc->match, sc->slots, sc->count * sizeof(size_t));
+                sc->match_count = sc->count;
+                sc->match_trimmed = sc->trimmed;
+                sc->match_current = (long long)m->current;
+                sc->match_end = next;
+            }
+        }
+        pos = next;
+    }
+}
+
+
+// first history index, counted from the very start, where the end state left the matching save behind.
+// Everything from there up to either position is what the file on disk is missing
+static size_t journal_diverge(journal_scan *sc) {
+    size_t m_top = sc->match_trimmed + (size_t)sc->match_current;
+    size_t e_top = sc->trimmed + sc->current;
+    size_t d = sc->trimmed;
+    while (d < m_top && d < e_top && sc->match[d - sc->match_trimmed] == sc->slots[d - sc->trimmed]) ++d;
+    return d;
+}
+
+
+// groups between the matching save and the end, 0 when there is nothing to bring back or it can not be
+static size_t journal_scan_unsaved(journal_scan *sc) {
+    if (sc->match_current < 0) return 0;
+    size_t m_top = sc->match_trimmed + (size_t)sc->match_current;
+    size_t e_top = sc->trimmed + sc->current;
+    if (m_top < sc->trimmed) return 0;   // the way back to the save was trimmed away
+    size_t d = journal_diverge(sc);
+    return (m_top - d) + (e_top - d);
+}
+
+
+// maps the journal at path read-only, NULL when it is not one
+static char *journal_map(const char *path, int *fd, size_t *map_len, size_t *used) {
+    *fd = open(path, O_RDWR);
+    struct stat st;
+    if (*fd < 0 || fstat(*fd, &st) != 0 || (size_t)st.st_size < sizeof(journal_header)) {
+        if (*fd >= 0) close(*fd);
+        return NULL;
+    }
+    *map_len = (size_t)st.st_size;
+    char *map = mmap(NULL, *map_len, PROT_READ, MAP_PRIVATE, *fd, 0);
+    if (map == MAP_FAILED || memcmp(((journal_header *)map)->magic, JOURNAL_MAGIC, 8) != 0) {
+        if (map != MAP_FAILED) munmap(map, *map_len);
+        close(*fd);
+        return NULL;
+    }
+    *used = ((journal_header *)map)->used;
+    if (*used > *map_len) *used = *map_len;
+    return map;
+}
+
+
+// left behind by a process that is gone without closing it
+static int journal_crashed(const char *map) {
+    const journal_header *h = (const journal_header *)map;
+    if (h->clean || h->pid == (uint32_t)getpid()) return 0;
+    return kill((pid_t)h->pid, 0) != 0 && errno != EPERM;
+}
+
+
+// a group whose text can be put back while buf holds the file of hash
+static int journal_usable(const char *map, size_t slot, uint64_t hash) {
+    journal_record *r = (journal_record *)(map + slot);
+    if (r->type != JOURNAL_GROUP) return 0;
+    uint64_t file = ((journal_group *)(r + 1))->file_hash;
+    return file == JOURNAL_INLINE || file == hash;
+}
+
+
+// the stretch of slots around at that can be put back, from *first up to *last
+static void journal_usable_range(const char *map, const size_t *slots, size_t n, size_t at, uint64_t hash,
+                                 size_t *first, size_t *last) {
+    *first = *last = at;
+    while (*first > 0 && journal_usable(map, slots[*first - 1], hash)) --*first;
+    while (*last < n && journal_usable(map, slots[*last], hash)) ++*last;
+}
+
+
+// the pieces of an op's text: parts copied into the journal stay in its mapping, the rest is taken from buf
+// while it still holds the file. -1 when a part does not fit either
+static int journal_op_pieces(textbuffer *buf, int chunk, const char *map, const char **p, const char *end,
+                             uint32_t parts, piece **out, size_t *n) {
+    size_t cap = 0;
+    *out = NULL;
+    *n = 0;
+    for (uint32_t k = 0; k < parts; ++k) {
+        journal_part *jp = (journal_part *)*p;
+        if (*p + sizeof(journal_part) > end) return -1;
+        *p += sizeof(journal_part);
+        piece one, *found = &one;
+        size_t count = 1;
+        if (jp->at == JOURNAL_INLINE) {
+            if (jp->len > (size_t)(end - *p)) return -1;
+            one = buffer_chunk_piece(buf, chunk, *p - map, jp->len);
+            *p += pad8(jp->len);
+        } else {
+            if (jp->at > buffer_length(buf) || jp->len > buffer_length(buf) - jp->at) return -1;
+            count = buffer_copy_pieces(buf, jp->at, jp->len, &found);
+            if (count == 0) continue;
+        }
+        if (*n + count > cap) {
+            cap = (*n + count) * 2;
+            piece *grown = realloc(*out, cap * sizeof(piece));
+            if (!grown) {
+                if (found != &one) free(found);
+                return -1;
+            }
+            *out = grown;
+        }
+        memcpy(*out + *n, found, count * sizeof(piece));
+        *n += count;
+        if (found != &one) free(found);
+    }
+    return 0;
+}
+
+
+// puts the groups of slots into u, copied text stays in the mapped journal and the rest comes from buf, which
+// holds the file the groups refer to
+static void journal_add_groups(undolog *u, textbuffer *buf, int chunk, const char *map, const size_t *slots,
+                               size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        journal_record *r = (journal_record *)(map + slots[i]);
+        const char *end = (const char *)(r + 1) + r->size;
+        journal_group *jg = (journal_group *)(r + 1);
+        undo_group *g = undo_add_group(u, jg->cursor_before, jg->cursor_after, (int)jg->kind);
+        if (!g) break;
+        const char *p = (const char *)(jg + 1);
+        for (uint32_t k = 0; k < jg->op_count; ++k) {
+            journal_op *op = (journal_op *)p;
+            if (p + sizeof(journal_op) > end) break;
+            p += sizeof(journal_op);
+            piece *text;
+            size_t count;
+            int ok = journal_op_pieces(buf, chunk, map, &p, end, op->parts, &text, &count) == 0;
+            if (ok) undo_add_op(u, g, (int)op->type, op->offset, op->len, text, count);
+            free(text);
+            if (!ok) break;
+        }
+    }
+}
+
+
+// takes over the journal at path for appending from used on, map stays as the restored mapping
+static void journal_adopt(journal *j, char *path, int fd, char *map, size_t map_len, size_t used) {
+    journal_close(j);
+    j->restored = map;
+    j->restored_len = map_len;
+    j->path = path;
+    j->fd = fd;
+    j->used = used;
+    if (journal_reserve(j, 0) != 0) {
+        journal_close(j);
+        return;
+    }
+    journal_header *h = (journal_header *)j->map;
+    h->pid = (uint32_t)getpid();
+    h->clean = 0;
+    journal_write_header(j);
+    j->compact_at = JOURNAL_COMPACT_SIZE > used * 2 ? JOURNAL_COMPACT_SIZE : used * 2;
+}
+
+
+// restores from the journal at path, hash is that of what buf holds. Without recover the history comes
+// back as of the matching save and later records are dropped, no edit is replayed. With recover the
+// buffer is walked from the save to where the journal ends: undone back to where both histories part,
+// then redone along the newer one. Groups too big to be journaled, or whose text was in a file that is
+// gone, cut the history short around the current state. Returns the groups replayed, -1 when nothing matched
+static int journal_load(journal *j, char *path, uint64_t hash, textbuffer *buf, undolog *u, int recover) {
+    int fd;
+    size_t map_len, used;
+    char *map = journal_map(path, &fd, &map_len, &used);
+    if (!map) {
+        free(path);
+        return -1;
+    }
+    journal_scan sc;
+    journal_scan_records(&sc, map, used, hash);
+    if (recover && journal_scan_unsaved(&sc) == 0) recover = 0;
+    size_t d = recover ? journal_diverge(&sc) : 0;
+    size_t m_top = sc.match_trimmed + (size_t)sc.match_current;
+    size_t first = 0, last = 0, newer_first = 0, newer_last = 0;
+    if (sc.match_current >= 0) {
+        journal_usable_range(map, sc.match, sc.match_count, (size_t)sc.match_current, hash, &first, &last);
+    }
+    if (recover) {   // both ways from the save have to be there, or only the save comes back
+        journal_usable_range(map, sc.slots, sc.count, sc.current, hash, &newer_first, &newer_last);
+        if (d - sc.match_trimmed < first || d - sc.trimmed < newer_first) recover = 0;
+    }
+    size_t end = recover ? used : sc.match_end;
+    int chunk = sc.match_current >= 0 ? buffer_add_chunk(buf, map, end) : -1;
+    if (chunk < 0) {
+        journal_scan_free(&sc);
+        munmap(map, map_len);
+        close(fd);
+        free(path);
+        return -1;
+    }
+
+    // both histories are taken in before any replay, text they refer to is read from the file as loaded
+    undolog newer;
+    undo_init(&newer);
+    if (recover) journal_add_groups(&newer, buf, chunk, map, sc.slots + newer_first, newer_last - newer_first);
+    journal_add_groups(u, buf, chunk, map, sc.match + first, last - first);
+    u->current = (size_t)sc.match_current - first < u->count ? (size_t)sc.match_current - first : u->count;
+    int replayed = 0;
+    long long saved = sc.match_current;   // counted before first is trimmed
+    if (recover) {
+        size_t cursor, lowest;
+        while (u->current > d - sc.match_trimmed - first && undo_undo(u, buf, &cursor, &lowest) == 0) ++replayed;
+        undo_free(u);
+        *u = newer;
+        first = newer_first;
+        u->current = d - sc.trimmed - first;
+        while (u->current < sc.current - first && undo_redo(u, buf, &cursor, &lowest) == 0) ++replayed;
+        saved = d >= m_top ? (long long)(m_top - sc.trimmed) : -1;
+    } else {
+        undo_free(&newer);
+    }
+    journal_scan_free(&sc);
+    u->stable = u->count;
+    u->trimmed = first;   // the next sync drops what could not come back from the journal too
+    u->open = 0;
+
+    // keep appending at the end, without recover right after the matching save, later records describe
+    // edits the file never got
+    journal_adopt(j, path, fd, map, map_len, end);
+    j->hash = hash;
+    j->saved = saved;
+    j->history = u->count > 0;
+    j->referenced = u->count > 0;
+    return replayed;
+}
+
+
+// brings back the history of file when the journal has a save matching hash, the content of buf
+int journal_restore(journal *j, const char *file, uint64_t hash, textbuffer *buf, undolog *u, int recover) {
+    char *path = journal_path(file);
+    if (!path) return -1;
+    return journal_load(j, path, hash, buf, u, recover);
+}
+
+
+// undo groups a crashed session left in the journal of file beyond what is saved in it, 0 when the
+// journal was closed normally or has nothing to add
+size_t journal_unsaved(const char *file, uint64_t hash) {
+    char *path = journal_path(file);
+    if (!path) return 0;
+    int fd;
+    size_t map_len, used, n = 0;
+    char *map = journal_map(path, &fd, &map_len, &used);
+    free(path);
+    if (!map) return 0;
+    if (journal_crashed(map)) {
+        journal_scan sc;
+        journal_scan_records(&sc, map, used, hash);
+        n = journal_scan_unsaved(&sc);
+        journal_scan_free(&sc);
+    }
+    munmap(map, map_len);
+    close(fd);
+    return n;
+}
+
+
+// a fresh journal for file whose content hashes to hash, so edits are recoverable before the first save
+void journal_open(journal *j, const char *file, uint64_t hash) {
+    char *path = journal_path(file);
+    if (!path) return;
+    journal_close(j);
+    j->path = path;
+    if (journal_create(j, path) != 0) {   // a directory we can not write to, edits go unjournaled
+        journal_close(j);
+        return;
+    }
+    j->hash = hash;
+    j->saved = 0;
+    journal_write_mark(j);
+    journal_write_header(j);
+}
+
+
+// $XDG_STATE_HOME/beditor, ~/.local/state/beditor without it, created when missing
+char *journal_state_dir(void) {
+    const char *state = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    char *dir;
+    if (state && state[0]) {
+        dir = malloc(strlen(state) + 10);
+        if (dir) sprintf(dir, "%s/beditor", state);
+    } else if (home && home[0]) {
+        dir = malloc(strlen(home) + 22);
+        if (dir) {
+            sprintf(dir, "%s/.local", home);
+            mkdir(dir, 0755);
+            strcat(dir, "/state");
+            mkdir(dir, 0700);
+            strcat(dir, "/beditor");
+        }
+    } else {
+        return NULL;
+    }
+    if (dir) mkdir(dir, 0700);
+    return dir;
+}
+
+
+// untitled-<pid>.bundo in the state directory
+static char *journal_untitled_path(pid_t pid) {
+    char *dir = journal_state_dir();
+    if (!dir) return NULL;
+    char *path = malloc(strlen(dir) + 32);
+    if (path) sprintf(path, "%s/untitled-%ld.bundo", dir, (long)pid);
+    free(dir);
+    return path;
+}
+
+
+// a journal for a document that has no file yet, it goes away when the document is closed or saved
+void journal_untitled(journal *j) {
+    journal_close(j);
+    j->path = journal_untitled_path(getpid());
+    if (!j->path || journal_create(j, j->path) != 0) {
+        journal_close(j);
+        return;
+    }
+    j->untitled = 1;
+    j->hash = JOURNAL_HASH_SEED;   // matches the empty document
+    j->saved = 0;
+    journal_write_mark(j);
+    journal_write_header(j);
+}
+
+
+// path of an untitled journal a crashed session left with edits in it, NULL when there is none
+char *journal_crashed_untitled(void) {
+    char *dir = journal_state_dir();
+    if (!dir) return NULL;
+    DIR *d = opendir(dir);
+    char *found = NULL;
+    struct dirent *e;
+    while (d && !found && (e = readdir(d))) {
+        if (strncmp(e->d_name, "untitled-", 9) != 0) continue;
+        char *path = malloc(strlen(dir) + strlen(e->d_name) + 2);
+        if (!path) break;
+        sprintf(path, "%s/%s", dir, e->d_name);
+        int fd;
+        size_t map_len, used;
+        char *map = journal_map(path, &fd, &map_len, &used);
+        if (map) {
+            if (journal_crashed(map)) {
+                journal_scan sc;
+                journal_scan_records(&sc, map, used, JOURNAL_HASH_SEED);
+                if (journal_scan_unsaved(&sc) > 0) found = path;
+                journal_scan_free(&sc);
+                if (!found) unlink(path);   // nothing in it worth asking about
+            }
+            munmap(map, map_len);
+            close(fd);
+        }
+        if (found != path) free(path);
+    }
+    if (d) closedir(d);
+    free(dir);
+    return found;
+}
+
+
+// replays the crashed untitled journal at path into the empty buf and keeps it as this session's own
+int journal_recover_untitled(journal *j, const char *path, textbuffer *buf, undolog *u) {
+    char *own = journal_untitled_path(getpid());
+    if (!own || rename(path, own) != 0) {
+        free(own);
+        return -1;
+    }
+    int replayed = journal_load(j, own, JOURNAL_HASH_SEED, buf, u, 1);
+    if (replayed >= 0) j->untitled = 1;
+    return replayed;
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+#include "linecache.h"
+
+
+void linecache_init(linecache *c) {
+    memset(c, 0, sizeof(*c));
+}
+
+
+static void linecache_drop(linecache_entry *e) {
+    if (e->tex) SDL_DestroyTexture(e->tex);
+    free(e->text);
+    memset(e, 0, sizeof(*e));
+}
+
+
+void linecache_free(linecache *c) {
+    for (int i = 0; i < LINECACHE_SLOTS; ++i) linecache_drop(&c->slots[i]);
+}
+
+
+// texture of the len bytes of line (NUL terminated), rendered only when none of its slots holds it yet
+SDL_Texture *linecache_get(linecache *c, SDL_Renderer *renderer, TTF_Font *font, SDL_Color color,
+                           const char *line, size_t len, int *w, int *h) {
+    uint64_t hash = 1469598103934665603ULL;   // FNV-1a
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)line[i];
+        hash *= 1099511628211ULL;
+    }
+    // FNV spreads a change of the last bytes over few bits, lines like "line 5" and "line 6" need a final
+    // mix to end up in different sets
+    uint64_t mix = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdULL;
+    mix ^= mix >> 33;
+    linecache_entry *set = &c->slots[mix % (LINECACHE_SLOTS / LINECACHE_WAYS) * LINECACHE_WAYS];
+    linecache_entry *e = NULL;
+    for (int k = 0; k < LINECACHE_WAYS && !e; ++k) {
+        linecache_entry *s = &set[k];
+        if (s->tex && s->hash == hash && s->len == len && memcmp(s->text, line, len) == 0) e = s;
+    }
+    if (!e) {
+        e = &set[0];
+        for (int k = 1; k < LINECACHE_WAYS; ++k) {
+            if (set[k].used < e->used) e = &set[k];
+        }
+        linecache_drop(e);
+        SDL_Surface *surf = TTF_RenderUTF8_Solid(font, line, color);
+        if (!surf) return NULL;
+        e->tex = SDL_CreateTextureFromSurface(renderer, surf);
+        e->w = surf->w;
+        e->h = surf->h;
+        SDL_FreeSurface(surf);
+        e->text = malloc(len);
+        if (!e->tex || !e->text) {
+            linecache_drop(e);
+            return NULL;
+        }
+        memcpy(e->text, line, len);
+        e->hash = hash;
+        e->len = len;
+    }
+    e->used = ++c->clock;
+    *w = e->w;
+    *h = e->h;
+    return e->tex;
+}
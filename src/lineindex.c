@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lineindex.h"
+#include "journal.h"
+
+#define LINEINDEX_MAGIC "BLIDX01"   // 8 bytes with the terminator
+#define LINEINDEX_NAME 64           // longest file name the trim looks at, the caches have 20
+
+// a cached index is this header, the full path of the file it is for and the checkpoint offsets as varint
+// deltas, a 20 GB log takes a few hundred KB
+typedef struct{
+char magic[8];
+uint64_t size;         // the file it was made for
+uint64_t mtime_sec;
+uint64_t mtime_nsec;
+uint64_t ino;
+uint64_t dev;
+uint64_t step;         // lines from one checkpoint to the next
+uint64_t line_count;
+uint64_t marks;        // checkpoints, the first one is offset 0 and not stored
+uint64_t data_len;     // bytes of deltas after the path
+uint32_t path_len;
+uint32_t unused;
+}lineindex_header;
+
+// one cache the trim found
+typedef struct{
+char name[LINEINDEX_NAME];
+off_t size;
+struct timespec used;
+}lineindex_entry;
+
+
+// lines/ in the state directory, made the first time
+static char *lineindex_dir(void) {
+    char *state = journal_state_dir();
+    if (!state) return NULL;
+    char *dir = malloc(strlen(state) + 8);
+    if (dir) {
+        sprintf(dir, "%s/lines", state);
+        mkdir(dir, 0700);
+    }
+    free(state);
+    return dir;
+}
+
+
+// the cache of path, named by a hash of its full path which goes into *full. The path is in the cache too,
+// two with the same hash are told apart by it
+static char *lineindex_path(const char *path, char **full) {
+    char *dir = lineindex_dir();
+    char *copy = realpath(path, NULL);   // the same file opened from somewhere else finds it
+    if (!copy) copy = strdup(path);
+    char *file = dir && copy ? malloc(strlen(dir) + 24) : NULL;
+    if (file) {
+        uint64_t h = journal_hash_update(JOURNAL_HASH_SEED, copy, strlen(copy));
+        sprintf(file, "%s/%016llx.idx", dir, (unsigned long long)h);
+    }
+    free(dir);
+    if (!file) {
+        free(copy);
+        return NULL;
+    }
+    *full = copy;
+    return file;
+}
+
+
+// the file behind st is the one the cache was made for. A stat the caller had anyway is all it takes
+static int lineindex_fresh(const lineindex_header *h, const struct stat *st) {
+    return h->size == (uint64_t)st->st_size && h->mtime_sec == (uint64_t)st->st_mtim.tv_sec &&
+           h->mtime_nsec == (uint64_t)st->st_mtim.tv_nsec && h->ino == (uint64_t)st->st_ino &&
+           h->dev == (uint64_t)st->st_dev;
+}
+
+
+static size_t varint_put(uint64_t v, unsigned char *out) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+
+// the varint at *p, 0 when it runs past end or is too long for 64 bits
+static int varint_get(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        x |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *v = x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// the checkpoints cached for path as st says it is now, one mmap of the cache and one pass over its deltas.
+// 0 with *lines allocated for *marks entries, -1 when there is none. One made before the file changed is
+// removed on the spot, it can never match again
+int lineindex_load(const char *path, const struct stat *st, size_t step, size_t **lines, size_t *marks,
+                   size_t *line_count) {
+    char *full = NULL;
+    char *file = lineindex_path(path, &full);
+    if (!file) return -1;
+    int fd = open(file, O_RDONLY);
+    struct stat cst;
+    const unsigned char *map = MAP_FAILED;
+    if (fd >= 0 && fstat(fd, &cst) == 0 && (size_t)cst.st_size >= sizeof(lineindex_header)) {
+        map = mmap(NULL, (size_t)cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    size_t *out = NULL;
+    int ok = 0, stale = 0;
+    if (map != MAP_FAILED) {
+        lineindex_header h;
+        memcpy(&h, map, sizeof(h));
+        const unsigned char *p = map + sizeof(h), *end = map + cst.st_size;
+        ok = memcmp(h.magic, LINEINDEX_MAGIC, 8) == 0 && h.path_len == strlen(full) &&
+             h.path_len <= (size_t)(end - p) && memcmp(p, full, h.path_len) == 0;   // another path's otherwise
+        stale = ok && (!lineindex_fresh(&h, st) || h.step != step);
+        p += ok ? h.path_len : 0;
+        ok = ok && !stale && h.data_len == (uint64_t)(end - p) && h.marks > 0 && h.marks - 1 <= h.data_len &&
+             h.line_count > (h.marks - 1) * step && h.line_count <= h.size + 1 &&
+             (out = malloc(h.marks * sizeof(size_t))) != NULL;
+        if (ok) out[0] = 0;
+        for (uint64_t k = 1; ok && k < h.marks; ++k) {
+            uint64_t delta;
+            ok = varint_get(&p, end, &delta) && delta > 0 && delta <= h.size - out[k - 1];
+            if (ok) out[k] = out[k - 1] + (size_t)delta;
+        }
+        if (ok && p == end) {
+            *lines = out;
+            *marks = (size_t)h.marks;
+            *line_count = (size_t)h.line_count;
+            out = NULL;
+            futimens(fd, NULL);   // used just now, the trim keeps it longer
+        } else {
+            ok = 0;
+        }
+        munmap((void *)map, (size_t)cst.st_size);
+    }
+    if (fd >= 0) close(fd);
+    if (stale) unlink(file);
+    free(out);
+    free(full);
+    free(file);
+    return ok ? 0 : -1;
+}
+
+
+static int lineindex_older(const void *a, const void *b) {
+    const struct timespec *x = &((const lineindex_entry *)a)->used, *y = &((const lineindex_entry *)b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+
+// removes the caches used longest ago until the rest fit LINEINDEX_BUDGET. Their mtime says when they were
+// written or last loaded, atime is not kept up on most mounts
+static void lineindex_trim(void) {
+    char *dir = lineindex_dir();
+    DIR *d = dir ? opendir(dir) : NULL;
+    free(dir);
+    if (!d) return;
+    lineindex_entry *all = NULL;
+    size_t count = 0, cap = 0;
+    off_t total = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        struct stat st;
+        if (e->d_name[0] == '.' || strlen(e->d_name) >= LINEINDEX_NAME) continue;
+        if (fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (count == cap) {
+            size_t grown = cap ? cap * 2 : 64;
+            lineindex_entry *more = realloc(all, grown * sizeof(lineindex_entry));
+            if (!more) break;
+            all = more;
+            cap = grown;
+        }
+        strcpy(all[count].name, e->d_name);
+        all[count].size = st.st_size;
+        all[count].used = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+    if (total > LINEINDEX_BUDGET) {
+        qsort(all, count, sizeof(lineindex_entry), lineindex_older);
+        for (size_t i = 0; i < count && total > LINEINDEX_BUDGET; ++i) {
+            if (unlinkat(dirfd(d), all[i].name, 0) == 0) total -= all[i].size;
+        }
+    }
+    closedir(d);
+    free(all);
+}
+
+
+// writes the checkpoints of path in one write and a rename, for the file as st describes it, then trims the
+// caches back to their budget
+int lineindex_save(const char *path, const struct stat *st, size_t step, const size_t *lines, size_t marks,
+                   size_t line_count) {
+    if (marks == 0) return -1;
+    char *full = NULL;
+    char *file = lineindex_path(path, &full);
+    if (!file) return -1;
+    lineindex_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LINEINDEX_MAGIC, 8);
+    h.size = (uint64_t)st->st_size;
+    h.mtime_sec = (uint64_t)st->st_mtim.tv_sec;
+    h.mtime_nsec = (uint64_t)st->st_mtim.tv_nsec;
+    h.ino = (uint64_t)st->st_ino;
+    h.dev = (uint64_t)st->st_dev;
+    h.step = step;
+    h.line_count = line_count;
+    h.marks = marks;
+    h.path_len = (uint32_t)strlen(full);
+    unsigned char *data = malloc(sizeof(h) + h.path_len + (marks - 1) * 10);   // 10 bytes hold any 64 bit delta
+    char *tmp = malloc(strlen(file) + 8);
+    if (!data || !tmp) {
+        free(data);
+        free(tmp);
+        free(full);
+        free(file);
+        return -1;
+    }
+    size_t at = sizeof(h);
+    memcpy(data + at, full, h.path_len);
+    at += h.path_len;
+    for (size_t k = 1; k < marks; ++k) at += varint_put(lines[k] - lines[k - 1], data + at);
+    h.data_len = at - sizeof(h) - h.path_len;
+    memcpy(data, &h, sizeof(h));
+    sprintf(tmp, "%s.tmp", file);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int ok = fd >= 0 && write(fd, data, at) == (ssize_t)at;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok) ok = rename(tmp, file) == 0;
+    if (!ok) unlink(tmp);
+    free(data);
+    free(tmp);
+    free(full);
+    free(file);
+    if (ok) lineindex_trim();
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "loader.h"
+#include "journal.h"
+
+
+void loader_init(loader *l) {
+    memset(l, 0, sizeof(*l));
+    l->fd = -1;
+    l->ring.fd = -1;
+    buffer_init(&l->buf);
+}
+
+
+// reads the next LOADER_QUEUE blocks into dst, all of them requested at once at their own offsets. A block
+// comes back short only at the end of the file, *last is set then
+static ssize_t loader_read(loader *l, char *dst, int *last) {
+    size_t left = l->size > l->done ? l->size - l->done : 0;
+    size_t blocks = left / LOADER_BLOCK + 1;   // one past the size, a file that grew since is read on
+    if (blocks > LOADER_QUEUE) blocks = LOADER_QUEUE;
+    ssize_t got[LOADER_QUEUE];
+    size_t queued = 0;
+    for (; queued < blocks; ++queued) {
+        char *to = dst + queued * LOADER_BLOCK;
+        off_t at = (off_t)(l->done + queued * LOADER_BLOCK);
+        if (uring_queue(&l->ring, URING_READ, l->fd, to, LOADER_BLOCK, at, queued) != 0) break;
+    }
+    int error = queued < blocks ? EIO : 0;
+    for (size_t k = 0; k < queued; ++k) {   // every read has to be back before dst can be used or freed
+        uring_done d;
+        if (uring_wait(&l->ring, &d) != 0) {
+            perror("Could not read file");
+            return -1;   // the ring is broken, the loader is cancelled and takes it down with it
+        }
+        got[d.tag] = d.result;
+        if (d.result < 0) error = (int)-d.result;
+    }
+    if (error) {
+        errno = error;
+        perror("Could not read file");
+        return -1;
+    }
+    size_t total = 0;
+    *last = 0;
+    for (size_t k = 0; k < blocks && !*last; ++k) {
+        size_t have = (size_t)got[k];
+        while (have > 0 && have < LOADER_BLOCK) {   // cut short before the end, the rest is read here
+            ssize_t n = pread(l->fd, dst + total + have, LOADER_BLOCK - have, (off_t)(l->done + total + have));
+            if (n < 0) {
+                perror("Could not read file");
+                return -1;
+            }
+            if (n == 0) break;
+            have += (size_t)n;
+        }
+        total += have;
+        *last = have < LOADER_BLOCK;
+    }
+    return (ssize_t)total;
+}
+
+
+// reads the next batch into the storage: 1 while there is more, 0 once the file is in, -1 on error. A utf-8
+// file is read straight into the storage and only validated there, anything else goes through raw and is
+// transcoded into the storage block by block
+static int loader_batch(loader *l) {
+    int chunk;
+    int utf8 = l->enc.kind == ENCODING_UTF8;
+    char *in = utf8 ? buffer_reserve(&l->buf, LOADER_QUEUE * LOADER_BLOCK, &chunk) : l->raw;
+    if (!in) return -1;
+    int last;
+    ssize_t n = loader_read(l, in, &last);
+    if (n < 0) return -1;
+    size_t got = (size_t)n, skip = 0;
+    // of the file as it is, while the block is still in cache
+    if (journal_blocks_hash(&l->blocks, in, got) != 0) return -1;
+    if (l->done == 0) skip = encoding_detect(&l->enc, in, got);
+    l->done += got;
+    if (l->enc.kind == ENCODING_UTF8 && encoding_validate(&l->enc, in, got, last)) {
+        encoding_line_ends(&l->enc, in, got);
+        if (buffer_commit(&l->buf, chunk, got) != 0) return -1;
+    } else {
+        if (utf8) {   // found out in this block, it is still in the reserved storage
+            if (!l->raw && !(l->raw = malloc(LOADER_QUEUE * LOADER_BLOCK))) return -1;
+            memcpy(l->raw, in, got);
+            in = l->raw;
+        }
+        char *dst = buffer_reserve(&l->buf, ENCODING_GROWTH(got), &chunk);
+        if (!dst) return -1;
+        size_t len = encoding_decode(&l->enc, in + skip, got - skip, dst, last);
+        encoding_line_ends(&l->enc, dst, len);
+        if (buffer_commit(&l->buf, chunk, len) != 0) return -1;
+    }
+    if (!last) return 1;
+    l->hash = journal_blocks_total(&l->blocks);
+    if (l->enc.kind == ENCODING_UTF8 && l->enc.invalid > 0) {
+        fprintf(stderr, "%s has %zu bytes that are not valid UTF-8\n", l->path, l->enc.invalid);
+    }
+    if (l->enc.crlf > 0 && l->enc.crlf < l->enc.lf) {   // kept as they are, new lines get the usual one
+        fprintf(stderr, "%s mixes line endings, %zu CRLF and %zu LF\n", l->path, l->enc.crlf, l->enc.lf - l->enc.crlf);
+    }
+    return 0;
+}
+
+
+static int loader_permille(loader *l) {
+    if (l->size == 0) return 0;
+    if (l->done >= l->size) return 1000;
+    return (int)(l->done * 1000 / l->size);
+}
+
+
+// reads, hashes, validates and indexes the whole file off the main thread, which only ever waits on it when
+// it cancels
+static int loader_thread(void *data) {
+    loader *l = data;
+    int state = 1;
+    while (state == 1 && !SDL_AtomicGet(&l->stop)) {
+        state = loader_batch(l);
+        SDL_AtomicSet(&l->progress, loader_permille(l));
+    }
+    SDL_AtomicSet(&l->state, state == 1 ? -1 : state);
+    return 0;
+}
+
+
+int loader_start(loader *l, const char *path) {
+    loader_cancel(l);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Could not open file");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    l->path = strdup(path);
+    if (!l->path) {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);   // one pass front to back, read ahead as far as possible
+    l->fd = fd;
+    l->size = (size_t)st.st_size;
+    l->st = st;
+    l->done = 0;
+    encoding_init(&l->enc);
+    uring_init(&l->ring);   // without io_uring the same reads run one after the other
+    SDL_AtomicSet(&l->state, 1);
+    l->thread = SDL_CreateThread(loader_thread, "load", l);
+    if (!l->thread) {
+        fprintf(stderr, "Could not start loading: %s\n", SDL_GetError());
+        loader_cancel(l);
+        return -1;
+    }
+    return 0;
+}
+
+
+// 1 while the file is still being read, 0 once it is all in buf, -1 on error. Never blocks, the window keeps
+// drawing while a file loads
+int loader_step(loader *l) {
+    if (l->fd < 0) return -1;
+    int state = SDL_AtomicGet(&l->state);
+    if (state == 1) return 1;
+    SDL_WaitThread(l->thread, NULL);   // done with the loader, buf and the rest are the caller's now
+    l->thread = NULL;
+    return state;
+}
+
+
+// stops loading and throws away what was read, the open document never saw any of it
+void loader_cancel(loader *l) {
+    if (l->thread) {
+        SDL_AtomicSet(&l->stop, 1);
+        SDL_WaitThread(l->thread, NULL);
+    }
+    if (l->fd >= 0) close(l->fd);
+    uring_free(&l->ring);
+    free(l->path);
+    free(l->raw);
+    journal_blocks_free(&l->blocks);
+    buffer_free(&l->buf);
+    loader_init(l);
+}
+
+
+// after the caller took over buf and maybe blocks, closes the file without freeing buf
+void loader_finish(loader *l) {
+    if (l->thread) SDL_WaitThread(l->thread, NULL);
+    if (l->fd >= 0) close(l->fd);
+    uring_free(&l->ring);
+    free(l->path);
+    free(l->raw);
+    journal_blocks_free(&l->blocks);
+    loader_init(l);
+}
+
+
+// permille of the file read so far
+int loader_progress(loader *l) {
+    return SDL_AtomicGet(&l->progress);
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "macro.h"
+
+
+void macro_init(macro *m) {
+    memset(m, 0, sizeof(*m));
+}
+
+
+void macro_free(macro *m) {
+    free(m->steps);
+    free(m->text);
+    macro_init(m);
+}
+
+
+// drops the old macro, everything from here until macro_stop is the new one
+void macro_start(macro *m) {
+    m->count = 0;
+    m->text_len = 0;
+    m->recording = 1;
+}
+
+
+void macro_stop(macro *m) {
+    m->recording = 0;
+}
+
+
+static macro_step *macro_push(macro *m) {
+    if (m->count == m->cap) {
+        size_t new_cap = m->cap ? m->cap * 2 : 64;
+        macro_step *steps = realloc(m->steps, new_cap * sizeof(macro_step));
+        if (!steps) return NULL;
+        m->steps = steps;
+        m->cap = new_cap;
+    }
+    return &m->steps[m->count++];
+}
+
+
+void macro_record_key(macro *m, SDL_Keycode sym, Uint16 mod) {
+    if (!m->recording) return;
+    macro_step *s = macro_push(m);
+    if (!s) return;
+    s->type = MACRO_KEY;
+    s->sym = sym;
+    s->mod = mod;
+    s->text = s->len = 0;
+}
+
+
+// text typed between two keys ends up as one step, so a replay inserts it as one edit
+void macro_record_text(macro *m, const char *text, size_t len) {
+    if (!m->recording || len == 0) return;
+    if (m->text_len + len > m->text_cap) {
+        size_t new_cap = m->text_cap ? m->text_cap : 256;
+        while (new_cap < m->text_len + len) new_cap *= 2;
+        char *grown = realloc(m->text, new_cap);
+        if (!grown) return;
+        m->text = grown;
+        m->text_cap = new_cap;
+    }
+    memcpy(m->text + m->text_len, text, len);
+    m->text_len += len;
+    if (m->count > 0 && m->steps[m->count - 1].type == MACRO_TEXT) {
+        m->steps[m->count - 1].len += len;
+        return;
+    }
+    macro_step *s = macro_push(m);
+    if (!s) {
+        m->text_len -= len;
+        return;
+    }
+    s->type = MACRO_TEXT;
+    s->sym = 0;
+    s->mod = 0;
+    s->text = m->text_len - len;
+    s->len = len;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minimap.h"
+
+#define MINIMAP_BG 240
+#define MINIMAP_INK 200
+
+
+void minimap_init(minimap *mm) {
+    memset(mm, 0, sizeof(*mm));
+}
+
+
+void minimap_free(minimap *mm) {
+    if (mm->texture){
+        SDL_DestroyTexture(mm->texture);
+    }
+    free(mm->tiles);
+    free(mm->pixels);
+    free(mm->row_dirty);
+    memset(mm, 0, sizeof(*mm));
+}
+
+
+// marks the tiles holding first_line..last_line for regeneration, last_line < 0 means up to the end
+void minimap_invalidate(minimap *mm, int first_line, int last_line) {
+    if (first_line < 0) first_line = 0;
+    int first = first_line / MINIMAP_TILE_LINES;
+    int last = last_line < 0 ? mm->tile_count - 1 : last_line / MINIMAP_TILE_LINES;
+    if (last >= mm->tile_count) last = mm->tile_count - 1;
+    for (int t = first; t <= last; ++t) {
+        if (!mm->tiles[t].dirty) {
+            mm->tiles[t].dirty = 1;
+            mm->dirty_count++;
+        }
+    }
+    if (first < mm->next_tile) mm->next_tile = first;
+}
+
+
+// marks pixel rows from..to-1 for composing
+static void minimap_dirty_rows(minimap *mm, int from, int to) {
+    if (from < 0) from = 0;
+    if (to > mm->height) to = mm->height;
+    for (int y = from; y < to; ++y) {
+        if (!mm->row_dirty[y]) {
+            mm->row_dirty[y] = 1;
+            mm->dirty_rows++;
+        }
+    }
+}
+
+
+// first line shown in pixel row y of the minimap
+static int minimap_row_line(minimap *mm, int y) {
+    return (int)((long long)y * mm->line_count / mm->rows_used);
+}
+
+
+// pixel row where line starts
+static int minimap_line_row(minimap *mm, int line) {
+    return (int)((long long)line * mm->rows_used / mm->line_count);
+}
+
+
+// downsamples the lines of tile t into ink bits
+static void minimap_build_tile(minimap *mm, sdltext *txt, int t) {
+    minimap_tile *tile = &mm->tiles[t];
+    memset(tile->bits, 0, sizeof(tile->bits));
+    memset(tile->summary, 0, sizeof(tile->summary));
+    int first = t * MINIMAP_TILE_LINES;
+    char s[MINIMAP_COLS + 1];
+    for (int l = 0; l < MINIMAP_TILE_LINES && first + l < mm->line_count; ++l) {
+        buffer_line(&txt->buf, first + l, s, sizeof(s));
+        for (int c = 0; c < MINIMAP_COLS && s[c]; ++c) {
+            if (s[c] != ' ' && s[c] != '\t') {
+                tile->bits[l][c >> 3] |= (Uint8)(1 << (c & 7));
+                tile->summary[c / MINIMAP_COLS_PER_PX]++;
+            }
+        }
+    }
+    tile->ready = 1;
+    tile->dirty = 0;
+    mm->dirty_count--;
+
+    // only the pixel rows covering this tile need composing again
+    int from = minimap_line_row(mm, first);
+    int to = minimap_line_row(mm, first + MINIMAP_TILE_LINES) + 1;
+    minimap_dirty_rows(mm, from, to);
+}
+
+
+// blends every tile line that falls into pixel row y, whole tiles go through their summary row
+static void minimap_compose_row(minimap *mm, int y) {
+    Uint32 *row = mm->pixels + (size_t)y * MINIMAP_WIDTH;
+    Uint32 bg = 0xFF000000u | (MINIMAP_BG << 16) | (MINIMAP_BG << 8) | MINIMAP_BG;
+    if (y >= mm->rows_used) {
+        for (int x = 0; x < MINIMAP_WIDTH; ++x) row[x] = bg;
+        return;
+    }
+    int a = minimap_row_line(mm, y);
+    int b = minimap_row_line(mm, y + 1);
+    if (b <= a) b = a + 1;
+    if (b > mm->line_count) b = mm->line_count;
+
+    int ink[MINIMAP_WIDTH] = {0};
+    int line = a;
+    while (line < b) {
+        int t = line / MINIMAP_TILE_LINES;
+        int tile_end = (t + 1) * MINIMAP_TILE_LINES;
+        int end = tile_end < b ? tile_end : b;
+        minimap_tile *tile = &mm->tiles[t];
+        if (!tile->ready) {
+            line = end;
+            continue;
+        }
+        if (line == t * MINIMAP_TILE_LINES && end == tile_end) {
+            for (int x = 0; x < MINIMAP_WIDTH; ++x) ink[x] += tile->summary[x];
+            line = end;
+            continue;
+        }
+        for (; line < end; ++line) {
+            const Uint8 *bits = tile->bits[line - t * MINIMAP_TILE_LINES];
+            for (int c = 0; c < MINIMAP_COLS; ++c) {
+                if (bits[c >> 3] & (1 << (c & 7))) ink[c / MINIMAP_COLS_PER_PX]++;
+            }
+        }
+    }
+
+    int samples = (b - a) * MINIMAP_COLS_PER_PX;
+    for (int x = 0; x < MINIMAP_WIDTH; ++x) {
+        Uint32 shade = MINIMAP_BG - (Uint32)(ink[x] * MINIMAP_INK / samples);
+        row[x] = 0xFF000000u | (shade << 16) | (shade << 8) | shade;
+    }
+}
+
+
+// keeps tiles and the composed texture in sync with the text, spending at most MINIMAP_BUDGET_US on tiles and
+// as much on composing rows. Whatever is left waits for the next frame, the old rows stay on screen until then
+void minimap_update(minimap *mm, sdlwindow *win, sdltext *txt, int line_count) {
+    if (line_count < 1) line_count = 1;
+
+    if (!mm->texture || mm->height != win->window_height) {
+        if (mm->texture){
+            SDL_DestroyTexture(mm->texture);
+        }
+        mm->height = win->window_height > 1 ? win->window_height : 1;
+        mm->texture = SDL_CreateTexture(win->renderer, SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_STATIC, MINIMAP_WIDTH, mm->height);
+        free(mm->pixels);
+        free(mm->row_dirty);
+        mm->pixels = malloc((size_t)mm->height * MINIMAP_WIDTH * sizeof(Uint32));
+        mm->row_dirty = calloc((size_t)mm->height, 1);
+        mm->dirty_rows = 0;
+        mm->next_row = 0;
+        mm->line_count = 0; // forces a full compose below
+    }
+
+    if (line_count != mm->line_count) {
+        int tile_count = (line_count + MINIMAP_TILE_LINES - 1) / MINIMAP_TILE_LINES;
+        if (tile_count != mm->tile_count) {
+            mm->tiles = realloc(mm->tiles, (size_t)tile_count * sizeof(minimap_tile));
+            for (int t = mm->tile_count; t < tile_count; ++t) {
+                memset(&mm->tiles[t], 0, sizeof(minimap_tile));
+                mm->tiles[t].dirty = 1;
+                mm->dirty_count++;
+            }
+            if (tile_count < mm->tile_count) { // tiles cut off by the shrink are not pending anymore
+                mm->dirty_count = 0;
+                for (int t = 0; t < tile_count; ++t) mm->dirty_count += mm->tiles[t].dirty;
+            }
+            mm->tile_count = tile_count;
+        }
+        int old_rows = mm->line_count * MINIMAP_LINE_PX;
+        int rows = line_count * MINIMAP_LINE_PX;
+        if (mm->line_count > 0 && old_rows <= mm->height && rows <= mm->height) {
+            // a line per MINIMAP_LINE_PX rows before and after, rows above the change stay as they are and the
+            // ones below come with their tiles, which the edit invalidated. Only the end moved
+            minimap_dirty_rows(mm, old_rows < rows ? old_rows : rows, old_rows < rows ? rows : old_rows);
+        } else {
+            minimap_dirty_rows(mm, 0, mm->height);   // scaled down, every row covers other lines now
+        }
+        mm->line_count = line_count;
+        mm->rows_used = rows < mm->height ? rows : mm->height;
+    }
+
+    if (mm->dirty_count > 0) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 budget = SDL_GetPerformanceFrequency() * MINIMAP_BUDGET_US / 1000000;
+        int scanned = 0;
+        while (mm->dirty_count > 0 && scanned < mm->tile_count) {
+            if (mm->next_tile >= mm->tile_count) mm->next_tile = 0;
+            int t = mm->next_tile++;
+            scanned++;
+            if (!mm->tiles[t].dirty) continue;
+            minimap_build_tile(mm, txt, t);
+            if (SDL_GetPerformanceCounter() - start > budget) break;
+        }
+    }
+
+    if (mm->dirty_rows > 0) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 budget = SDL_GetPerformanceFrequency() * MINIMAP_BUDGET_US / 1000000;
+        int low = mm->height, high = 0;   // the rows composed, uploaded in one go
+        for (int scanned = 0; mm->dirty_rows > 0 && scanned < mm->height; ++scanned) {
+            if (mm->next_row >= mm->height) mm->next_row = 0;
+            int y = mm->next_row++;
+            if (!mm->row_dirty[y]) continue;
+            minimap_compose_row(mm, y);
+            mm->row_dirty[y] = 0;
+            mm->dirty_rows--;
+            if (y < low) low = y;
+            if (y >= high) high = y + 1;
+            if (SDL_GetPerformanceCounter() - start > budget) break;
+        }
+        if (low < high) {
+            SDL_Rect rows = {0, low, MINIMAP_WIDTH, high - low};
+            SDL_UpdateTexture(mm->texture, &rows, mm->pixels + (size_t)low * MINIMAP_WIDTH,
+                MINIMAP_WIDTH * sizeof(Uint32));
+        }
+    }
+}
+
+
+// draws the composed minimap and the viewport band on the right edge
+void minimap_render(minimap *mm, sdlwindow *win, sdltext *txt) {
+    if (!mm->texture || mm->line_count == 0) return;
+    SDL_Rect dst = {win->window_width - MINIMAP_WIDTH, 0, MINIMAP_WIDTH, mm->height};
+    SDL_RenderCopy(win->renderer, mm->texture, NULL, &dst);
+
+    int top = minimap_line_row(mm, txt->first_visible_line);
+    int bottom = minimap_line_row(mm, txt->first_visible_line + txt->MAX_VISIBLE_LINES + 1);
+    SDL_Rect band = {dst.x, top, MINIMAP_WIDTH, bottom - top > 2 ? bottom - top : 2};
+    SDL_SetRenderDrawBlendMode(win->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(win->renderer, 0, 0, 0, 40);
+    SDL_RenderFillRect(win->renderer, &band);
+    SDL_SetRenderDrawBlendMode(win->renderer, SDL_BLENDMODE_NONE);
+}
+
+
+int minimap_hit(sdlwindow *win, int mouse_x) {
+    return mouse_x >= win->window_width - MINIMAP_WIDTH;
+}
+
+
+// line under mouse_y, same coordinate math as the text area with a fractional row height
+int minimap_line_at(minimap *mm, int mouse_y) {
+    if (mm->line_count == 0) return 0;
+    return line_from_y(mouse_y, 0, 0, mm->line_count, mm->rows_used, mm->line_count);
+}
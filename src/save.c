@@ -0,0 +1,748 @@
+#define _GNU_SOURCE   // copy_file_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "save.h"
+#include "journal.h"
+#include "uring.h"
+
+
+// writes all of iov, writev may stop early and the batch is picked up where it did
+static int write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+
+// writes all of the count iovecs at offset, pwritev may stop early and the batch is picked up where it did
+static int pwrite_all(int fd, struct iovec *iov, int count, size_t offset) {
+    while (count > 0) {
+        ssize_t n = pwritev(fd, iov, count, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        offset += (size_t)n;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+
+// one pwritev worth of iovecs at an offset of the file, they stay put while the write is out
+typedef struct{
+struct iovec iov[SAVE_IOV_BATCH];
+int count;
+size_t offset;
+size_t total;
+}write_batch;
+
+// batches going out SAVE_QUEUE at a time through io_uring, or one after the other without it
+typedef struct{
+uring ring;
+int fd;
+write_batch *batches;
+int free[SAVE_QUEUE];   // batches not out, the last one is handed out next
+int free_count;
+size_t written;         // bytes of the batches that came back
+}write_queue;
+
+
+static int queue_open(write_queue *q, int fd) {
+    uring_init(&q->ring);
+    q->fd = fd;
+    q->batches = malloc(SAVE_QUEUE * sizeof(write_batch));
+    for (int i = 0; i < SAVE_QUEUE; ++i) q->free[i] = i;
+    q->free_count = SAVE_QUEUE;
+    q->written = 0;
+    if (q->batches) return 0;
+    uring_free(&q->ring);
+    return -1;
+}
+
+
+// a batch that came back, a write that stopped early is finished here
+static int queue_done(write_queue *q, const uring_done *d) {
+    write_batch *b = &q->batches[d->tag];
+    q->free[q->free_count++] = (int)d->tag;
+    if (d->result < 0) {
+        errno = (int)-d->result;
+        return -1;
+    }
+    q->written += b->total;
+    if ((size_t)d->result == b->total) return 0;
+    struct iovec *v = b->iov;
+    int count = b->count;
+    size_t n = (size_t)d->result;
+    while (count > 0 && n >= v->iov_len) {
+        n -= v->iov_len;
+        v++;
+        count--;
+    }
+    if (count > 0) {
+        v->iov_base = (char *)v->iov_base + n;
+        v->iov_len -= n;
+    }
+    return pwrite_all(q->fd, v, count, b->offset + (size_t)d->result);
+}
+
+
+// a batch to fill, when all of them are out it waits for one to come back
+static write_batch *queue_batch(write_queue *q) {
+    if (q->free_count == 0) {
+        uring_done d;
+        if (uring_wait(&q->ring, &d) != 0 || queue_done(q, &d) != 0) return NULL;
+    }
+    write_batch *b = &q->batches[q->free[q->free_count - 1]];
+    b->count = 0;
+    b->total = 0;
+    return b;
+}
+
+
+// sends the batch queue_batch handed out last
+static int queue_send(write_queue *q, write_batch *b) {
+    q->free_count--;
+    return uring_queue(&q->ring, URING_WRITEV, q->fd, b->iov, (size_t)b->count, (off_t)b->offset,
+                       (uint64_t)(b - q->batches));
+}
+
+
+// waits for every batch still out, 0 when all of them were written
+static int queue_close(write_queue *q) {
+    int result = 0;
+    while (q->ring.in_flight > 0) {
+        uring_done d;
+        if (uring_wait(&q->ring, &d) != 0) {   // the ring broke, closing it leaves the rest to the kernel
+            result = -1;
+            break;
+        }
+        if (queue_done(q, &d) != 0) result = -1;
+    }
+    uring_free(&q->ring);
+    free(q->batches);
+    return result;
+}
+
+
+// the pieces straight from the storage, nothing is copied into a staging buffer. Every batch goes to its own
+// offset, so SAVE_QUEUE of them are out at once. A batch is hashed as it is put together, its write then
+// finds the bytes in the cache
+static int write_pieces(int fd, save_job *job) {
+    write_queue q;
+    if (queue_open(&q, fd) != 0) return -1;
+    journal_blocks_free(&job->blocks);   // whatever an in-place attempt left
+    size_t offset = 0;
+    size_t i = 0;
+    int ok = 1, hashed = 1;
+    while (ok && i < job->count) {
+        write_batch *b = queue_batch(&q);
+        if (!b) {
+            ok = 0;
+            break;
+        }
+        for (; i < job->count && b->count < SAVE_IOV_BATCH; ++i) {
+            piece *p = &job->pieces[i];
+            if (p->len == 0) continue;
+            b->iov[b->count].iov_base = job->chunks[p->chunk] + p->start;
+            b->iov[b->count].iov_len = p->len;
+            b->total += p->len;
+            b->count++;
+            hashed = journal_blocks_hash(&job->blocks, job->chunks[p->chunk] + p->start, p->len) == 0 && hashed;
+        }
+        if (b->count == 0) break;
+        b->offset = offset;
+        offset += b->total;
+        ok = queue_send(&q, b) == 0;
+        SDL_AtomicSet(&job->progress, job->length ? (int)(q.written * 1000 / job->length) : 1000);
+    }
+    ok = queue_close(&q) == 0 && ok;
+    job->hash = journal_blocks_total(&job->blocks);
+    return ok && hashed ? 0 : -1;
+}
+
+
+// the pieces transcoded back to what the file was read in, through a staging block that goes out whenever
+// the next slice might not fit any more. The hash is of the bytes in the file, like the loader's
+static int write_encoded(int fd, save_job *job) {
+    size_t cap = ENCODING_GROWTH(SAVE_ENCODE_BLOCK);
+    unsigned char *block = malloc(cap);
+    if (!block) return -1;
+    text_encoding *e = &job->enc;
+    uint64_t hash = JOURNAL_HASH_SEED;
+    size_t fill = 0, done = 0;
+    int ok = 1;
+    if (e->bom) {
+        block[fill++] = e->kind == ENCODING_UTF16BE ? 0xFE : 0xFF;
+        block[fill++] = e->kind == ENCODING_UTF16BE ? 0xFF : 0xFE;
+    }
+    for (size_t i = 0; ok && i <= job->count; ++i) {
+        const char *data = i < job->count ? job->chunks[job->pieces[i].chunk] + job->pieces[i].start : "";
+        size_t len = i < job->count ? job->pieces[i].len : 0;
+        size_t at = 0;
+        do {   // once more with nothing after the last piece, for a character it left open
+            size_t n = len - at < SAVE_ENCODE_BLOCK ? len - at : SAVE_ENCODE_BLOCK;
+            if (fill + ENCODING_GROWTH(n) > cap) {
+                struct iovec v = {block, fill};
+                ok = write_all(fd, &v, 1) == 0;
+                hash = journal_hash_update(hash, (const char *)block, fill);
+                fill = 0;
+            }
+            fill += encoding_encode(e, data + at, n, (char *)block + fill);
+            at += n;
+        } while (ok && at < len);
+        done += len;
+        SDL_AtomicSet(&job->progress, job->length ? (int)(done * 1000 / job->length) : 1000);
+    }
+    if (ok && fill > 0) {
+        struct iovec v = {block, fill};
+        ok = write_all(fd, &v, 1) == 0;
+        hash = journal_hash_update(hash, (const char *)block, fill);
+    }
+    free(block);
+    job->hash = hash;
+    return ok ? 0 : -1;
+}
+
+
+// makes the rename itself survive a crash
+static void sync_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char dir[PATH_MAX];
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else if ((size_t)(slash - path) < sizeof(dir)) {
+        memcpy(dir, path, slash - path);
+        dir[slash - path] = '\0';
+    } else {
+        return;
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+
+// a run of storage bytes and where the base has it in the file
+typedef struct{
+int chunk;
+size_t start;
+size_t len;
+size_t file_offset;
+}disk_extent;
+
+// a stretch of the new document, file_offset is where its bytes already are on disk or -1
+typedef struct{
+size_t offset;
+size_t len;
+const char *data;
+long long file_offset;
+}save_run;
+
+
+static int extent_compare(const void *a, const void *b) {
+    const disk_extent *x = a, *y = b;
+    if (x->chunk != y->chunk) return x->chunk < y->chunk ? -1 : 1;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+
+// first extent at or after (chunk, start) in the sorted extents
+static size_t extent_find(const disk_extent *e, size_t n, int chunk, size_t start) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[mid].chunk < chunk || (e[mid].chunk == chunk && e[mid].start + e[mid].len <= start)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// splits the snapshot into runs that either sit on disk already (at some offset) or have to be written
+static save_run *save_runs(save_job *job, size_t *count) {
+    const save_base *base = job->base;
+    disk_extent *e = malloc((base->count ? base->count : 1) * sizeof(disk_extent));
+    size_t cap = job->count * 2 + 1;
+    save_run *runs = malloc(cap * sizeof(save_run));
+    if (!e || !runs) {
+        free(e);
+        free(runs);
+        return NULL;
+    }
+    size_t at = 0;
+    for (size_t i = 0; i < base->count; ++i) {
+        disk_extent x = {base->pieces[i].chunk, base->pieces[i].start, base->pieces[i].len, at};
+        e[i] = x;
+        at += x.len;
+    }
+    qsort(e, base->count, sizeof(disk_extent), extent_compare);
+
+    size_t n = 0;
+    at = 0;
+    for (size_t i = 0; i < job->count; ++i) {
+        piece p = job->pieces[i];
+        while (p.len > 0) {
+            size_t k = extent_find(e, base->count, p.chunk, p.start);
+            save_run r = {at, p.len, job->chunks[p.chunk] + p.start, -1};
+            if (k < base->count && e[k].chunk == p.chunk && e[k].start <= p.start) {
+                size_t inner = p.start - e[k].start;
+                if (r.len > e[k].len - inner) r.len = e[k].len - inner;
+                r.file_offset = (long long)(e[k].file_offset + inner);
+            } else if (k < base->count && e[k].chunk == p.chunk && e[k].start - p.start < r.len) {
+                r.len = e[k].start - p.start;   // new up to where the next known bytes start
+            }
+            if (n == cap) {
+                cap *= 2;
+                save_run *grown = realloc(runs, cap * sizeof(save_run));
+                if (!grown) {
+                    free(e);
+                    free(runs);
+                    return NULL;
+                }
+                runs = grown;
+            }
+            runs[n++] = r;
+            at += r.len;
+            p.start += r.len;
+            p.len -= r.len;
+        }
+    }
+    free(e);
+    *count = n;
+    return runs;
+}
+
+
+// copies len bytes inside the file from one offset to another, back to front when they move up so
+// nothing is overwritten before it was read
+static int move_range(int fd, size_t from, size_t to, size_t len, char *block) {
+    size_t distance = from < to ? to - from : from - to;
+    size_t done = 0;
+    while (done < len) {
+        size_t n = len - done < SAVE_MOVE_BLOCK ? len - done : SAVE_MOVE_BLOCK;
+        size_t at = to > from ? len - done - n : done;
+        size_t copied = 0;   // of the block, from its front. A short copy leaves the rest for the next call
+        while (distance >= n && copied < n) {   // in the kernel, source and destination must not overlap
+            off_t src = (off_t)(from + at + copied), dst = (off_t)(to + at + copied);
+            ssize_t moved = copy_file_range(fd, &src, fd, &dst, n - copied, 0);
+            if (moved <= 0) break;
+            copied += (size_t)moved;
+        }
+        if (copied < n) {   // whatever the kernel did not copy goes through memory
+            size_t rest = n - copied;
+            if (pread(fd, block, rest, (off_t)(from + at + copied)) != (ssize_t)rest) return -1;
+            if (pwrite(fd, block, rest, (off_t)(to + at + copied)) != (ssize_t)rest) return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+
+// writes the runs [first, last) that are not in place, neighbours go out in one pwritev and SAVE_QUEUE of
+// those at once
+static int write_runs(int fd, save_run *runs, size_t first, size_t last) {
+    write_queue q;
+    if (queue_open(&q, fd) != 0) return -1;
+    size_t i = first;
+    int ok = 1;
+    while (ok && i < last) {
+        if (runs[i].file_offset == (long long)runs[i].offset) {
+            i++;
+            continue;
+        }
+        write_batch *b = queue_batch(&q);
+        if (!b) {
+            ok = 0;
+            break;
+        }
+        b->offset = runs[i].offset;
+        while (i < last && b->count < SAVE_IOV_BATCH && runs[i].file_offset != (long long)runs[i].offset) {
+            b->iov[b->count].iov_base = (void *)runs[i].data;
+            b->iov[b->count].iov_len = runs[i].len;
+            b->total += runs[i].len;
+            b->count++;
+            i++;
+        }
+        ok = queue_send(&q, b) == 0;
+    }
+    ok = queue_close(&q) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+
+// last of the blocks starting at starts that begins at or before offset
+static size_t block_find(const size_t *starts, size_t n, size_t offset) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (starts[mid] <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+
+// the blocks of the file once the runs are in it. Kept runs take the hashes of the base's blocks they cover
+// whole, only written runs and the ends of kept ones are read. Without blocks in the base every run is
+static int save_run_blocks(save_job *job, const save_run *runs, size_t count) {
+    const journal_blocks *old = &job->base->blocks;
+    int known = old->count > 0 && old->len == (size_t)job->base->st.st_size;
+    size_t *starts = known ? malloc(old->count * sizeof(size_t)) : NULL;
+    if (!starts) known = 0;
+    size_t at = 0;
+    for (size_t k = 0; known && k < old->count; ++k) {
+        starts[k] = at;
+        at += old->blocks[k].len;
+    }
+    journal_blocks_free(&job->blocks);
+    int ok = 1;
+    for (size_t i = 0; ok && i < count; ++i) {
+        const save_run *r = &runs[i];
+        if (!known || r->file_offset < 0) {
+            ok = journal_blocks_hash(&job->blocks, r->data, r->len) == 0;
+            continue;
+        }
+        size_t from = (size_t)r->file_offset, end = from + r->len;
+        size_t k = block_find(starts, old->count, from);
+        while (ok && from < end) {
+            const journal_block *x = &old->blocks[k];
+            size_t n = (starts[k] + x->len < end ? starts[k] + x->len : end) - from;
+            if (from == starts[k] && n == x->len) {
+                ok = journal_blocks_add(&job->blocks, n, x->hash) == 0;
+            } else {
+                ok = journal_blocks_hash(&job->blocks, r->data + (from - (size_t)r->file_offset), n) == 0;
+            }
+            from += n;
+            k++;
+        }
+    }
+    free(starts);
+    return ok ? 0 : -1;
+}
+
+
+// updates the file the base describes in place: runs already at their offset stay, a tail that only moved
+// is shifted inside the file and everything else is written. Returns 1 when that would move more bytes than
+// writing the whole file, or the file is not the one the base describes. Unlike the full save this is not
+// atomic, a crash in the middle leaves a mix of both versions
+static int save_in_place(save_job *job, const char *target) {
+    const save_base *base = job->base;
+    if (!base || base->count == 0) return 1;
+    struct stat st;
+    if (stat(target, &st) != 0 || !save_base_fresh(base, &st)) return 1;   // changed by something else since
+    size_t count;
+    save_run *runs = save_runs(job, &count);
+    if (!runs) return 1;
+
+    // the tail that kept its bytes but moved by the same distance, usually everything after the edits
+    size_t tail = count;
+    long long shift = 0;
+    while (tail > 0 && runs[tail - 1].file_offset >= 0) {
+        long long d = (long long)runs[tail - 1].offset - runs[tail - 1].file_offset;
+        if (d == 0 || (tail < count && d != shift)) break;
+        shift = d;
+        tail--;
+    }
+    size_t tail_len = 0, cost = 0;
+    for (size_t i = tail; i < count; ++i) tail_len += runs[i].len;
+    for (size_t i = 0; i < tail; ++i) {
+        if (runs[i].file_offset != (long long)runs[i].offset) cost += runs[i].len;
+    }
+    cost += tail_len * 2;   // read and written again
+    if (cost >= job->length) {
+        free(runs);
+        return 1;
+    }
+
+    int fd = open(target, O_RDWR);
+    char *block = tail_len > 0 ? malloc(SAVE_MOVE_BLOCK) : NULL;
+    int ok = fd >= 0 && (tail_len == 0 || block);
+    if (ok && tail_len > 0) {
+        size_t from = (size_t)runs[tail].file_offset;
+        ok = move_range(fd, from, (size_t)((long long)from + shift), tail_len, block) == 0;
+    }
+    ok = ok && write_runs(fd, runs, 0, tail) == 0;
+    if (ok && (off_t)job->length < st.st_size) ok = ftruncate(fd, (off_t)job->length) == 0;
+    ok = ok && fsync(fd) == 0 && fstat(fd, &job->st) == 0;
+    if (fd >= 0) close(fd);
+    free(block);
+    if (!ok) {
+        free(runs);
+        perror("Could not update file in place, writing all of it");
+        return 1;   // the full save below puts a complete file back
+    }
+    ok = save_run_blocks(job, runs, count) == 0;
+    free(runs);
+    if (!ok) return 1;
+    job->hash = journal_blocks_total(&job->blocks);
+    job->in_place = 1;
+    return 0;
+}
+
+
+// writes the snapshot to a temporary file next to the target, syncs it and renames it over the target, so
+// the file on disk is always either the old version or the complete new one
+static int save_snapshot(save_job *job) {
+    const char *filename = job->path;
+    char target[PATH_MAX];
+    if (!realpath(filename, target)) {   // a symlink keeps pointing at the saved file
+        if (errno != ENOENT || strlen(filename) >= sizeof(target)) {
+            perror("Could not resolve save path");
+            return -1;
+        }
+        strcpy(target, filename);
+    }
+    if (job->enc.kind == ENCODING_LATIN1) {
+        for (size_t i = 0; i < job->count; ++i) {
+            piece *p = &job->pieces[i];
+            if (encoding_fits_latin1(job->chunks[p->chunk] + p->start, p->len)) continue;
+            fprintf(stderr, "%s has characters Latin-1 does not, it is saved as UTF-8\n", filename);
+            job->enc.kind = ENCODING_UTF8;
+            break;
+        }
+    }
+    if (job->enc.kind == ENCODING_UTF8 && save_in_place(job, target) == 0) return 0;
+    char tmp[PATH_MAX + 32];
+    int fd = -1;
+    for (int attempt = 0; attempt < 100 && fd < 0; ++attempt) {
+        snprintf(tmp, sizeof(tmp), "%s.%ld.%d.tmp", target, (long)getpid(), attempt);
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        perror("Could not open file for writing");
+        return -1;
+    }
+    struct stat st;
+    if (stat(target, &st) == 0) {
+        fchmod(fd, st.st_mode & 07777);   // same permissions as the file it replaces
+    }
+    int written = job->enc.kind == ENCODING_UTF8 ? write_pieces(fd, job) : write_encoded(fd, job);
+    if (written != 0 || fsync(fd) != 0 || fstat(fd, &job->st) != 0) {
+        perror("Could not write file");
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    if (close(fd) != 0 || rename(tmp, target) != 0) {
+        perror("Could not replace file");
+        unlink(tmp);
+        return -1;
+    }
+    sync_directory(target);
+    return 0;
+}
+
+
+void save_base_init(save_base *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+
+void save_base_free(save_base *b) {
+    free(b->pieces);
+    journal_blocks_free(&b->blocks);
+    save_base_init(b);
+}
+
+
+// the file behind st holds exactly what buf holds now, e.g. right after loading it. blocks are its hashes
+// when they are known, they move over into the base
+void save_base_set(save_base *b, textbuffer *buf, const struct stat *st, journal_blocks *blocks) {
+    save_base_free(b);
+    if ((size_t)st->st_size != buffer_length(buf)) return;
+    if (buf->piece_count > 0) {
+        b->pieces = malloc(buf->piece_count * sizeof(piece));
+        if (!b->pieces) return;
+        memcpy(b->pieces, buf->pieces, buf->piece_count * sizeof(piece));
+        b->count = b->cap = buf->piece_count;
+    }
+    b->st = *st;
+    if (blocks && blocks->len == (size_t)st->st_size) {
+        b->blocks = *blocks;
+        memset(blocks, 0, sizeof(*blocks));
+    }
+}
+
+
+// bytes another program appended to the file, read into the storage as p with data its bytes. The caller
+// updates st
+int save_base_append(save_base *b, piece p, const char *data) {
+    int hashed = b->blocks.len > 0 || b->count == 0;   // blocks are kept up to date only when there are any
+    if (hashed && journal_blocks_hash(&b->blocks, data, p.len) != 0) {
+        journal_blocks_free(&b->blocks);   // the next save hashes everything again
+    }
+    piece *last = b->count ? &b->pieces[b->count - 1] : NULL;
+    if (last && last->chunk == p.chunk && last->start + last->len == p.start) {   // read right after the last one
+        last->len += p.len;
+        last->newlines += p.newlines;
+        return 0;
+    }
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 16;
+        piece *pieces = realloc(b->pieces, cap * sizeof(piece));
+        if (!pieces) return -1;
+        b->pieces = pieces;
+        b->cap = cap;
+    }
+    b->pieces[b->count++] = p;
+    return 0;
+}
+
+
+// the file behind st is still the one the base describes, nothing wrote to it since
+int save_base_fresh(const save_base *b, const struct stat *st) {
+    return st->st_dev == b->st.st_dev && st->st_ino == b->st.st_ino && st->st_size == b->st.st_size &&
+           st->st_mtim.tv_sec == b->st.st_mtim.tv_sec && st->st_mtim.tv_nsec == b->st.st_mtim.tv_nsec;
+}
+
+
+// next span of pieces from *i on that follow each other in one chunk, edits that were undone leave the
+// document split into such neighbours
+static piece base_span(const piece *p, size_t count, size_t *i) {
+    piece span = p[(*i)++];
+    while (*i < count && p[*i].chunk == span.chunk && p[*i].start == span.start + span.len) {
+        span.len += p[(*i)++].len;
+    }
+    return span;
+}
+
+
+// buf holds what the file on disk holds, found from the pieces alone without comparing any text
+int save_base_same(const save_base *b, textbuffer *buf) {
+    if (b->count == 0 && b->st.st_ino == 0) return 0;   // nothing known about the file
+    size_t i = 0, k = 0;
+    while (i < b->count && k < buf->piece_count) {
+        piece x = base_span(b->pieces, b->count, &i);
+        piece y = base_span(buf->pieces, buf->piece_count, &k);
+        if (x.chunk != y.chunk || x.start != y.start || x.len != y.len) return 0;
+    }
+    return i == b->count && k == buf->piece_count;
+}
+
+
+// a finished save becomes the base of the next one, its piece list moves over. A transcoded file does not
+// hold the bytes of the pieces, there is no base for it
+void save_base_take(save_base *b, save_job *job) {
+    save_base_free(b);
+    if (job->result != 0 || job->enc.kind != ENCODING_UTF8) return;
+    b->pieces = job->pieces;
+    b->count = b->cap = job->count;
+    b->st = job->st;
+    b->blocks = job->blocks;
+    job->pieces = NULL;
+    job->count = 0;
+    memset(&job->blocks, 0, sizeof(job->blocks));
+}
+
+
+// SDL event a finished save sends back, user.data1 is the job
+Uint32 save_event_type(void) {
+    static Uint32 type = 0;
+    if (type == 0) type = SDL_RegisterEvents(1);
+    return type;
+}
+
+
+static int save_thread(void *data) {
+    save_job *job = data;
+    job->result = save_snapshot(job);
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = save_event_type();
+    event.user.code = job->result;
+    event.user.data1 = job;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+
+// after save_wait, or for a job that never started
+void save_free(save_job *job) {
+    free(job->path);
+    free(job->pieces);
+    journal_blocks_free(&job->blocks);
+    free(job->chunks);
+    free(job);
+}
+
+
+// snapshots buf and starts writing it to filename in the background, NULL if it could not start.
+// The buffer must stay alive until the job went through save_finish
+save_job *save_start(const char *filename, textbuffer *buf, const save_base *base, const text_encoding *enc) {
+    save_event_type();   // registered here on the main thread, not on the worker
+    save_job *job = calloc(1, sizeof(save_job));
+    if (!job) return NULL;
+    job->path = strdup(filename);
+    job->count = buf->piece_count;
+    job->pieces = malloc((job->count ? job->count : 1) * sizeof(piece));
+    job->chunks = malloc((buf->chunk_count ? buf->chunk_count : 1) * sizeof(char *));
+    if (!job->path || !job->pieces || !job->chunks) {
+        save_free(job);
+        return NULL;
+    }
+    memcpy(job->pieces, buf->pieces, job->count * sizeof(piece));
+    for (int c = 0; c < buf->chunk_count; ++c) {
+        job->chunks[c] = buf->chunks[c].data;
+    }
+    job->length = buffer_length(buf);
+    job->base = base;
+    encoding_init(&job->enc);   // only what it is, none of the state of the load
+    job->enc.kind = enc->kind;
+    job->enc.bom = enc->bom;
+    job->result = -1;
+    job->thread = SDL_CreateThread(save_thread, "save", job);
+    if (!job->thread) {
+        fprintf(stderr, "Could not start saving: %s\n", SDL_GetError());
+        save_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+
+// waits for the thread if it is still writing, result and hash are final afterwards
+void save_wait(save_job *job) {
+    if (job->thread) SDL_WaitThread(job->thread, NULL);
+    job->thread = NULL;
+}
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE   // memrchr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "session.h"
+#include "journal.h"
+
+#define SESSION_MAGIC "BSESS01"   // 8 bytes with the terminator
+
+// the file is this header and then count records, each followed by its path
+typedef struct{
+char magic[8];
+uint32_t count;
+uint32_t unused;
+}session_header;
+
+
+// session in the state directory, next to the untitled journals
+static char *session_path(void) {
+    char *dir = journal_state_dir();
+    if (!dir) return NULL;
+    char *path = malloc(strlen(dir) + 16);
+    if (path) sprintf(path, "%s/session", dir);
+    free(dir);
+    return path;
+}
+
+
+void session_init(session *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+
+void session_free(session *s) {
+    for (size_t i = 0; i < s->count; ++i) free(s->paths[i]);
+    session_init(s);
+}
+
+
+// adds a file, the one on top first. st is the file the positions are in, NULL when they are in unsaved edits
+int session_add(session *s, uint32_t kind, const char *path, const struct stat *st, size_t cursor, size_t top,
+                uint64_t top_offset) {
+    if (s->count == SESSION_FILES) return -1;
+    char *copy = realpath(path, NULL);   // the next start may run somewhere else
+    if (!copy) copy = strdup(path);
+    if (!copy) return -1;
+    session_record *r = &s->files[s->count];
+    memset(r, 0, sizeof(*r));
+    r->kind = kind;
+    r->path_len = (uint32_t)strlen(copy);
+    if (st) {
+        r->size = (uint64_t)st->st_size;
+        r->mtime_sec = (uint64_t)st->st_mtim.tv_sec;
+        r->mtime_nsec = (uint64_t)st->st_mtim.tv_nsec;
+        r->ino = (uint64_t)st->st_ino;
+        r->dev = (uint64_t)st->st_dev;
+    }
+    r->cursor = cursor;
+    r->top = top;
+    r->top_offset = top_offset;
+    s->paths[s->count++] = copy;
+    return 0;
+}
+
+
+// what the last run left, -1 when there is none or it cannot be read. A few hundred bytes whatever was open
+int session_load(session *s) {
+    session_free(s);
+    char *path = session_path();
+    int fd = path ? open(path, O_RDONLY) : -1;
+    free(path);
+    if (fd < 0) return -1;
+    session_header h;
+    int ok = read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) && memcmp(h.magic, SESSION_MAGIC, 8) == 0 &&
+             h.count <= SESSION_FILES;
+    for (uint32_t i = 0; ok && i < h.count; ++i) {
+        session_record *r = &s->files[i];
+        ok = read(fd, r, sizeof(*r)) == (ssize_t)sizeof(*r) && r->path_len > 0 && r->path_len < PATH_MAX;
+        char *p = ok ? malloc(r->path_len + 1) : NULL;
+        ok = p && read(fd, p, r->path_len) == (ssize_t)r->path_len;
+        if (!ok) {
+            free(p);
+            break;
+        }
+        p[r->path_len] = '\0';
+        s->paths[s->count++] = p;
+    }
+    close(fd);
+    if (!ok) session_free(s);
+    return ok ? 0 : -1;
+}
+
+
+// replaces the session file in one write and a rename, a run that quits halfway leaves the old one
+int session_save(const session *s) {
+    char *path = session_path();
+    if (!path) return -1;
+    size_t len = sizeof(session_header);
+    for (size_t i = 0; i < s->count; ++i) len += sizeof(session_record) + s->files[i].path_len;
+    char *data = malloc(len);
+    char *tmp = malloc(strlen(path) + 8);
+    if (!data || !tmp) {
+        free(data);
+        free(tmp);
+        free(path);
+        return -1;
+    }
+    session_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SESSION_MAGIC, 8);
+    h.count = (uint32_t)s->count;
+    memcpy(data, &h, sizeof(h));
+    size_t at = sizeof(h);
+    for (size_t i = 0; i < s->count; ++i) {
+        memcpy(data + at, &s->files[i], sizeof(session_record));
+        at += sizeof(session_record);
+        memcpy(data + at, s->paths[i], s->files[i].path_len);
+        at += s->files[i].path_len;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int ok = fd >= 0 && write(fd, data, len) == (ssize_t)len;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+    free(data);
+    free(tmp);
+    free(path);
+    return ok ? 0 : -1;
+}
+
+
+// the file behind st is the one the positions were taken in
+int session_fresh(const session_record *r, const struct stat *st) {
+    if (r->ino == 0) return 0;   // they were in unsaved edits
+    return r->size == (uint64_t)st->st_size && r->mtime_sec == (uint64_t)st->st_mtim.tv_sec &&
+           r->mtime_nsec == (uint64_t)st->st_mtim.tv_nsec && r->ino == (uint64_t)st->st_ino &&
+           r->dev == (uint64_t)st->st_dev;
+}
+
+
+// the text of the last screen, read with one pread from where its top line starts and cut after the last
+// whole line. NULL when the file changed since, the lines would be somewhere else
+char *session_preview(const session_record *r, const char *path, size_t *len) {
+    if (r->top_offset == UINT64_MAX) return NULL;
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0) return NULL;
+    char *text = NULL;
+    ssize_t n = -1;
+    if (fstat(fd, &st) == 0 && session_fresh(r, &st) && r->top_offset < (uint64_t)st.st_size &&
+        (text = malloc(SESSION_PREVIEW)) != NULL) {
+        n = pread(fd, text, SESSION_PREVIEW, (off_t)r->top_offset);
+    }
+    close(fd);
+    if (n == SESSION_PREVIEW) {
+        char *nl = memrchr(text, '\n', SESSION_PREVIEW);
+        n = nl ? nl - text : 0;
+    }
+    if (n <= 0) {
+        free(text);
+        return NULL;
+    }
+    *len = (size_t)n;
+    return text;
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "undo.h"
+
+
+void undo_init(undolog *u) {
+    memset(u, 0, sizeof(*u));
+    u->limit = UNDO_MEMORY_LIMIT;
+}
+
+
+static void undo_group_free(undo_group *g) {
+    for (size_t i = 0; i < g->count; ++i) {
+        free(g->ops[i].pieces);
+    }
+    free(g->ops);
+}
+
+
+void undo_free(undolog *u) {
+    for (size_t i = 0; i < u->count; ++i) {
+        undo_group_free(&u->groups[i]);
+    }
+    free(u->groups);
+    undo_init(u);
+}
+
+
+// a new edit replaces whatever could still be redone
+static void undo_drop_redo(undolog *u) {
+    for (size_t i = u->current; i < u->count; ++i) {
+        u->memory -= u->groups[i].memory;
+        undo_group_free(&u->groups[i]);
+    }
+    u->count = u->current;
+    if (u->stable > u->count) u->stable = u->count;
+}
+
+
+// drops the oldest groups until the history fits the memory limit again, the newest one always stays
+static void undo_trim(undolog *u) {
+    if (u->memory <= u->limit) return;
+    size_t target = u->limit - u->limit / 4;   // a quarter below the cap, long replays do not shift the groups on every step
+    size_t drop = 0;
+    while (u->memory > target && drop + 1 < u->current) {
+        u->memory -= u->groups[drop].memory;
+        undo_group_free(&u->groups[drop]);
+        drop++;
+    }
+    if (drop == 0) return;
+    memmove(u->groups, u->groups + drop, (u->count - drop) * sizeof(undo_group));
+    u->count -= drop;
+    u->current -= drop;
+    u->stable = u->stable > drop ? u->stable - drop : 0;
+    u->trimmed += drop;
+}
+
+
+static undo_group *undo_push_group(undolog *u, size_t cursor) {
+    if (u->count == u->cap) {
+        size_t new_cap = u->cap ? u->cap * 2 : 64;
+        undo_group *groups = realloc(u->groups, new_cap * sizeof(undo_group));
+        if (!groups) return NULL;
+        u->groups = groups;
+        u->cap = new_cap;
+    }
+    undo_group *g = &u->groups[u->count++];
+    memset(g, 0, sizeof(*g));
+    g->cursor_before = cursor;
+    g->cursor_after = cursor;
+    g->memory = sizeof(undo_group);
+    u->memory += g->memory;
+    u->current = u->count;
+    return g;
+}
+
+
+void undo_begin(undolog *u, size_t cursor) {
+    undo_drop_redo(u);
+    if (!undo_push_group(u, cursor)) return;
+    u->open = 1;
+    u->recording = 1;
+}
+
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+
+// reopens the last group for one more keystroke of the same kind right where the last one stopped,
+// a word followed by its spaces ends up as one group
+int undo_continue(undolog *u, int kind, size_t cursor, char c, unsigned int now) {
+    if (!u->open || kind == UNDO_OTHER || u->current == 0 || u->current != u->count) return 0;
+    undo_group *g = &u->groups[u->current - 1];
+    if (g->kind != kind || g->cursor_after != cursor || now - g->time > UNDO_COALESCE_MS) return 0;
+    if (is_space(g->last_char) && !is_space(c)) return 0;
+    u->recording = 1;
+    return 1;
+}
+
+
+void undo_end(undolog *u, size_t cursor, int kind, char c, unsigned int now) {
+    if (!u->recording || u->current == 0) return;
+    u->recording = 0;
+    undo_group *g = &u->groups[u->current - 1];
+    g->cursor_after = cursor;
+    g->kind = kind;
+    g->last_char = c;
+    g->time = now;
+    if (g->count == 0) {   // nothing changed, forget the group again
+        u->memory -= g->memory;
+        undo_group_free(g);
+        u->count--;
+        u->current--;
+        u->open = 0;
+        return;
+    }
+    undo_trim(u);
+}
+
+
+// cursor moved elsewhere, the next keystroke starts a new group
+void undo_break(undolog *u) {
+    u->open = 0;
+}
+
+
+// adds n pieces to the front or back of op, gluing spans that are next to each other in storage
+static int op_add_pieces(undolog *u, undo_group *g, undo_op *op, const piece *p, size_t n, int front) {
+    if (n > 0 && op->count > 0) {
+        if (front) {
+            const piece *a = &p[n - 1];
+            piece *b = &op->pieces[0];
+            if (a->chunk == b->chunk && a->start + a->len == b->start) {
+                b->start = a->start;
+                b->len += a->len;
+                b->newlines += a->newlines;
+                n--;
+            }
+        } else {
+            piece *a = &op->pieces[op->count - 1];
+            const piece *b = &p[0];
+            if (a->chunk == b->chunk && a->start + a->len == b->start) {
+                a->len += b->len;
+                a->newlines += b->newlines;
+                p++;
+                n--;
+            }
+        }
+    }
+    if (n == 0) return 0;
+    piece *pieces = realloc(op->pieces, (op->count + n) * sizeof(piece));
+    if (!pieces) return -1;
+    op->pieces = pieces;
+    if (front) {
+        memmove(op->pieces + n, op->pieces, op->count * sizeof(piece));
+        memcpy(op->pieces, p, n * sizeof(piece));
+    } else {
+        memcpy(op->pieces + op->count, p, n * sizeof(piece));
+    }
+    op->count += n;
+    g->memory += n * sizeof(piece);
+    u->memory += n * sizeof(piece);
+    return 0;
+}
+
+
+static undo_op *undo_new_op(undolog *u, undo_group *g, int type, size_t offset) {
+    if (g->count == g->cap) {
+        size_t new_cap = g->cap ? g->cap * 2 : 4;
+        undo_op *ops = realloc(g->ops, new_cap * sizeof(undo_op));
+        if (!ops) return NULL;
+        g->ops = ops;
+        g->memory += (new_cap - g->cap) * sizeof(undo_op);
+        u->memory += (new_cap - g->cap) * sizeof(undo_op);
+        g->cap = new_cap;
+    }
+    undo_op *op = &g->ops[g->count++];
+    memset(op, 0, sizeof(*op));
+    op->type = type;
+    op->offset = offset;
+    return op;
+}
+
+
+static undo_group *undo_recording(undolog *u, size_t offset) {
+    if (!u->recording) undo_begin(u, offset);
+    return u->current ? &u->groups[u->current - 1] : NULL;
+}
+
+
+// call after len bytes were inserted at offset
+void undo_record_insert(undolog *u, textbuffer *buf, size_t offset, size_t len) {
+    undo_group *g = undo_recording(u, offset);
+    if (!g || len == 0) return;
+    piece *p;
+    size_t n = buffer_copy_pieces(buf, offset, len, &p);
+    undo_op *last = g->count ? &g->ops[g->count - 1] : NULL;
+    if (last && last->type == UNDO_INSERT && last->offset + last->len == offset) {   // typing on
+        op_add_pieces(u, g, last, p, n, 0);
+        last->len += len;
+    } else {
+        undo_op *op = undo_new_op(u, g, UNDO_INSERT, offset);
+        if (op) {
+            op_add_pieces(u, g, op, p, n, 0);
+            op->len = len;
+        }
+    }
+    free(p);
+}
+
+
+// call before len bytes at offset get deleted
+void undo_record_delete(undolog *u, textbuffer *buf, size_t offset, size_t len) {
+    undo_group *g = undo_recording(u, offset);
+    if (!g || len == 0) return;
+    piece *p;
+    size_t n = buffer_copy_pieces(buf, offset, len, &p);
+    undo_op *last = g->count ? &g->ops[g->count - 1] : NULL;
+    if (last && last->type == UNDO_DELETE && offset + len == last->offset) {   // backspacing on
+        op_add_pieces(u, g, last, p, n, 1);
+        last->offset = offset;
+        last->len += len;
+    } else if (last && last->type == UNDO_DELETE && offset == last->offset) {   // deleting forward
+        op_add_pieces(u, g, last, p, n, 0);
+        last->len += len;
+    } else {
+        undo_op *op = undo_new_op(u, g, UNDO_DELETE, offset);
+        if (op) {
+            op_add_pieces(u, g, op, p, n, 0);
+            op->len = len;
+        }
+    }
+    free(p);
+}
+
+
+// records an op whose pieces the caller already has, batches use it for every one of their edits
+void undo_record_pieces(undolog *u, int type, size_t offset, size_t len, const piece *p, size_t n) {
+    undo_group *g = undo_recording(u, offset);
+    if (!g || len == 0) return;
+    undo_add_op(u, g, type, offset, len, p, n);
+}
+
+
+// one edit of a batch group with the ops at its place merged, what it deleted and what it inserted there
+typedef struct{
+size_t offset;
+size_t del_len;
+const piece *del;
+size_t del_count;
+size_t ins_len;
+const piece *ins;
+size_t ins_count;
+}undo_edit;
+
+
+// the ops of g as edits sorted by offset in the document before the group, 0 when they do not go one way
+// through it and have to be replayed one by one
+static size_t undo_edits(const undo_group *g, undo_edit *e) {
+    size_t n = 0;
+    for (size_t i = 0; i < g->count; ++i) {
+        const undo_op *op = &g->ops[i];
+        undo_edit *last = n ? &e[n - 1] : NULL;
+        if (op->type == UNDO_INSERT && last && last->ins_len == 0 && last->offset == op->offset) {
+            last->ins_len = op->len;   // the text a batch edit put where it deleted
+            last->ins = op->pieces;
+            last->ins_count = op->count;
+            continue;
+        }
+        undo_edit *edit = &e[n++];
+        memset(edit, 0, sizeof(*edit));
+        edit->offset = op->offset;
+        if (op->type == UNDO_INSERT) {
+            edit->ins_len = op->len;
+            edit->ins = op->pieces;
+            edit->ins_count = op->count;
+        } else {
+            edit->del_len = op->len;
+            edit->del = op->pieces;
+            edit->del_count = op->count;
+        }
+    }
+    // the offsets are in the document as the edits before left it. Front to back each one starts past them,
+    // back to front each one ends before them and stays where it was before the group
+    int forward = 1, backward = 1;
+    for (size_t k = 1; k < n; ++k) {
+        if (e[k].offset < e[k - 1].offset + e[k - 1].ins_len) forward = 0;
+        if (e[k].offset + e[k].del_len > e[k - 1].offset) backward = 0;
+    }
+    if (forward) {
+        size_t added = 0, removed = 0;
+        for (size_t k = 0; k < n; ++k) {
+            e[k].offset = e[k].offset + removed - added;
+            added += e[k].ins_len;
+            removed += e[k].del_len;
+        }
+    } else if (backward) {
+        for (size_t k = 0; k < n / 2; ++k) {
+            undo_edit swap = e[k];
+            e[k] = e[n - 1 - k];
+            e[n - 1 - k] = swap;
+        }
+    } else {
+        return 0;
+    }
+    return n;
+}
+
+
+// replays a group of many ops as one buffer_apply, a batch of n edits costs one pass over the pieces
+// instead of one per op. -1 when it has to go op by op
+static int undo_batch(const undo_group *g, textbuffer *buf, int redo, size_t *first_offset) {
+    undo_edit *e = malloc(g->count * sizeof(undo_edit));
+    bufedit *edits = malloc(g->count * sizeof(bufedit));
+    size_t n = e && edits ? undo_edits(g, e) : 0;
+    if (n == 0) {
+        free(e);
+        free(edits);
+        return -1;
+    }
+    // undo runs on the document after the group, each edit sits shifted by the ones before it
+    size_t added = 0, removed = 0;
+    for (size_t k = 0; k < n; ++k) {
+        if (redo) {
+            edits[k] = (bufedit){e[k].offset, e[k].del_len, e[k].ins, e[k].ins_count};
+        } else {
+            edits[k] = (bufedit){e[k].offset + added - removed, e[k].ins_len, e[k].del, e[k].del_count};
+        }
+        added += e[k].ins_len;
+        removed += e[k].del_len;
+    }
+    int result = buffer_apply(buf, edits, n);
+    if (result == 0) *first_offset = edits[0].offset;
+    free(e);
+    free(edits);
+    return result;
+}
+
+
+// reverts the newest group, each op costs only the pieces it touches, a batch of them one pass
+int undo_undo(undolog *u, textbuffer *buf, size_t *cursor, size_t *first_offset) {
+    if (u->current == 0) return -1;
+    undo_group *g = &u->groups[u->current - 1];
+    *first_offset = buffer_length(buf);
+    int batched = g->count > 1 && undo_batch(g, buf, 0, first_offset) == 0;
+    for (size_t i = batched ? 0 : g->count; i-- > 0;) {
+        undo_op *op = &g->ops[i];
+        if (op->type == UNDO_INSERT) {
+            buffer_delete(buf, op->offset, op->len);
+        } else {
+            buffer_insert_pieces(buf, op->offset, op->pieces, op->count);
+        }
+        if (op->offset < *first_offset) *first_offset = op->offset;
+    }
+    *cursor = g->cursor_before;
+    u->current--;
+    u->open = 0;
+    u->recording = 0;
+    return 0;
+}
+
+
+int undo_redo(undolog *u, textbuffer *buf, size_t *cursor, size_t *first_offset) {
+    if (u->current == u->count) return -1;
+    undo_group *g = &u->groups[u->current];
+    *first_offset = buffer_length(buf);
+    int batched = g->count > 1 && undo_batch(g, buf, 1, first_offset) == 0;
+    for (size_t i = batched ? g->count : 0; i < g->count; ++i) {
+        undo_op *op = &g->ops[i];
+        if (op->type == UNDO_INSERT) {
+            buffer_insert_pieces(buf, op->offset, op->pieces, op->count);
+        } else {
+            buffer_delete(buf, op->offset, op->len);
+        }
+        if (op->offset < *first_offset) *first_offset = op->offset;
+    }
+    *cursor = g->cursor_after;
+    u->current++;
+    u->open = 0;
+    u->recording = 0;
+    return 0;
+}
+
+
+// appends a finished group read back from the journal, the caller sets current once all are in
+undo_group *undo_add_group(undolog *u, size_t cursor_before, size_t cursor_after, int kind) {
+    undo_group *g = undo_push_group(u, cursor_before);
+    if (!g) return NULL;
+    g->cursor_after = cursor_after;
+    g->kind = kind;
+    return g;
+}
+
+
+int undo_add_op(undolog *u, undo_group *g, int type, size_t offset, size_t len, const piece *p, size_t n) {
+    undo_op *op = undo_new_op(u, g, type, offset);
+    if (!op) return -1;
+    op->len = len;
+    return op_add_pieces(u, g, op, p, n, 0);
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+#ifdef __NR_io_uring_setup
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+#else
+    (void)entries;
+    (void)p;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+static int uring_enter(int fd, unsigned int submit, unsigned int wait, unsigned int flags) {
+#ifdef __NR_io_uring_enter
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+#else
+    (void)fd;
+    (void)submit;
+    (void)wait;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+// 0 with a ring, -1 when the kernel has none and requests run synchronously, r works either way
+int uring_init(uring *r) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = getenv("BEDITOR_NO_URING") ? -1 : uring_setup(URING_DEPTH, &p);   // set, even a kernel with it falls back
+    if (r->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {   // came with IORING_OP_READ, before 5.6 it is not there
+        uring_free(r);
+        return -1;
+    }
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {   // both rings in one mapping
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) r->sq_map = NULL;
+    if (r->sq_map && (p.features & IORING_FEAT_SINGLE_MMAP)) {
+        r->cq_map = r->sq_map;
+    } else if (r->sq_map) {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) r->cq_map = NULL;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) r->sqes = NULL;
+    if (!r->sq_map || !r->cq_map || !r->sqes) {
+        uring_free(r);
+        return -1;
+    }
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes = cq + p.cq_off.cqes;
+    return 0;
+}
+
+
+// the caller waited for everything it queued, or gives up on it and the kernel finishes it on its own
+void uring_free(uring *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+
+// what pread or pwritev return, a negative errno like a completion has it
+static ssize_t uring_now(int op, int fd, void *buf, size_t len, off_t offset) {
+    ssize_t n;
+    do {
+        n = op == URING_READ ? pread(fd, buf, len, offset) : pwritev(fd, buf, (int)len, offset);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -errno : n;
+}
+
+
+// queues a read of len bytes into buf, or for URING_WRITEV a write of the len iovecs at buf (which must stay
+// alive until it is handed back), at offset in fd. Goes to the kernel with the next uring_wait. -1 when
+// URING_DEPTH requests are out already
+int uring_queue(uring *r, int op, int fd, void *buf, size_t len, off_t offset, uint64_t tag) {
+    if (r->in_flight == URING_DEPTH) return -1;
+    r->in_flight++;
+    if (r->fd < 0) {
+        uring_done d = {tag, uring_now(op, fd, buf, len, offset)};
+        r->done[r->done_count++] = d;
+        return 0;
+    }
+    unsigned int tail = *r->sq_tail;
+    unsigned int i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)r->sqes + i;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op == URING_READ ? IORING_OP_READ : IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = tag;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);   // the kernel sees the entry filled in
+    r->queued++;
+    return 0;
+}
+
+
+// submits what was queued and hands back one finished request, in whatever order they finish. 0 with out
+// filled in, -1 when nothing is out or the ring failed
+int uring_wait(uring *r, uring_done *out) {
+    if (r->in_flight == 0) return -1;
+    if (r->fd < 0) {   // finished when queued, handed back in order
+        *out = r->done[0];
+        memmove(r->done, r->done + 1, --r->done_count * sizeof(uring_done));
+        r->in_flight--;
+        return 0;
+    }
+    for (;;) {
+        unsigned int head = *r->cq_head;
+        if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = (struct io_uring_cqe *)r->cqes + (head & *r->cq_mask);
+            out->tag = cqe->user_data;
+            out->result = cqe->res;
+            __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+            r->in_flight--;
+            return 0;
+        }
+        int n = uring_enter(r->fd, r->queued, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter");
+            return -1;
+        }
+        r->queued -= (unsigned int)n < r->queued ? (unsigned int)n : r->queued;
+    }
+}
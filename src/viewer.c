@@ -0,0 +1,491 @@
+#define _GNU_SOURCE   // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "viewer.h"
+#include "buffer.h"
+#include "lineindex.h"
+
+
+void viewer_init(viewer *v) {
+    memset(v, 0, sizeof(*v));
+    v->fd = -1;
+}
+
+
+void viewer_close(viewer *v) {
+    if (v->fd >= 0) {
+        close(v->fd);
+        if (!v->mapped) inflateEnd(&v->strm);
+    }
+    if (v->map) munmap(v->map, (size_t)v->size);
+    free(v->path);
+    free(v->in);
+    free(v->window);
+    for (size_t i = 0; i < v->point_count; ++i) free(v->points[i].window);
+    free(v->points);
+    free(v->lines);
+    for (int i = 0; i < VIEW_CACHE && !v->mapped; ++i) free(v->cache[i].data);   // spans of a map point into it
+    viewer_init(v);
+}
+
+
+// files the editor always shows through a view instead of loading them, --view opens any file in one
+int viewer_wants(const char *path) {
+    size_t len = strlen(path);
+    return len > 3 && strcmp(path + len - 3, ".gz") == 0;
+}
+
+
+// a gzip file gets inflated by the indexing pass, any other file is mapped and the pass only counts lines
+int viewer_open(viewer *v, const char *path) {
+    viewer_close(v);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Could not open file");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    v->mapped = !viewer_wants(path);
+    v->size = st.st_size;
+    if (v->mapped && st.st_size > 0) {
+        v->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (v->map == MAP_FAILED) {
+            perror("Could not map file");
+            v->map = NULL;
+            close(fd);
+            viewer_close(v);
+            return -1;
+        }
+    }
+    v->path = strdup(path);
+    v->lines = malloc(64 * sizeof(size_t));
+    if (!v->mapped) {
+        v->in = malloc(VIEW_IN_BLOCK);
+        v->window = calloc(1, VIEW_WINDOW);
+    }
+    if (!v->path || !v->lines || (!v->mapped && (!v->in || !v->window || inflateInit2(&v->strm, 47) != Z_OK))) {
+        close(fd);   // 47: a gzip header
+        viewer_close(v);
+        return -1;
+    }
+    v->fd = fd;
+    v->indexing = v->mapped && st.st_size == 0 ? 0 : 1;
+    v->strm.avail_out = VIEW_WINDOW;
+    v->strm.next_out = v->window;
+    v->lines[0] = 0;
+    v->line_marks = 1;
+    v->line_cap = 64;
+    v->line_count = 1;
+    v->st = st;
+    size_t *lines, marks, count;
+    if (v->mapped && st.st_size >= LINEINDEX_MIN_SIZE &&
+        lineindex_load(path, &st, VIEW_LINE_STEP, &lines, &marks, &count) == 0) {   // seen before, unchanged
+        free(v->lines);
+        v->lines = lines;
+        v->line_marks = v->line_cap = marks;
+        v->line_count = count;
+        v->length = (size_t)st.st_size;
+        v->read_at = st.st_size;
+        v->indexing = 0;
+    }
+    return 0;
+}
+
+
+// an access point where the pass is now, right at the start of a deflate block
+static int viewer_add_point(viewer *v) {
+    if (v->point_count == v->point_cap) {
+        size_t cap = v->point_cap ? v->point_cap * 2 : 64;
+        view_point *points = realloc(v->points, cap * sizeof(view_point));
+        if (!points) return -1;
+        v->points = points;
+        v->point_cap = cap;
+    }
+    view_point *p = &v->points[v->point_count];
+    p->window = malloc(VIEW_WINDOW);
+    if (!p->window) return -1;
+    size_t left = v->strm.avail_out;   // the window in output order, oldest byte first
+    memcpy(p->window, v->window + VIEW_WINDOW - left, left);
+    memcpy(p->window + left, v->window, VIEW_WINDOW - left);
+    p->out = v->length;
+    p->in = (off_t)v->strm.total_in;
+    p->bits = v->strm.data_type & 7;
+    v->point_count++;
+    return 0;
+}
+
+
+// counts the lines in output the pass just made, every VIEW_LINE_STEP-th gets a checkpoint
+static int viewer_count_lines(viewer *v, const unsigned char *from, size_t n) {
+    const unsigned char *p = from, *end = from + n;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        ++p;
+        if (v->line_count++ % VIEW_LINE_STEP != 0) continue;
+        if (v->line_marks == v->line_cap) {
+            size_t *lines = realloc(v->lines, v->line_cap * 2 * sizeof(size_t));
+            if (!lines) return -1;
+            v->lines = lines;
+            v->line_cap *= 2;
+        }
+        v->lines[v->line_marks++] = v->length + (size_t)(p - from);
+    }
+    return 0;
+}
+
+
+// newlines in the n bytes at p
+static size_t viewer_newlines(const char *p, size_t n) {
+    size_t count = 0;
+    const char *end = p + n;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        ++p;
+        ++count;
+    }
+    return count;
+}
+
+
+static const char *viewer_bytes(viewer *v, size_t offset, size_t *avail);
+
+
+// first place the len bytes of text are at in the n bytes at p. 16 places are tried at a time by comparing
+// the bytes there and len - 1 further on with the first and last byte of text, only where both agree is the
+// rest compared. Log lines repeat their prefixes all the time, memmem slows down a lot on them
+static const char *viewer_search(const char *p, size_t n, const char *text, size_t len) {
+    if (len == 0 || len > n) return NULL;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(text[0]), last = _mm_set1_epi8(text[len - 1]);
+    for (; i + 16 <= n - len + 1; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + len - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                                          _mm_cmpeq_epi8(b, last)));
+        for (; mask; mask &= mask - 1) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + at, text, len) == 0) return p + at;
+        }
+    }
+#endif
+    return memmem(p + i, n - i, text, len);
+}
+
+
+// looks on from find_at until the frame budget is used up. A block ends far enough back that a match across
+// it and the next one is still found, at the end of a span the two sides of it are put together in joint
+static void viewer_find_step(viewer *v, Uint32 start) {
+    char joint[2 * VIEW_FIND_MAX];
+    size_t len = v->find_len;
+    do {
+        size_t avail;
+        const char *p = viewer_bytes(v, v->find_at, &avail);
+        if (!p) {   // at the end of what is indexed, the pass may still bring more
+            if (v->indexing != 1) v->finding = -1;
+            return;
+        }
+        size_t n = avail < VIEW_FIND_BLOCK ? avail : VIEW_FIND_BLOCK;
+        const char *hit = viewer_search(p, n, v->find, len);
+        if (hit) {
+            v->top = v->find_line + viewer_newlines(p, (size_t)(hit - p));
+            v->finding = 0;
+            return;
+        }
+        if (n < avail || (v->find_at + n == v->length && v->indexing == 1)) {
+            size_t step = n >= len ? n - (len - 1) : 0;
+            if (step == 0) return;   // waits for the pass
+            v->find_line += viewer_newlines(p, step);
+            v->find_at += step;
+            continue;
+        }
+        size_t k = len - 1 < n ? len - 1 : n;
+        memcpy(joint, p + n - k, k);
+        v->find_line += viewer_newlines(p, n - k);
+        const char *next = viewer_bytes(v, v->find_at + n, &avail);
+        size_t m = next ? (avail < len - 1 ? avail : len - 1) : 0;
+        if (next) memcpy(joint + k, next, m);
+        hit = viewer_search(joint, k + m, v->find, len);
+        if (hit) {
+            v->top = v->find_line + viewer_newlines(joint, (size_t)(hit - joint));
+            v->finding = 0;
+            return;
+        }
+        v->find_line += viewer_newlines(joint, k);
+        v->find_at += n;
+    } while (SDL_GetTicks() - start < VIEW_BUDGET_MS);
+}
+
+
+// starts looking for text from the start of line on, viewer_step goes on with it a frame at a time and puts
+// the first line with a match on top
+void viewer_find(viewer *v, const char *text, size_t line) {
+    size_t len = strlen(text);
+    if (len > VIEW_FIND_MAX) len = VIEW_FIND_MAX;
+    memmove(v->find, text, len);   // text may be find itself, to search again
+    v->find[len] = '\0';
+    v->find_len = len;
+    v->finding = -1;
+    if (len == 0 || line >= v->line_count) return;
+    char c;
+    viewer_line(v, line, &c, 1);
+    if (v->at_line != line) return;
+    v->find_at = v->at_offset;
+    v->find_line = line;
+    v->finding = 1;
+}
+
+
+// the pass over a mapped file: counts the lines of one span and gives its pages back, the view reads them
+// again only if it gets there
+static void viewer_step_map(viewer *v) {
+    size_t n = (size_t)v->size - v->length;
+    if (n > VIEW_SPAN) n = VIEW_SPAN;
+    char *from = v->map + v->length;
+    if (n == VIEW_SPAN && v->length + n < (size_t)v->size) {   // the next span is read while this one is counted
+        size_t ahead = (size_t)v->size - v->length - n;
+        madvise(from + n, ahead < VIEW_SPAN ? ahead : VIEW_SPAN, MADV_WILLNEED);
+    }
+    if (viewer_count_lines(v, (const unsigned char *)from, n) != 0) {
+        v->indexing = -1;
+        return;
+    }
+    madvise(from, n, MADV_DONTNEED);
+    v->length += n;
+    v->read_at = (off_t)v->length;
+    if (v->length < (size_t)v->size) return;
+    v->indexing = 0;
+    struct stat st;   // a file that changed while it was counted is counted again next time
+    if (v->size >= LINEINDEX_MIN_SIZE && fstat(v->fd, &st) == 0 && st.st_size == v->st.st_size &&
+        st.st_mtim.tv_sec == v->st.st_mtim.tv_sec && st.st_mtim.tv_nsec == v->st.st_mtim.tv_nsec) {
+        lineindex_save(v->path, &v->st, VIEW_LINE_STEP, v->lines, v->line_marks, v->line_count);
+    }
+}
+
+
+// runs the indexing pass and a search for a frame's worth of time: 1 while there is more to index, 0 once
+// the whole file is, -1 on error. What was indexed can already be viewed and searched
+int viewer_step(viewer *v) {
+    if (v->fd < 0) return v->indexing;
+    Uint32 start = SDL_GetTicks();
+    if (v->finding == 1) viewer_find_step(v, start);
+    if (v->indexing != 1) return v->indexing;
+    if (v->mapped) {
+        do {
+            viewer_step_map(v);
+        } while (v->indexing == 1 && SDL_GetTicks() - start < VIEW_BUDGET_MS);
+        return v->indexing;
+    }
+    z_stream *s = &v->strm;
+    do {
+        if (s->avail_in == 0) {
+            ssize_t n = pread(v->fd, v->in, VIEW_IN_BLOCK, v->read_at);
+            if (n <= 0) {   // cut off, everything before stays viewable
+                v->indexing = n < 0 ? -1 : 0;
+                return v->indexing;
+            }
+            v->read_at += n;
+            s->next_in = v->in;
+            s->avail_in = (uInt)n;
+        }
+        if (s->avail_out == 0) {
+            s->avail_out = VIEW_WINDOW;
+            s->next_out = v->window;
+        }
+        unsigned char *from = s->next_out;
+        int ret = inflate(s, Z_BLOCK);   // stops at every block boundary so points can go there
+        size_t made = (size_t)(s->next_out - from);
+        if (viewer_count_lines(v, from, made) != 0) ret = Z_MEM_ERROR;
+        v->length += made;
+        if (ret == Z_STREAM_END) {   // further gzip members are not looked at
+            v->indexing = 0;
+            return 0;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            v->indexing = -1;
+            return -1;
+        }
+        if ((s->data_type & 128) && !(s->data_type & 64) &&
+            (v->point_count == 0 ? 1 : v->length - v->points[v->point_count - 1].out > VIEW_SPAN)) {
+            if (viewer_add_point(v) != 0) {
+                v->indexing = -1;
+                return -1;
+            }
+        }
+    } while (SDL_GetTicks() - start < VIEW_BUDGET_MS);
+    return 1;
+}
+
+
+// inflates span k into data, from its access point to the next one or to what is indexed so far
+static int viewer_inflate(viewer *v, size_t k, char *data, size_t len) {
+    view_point *p = &v->points[k];
+    z_stream s;
+    memset(&s, 0, sizeof(s));
+    if (inflateInit2(&s, -15) != Z_OK) return -1;   // raw deflate, the header is long behind
+    off_t in = p->in;
+    unsigned char *block = malloc(VIEW_IN_BLOCK);
+    int ret = block ? Z_OK : Z_MEM_ERROR;
+    if (ret == Z_OK && p->bits) {
+        unsigned char byte;
+        if (pread(v->fd, &byte, 1, in - 1) != 1) ret = Z_DATA_ERROR;
+        else ret = inflatePrime(&s, p->bits, byte >> (8 - p->bits));
+    }
+    if (ret == Z_OK) ret = inflateSetDictionary(&s, p->window, VIEW_WINDOW);
+    s.next_out = (unsigned char *)data;
+    s.avail_out = (uInt)len;
+    while (ret == Z_OK && s.avail_out > 0) {
+        if (s.avail_in == 0) {
+            ssize_t n = pread(v->fd, block, VIEW_IN_BLOCK, in);
+            if (n <= 0) break;
+            in += n;
+            s.next_in = block;
+            s.avail_in = (uInt)n;
+        }
+        ret = inflate(&s, Z_NO_FLUSH);
+    }
+    inflateEnd(&s);
+    free(block);
+    return s.avail_out == 0 ? 0 : -1;
+}
+
+
+// bytes at offset and how many follow in the same span, NULL from limit on. A gzip file has no more than what
+// is indexed, a mapped file all of it
+static const char *viewer_bytes_before(viewer *v, size_t offset, size_t limit, size_t *avail) {
+    if (offset >= limit || (!v->mapped && v->point_count == 0)) return NULL;
+    size_t lo = 0, start, end;
+    if (v->mapped) {
+        start = offset - offset % VIEW_SPAN;
+        end = start + VIEW_SPAN < limit ? start + VIEW_SPAN : limit;
+    } else {
+        size_t hi = v->point_count;   // last point at or before offset
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (v->points[mid].out <= offset) lo = mid;
+            else hi = mid;
+        }
+        start = v->points[lo].out;
+        end = lo + 1 < v->point_count ? v->points[lo + 1].out : v->length;
+    }
+    view_span *span = NULL, *oldest = &v->cache[0];
+    for (int i = 0; i < VIEW_CACHE; ++i) {
+        view_span *c = &v->cache[i];
+        if (c->data && c->start == start && (v->mapped || offset < start + c->len)) span = c;
+        if (c->used < oldest->used) oldest = c;
+    }
+    if (!span && v->mapped) {   // its pages come in as they are touched, the ones of the span it replaces go
+        span = oldest;
+        if (span->data) madvise(span->data, span->len, MADV_DONTNEED);
+        span->data = v->map + start;
+        span->start = start;
+    } else if (!span) {   // the last span keeps growing while indexing, it is inflated again when needed
+        span = oldest;
+        free(span->data);
+        span->data = malloc(end - start);
+        if (!span->data || viewer_inflate(v, lo, span->data, end - start) != 0) {
+            free(span->data);
+            span->data = NULL;
+            return NULL;
+        }
+        span->start = start;
+        span->len = end - start;
+    }
+    if (v->mapped) span->len = end - start;   // the pass may have got further into it since
+    span->used = ++v->clock;
+    *avail = span->start + span->len - offset;
+    return span->data + (offset - span->start);
+}
+
+
+// bytes at offset in what is indexed, lines and searches never go past it
+static const char *viewer_bytes(viewer *v, size_t offset, size_t *avail) {
+    return viewer_bytes_before(v, offset, v->length, avail);
+}
+
+
+// bytes that can be read at any offset right away: all of a mapped file, as much of a gzip file as is indexed
+size_t viewer_readable(viewer *v) {
+    return v->mapped ? (size_t)v->size : v->length;
+}
+
+
+// copies up to len bytes at offset into out through the span cache, so only the cache stays in memory however
+// far it jumps. Returns the bytes copied, fewer at the end of what is readable
+size_t viewer_read(viewer *v, size_t offset, char *out, size_t len) {
+    size_t n = 0, avail;
+    const char *p;
+    while (n < len && (p = viewer_bytes_before(v, offset + n, viewer_readable(v), &avail)) != NULL) {
+        size_t take = avail < len - n ? avail : len - n;
+        memcpy(out + n, p, take);
+        n += take;
+    }
+    return n;
+}
+
+
+// remembers where line starts, the lines on screen are found again without a scan from their checkpoint
+static void viewer_remember(viewer *v, size_t line, size_t offset) {
+    v->start_line[line % VIEW_STARTS] = line;
+    v->start_offset[line % VIEW_STARTS] = offset;
+}
+
+
+// copies line into out like buffer_line, NUL terminated and cut at cap, and returns the bytes copied. Nothing
+// after the cut is looked at, a line as long as the whole file costs what cap bytes of it do. NUL bytes in it
+// are shown the same way too
+size_t viewer_line(viewer *v, size_t line, char *out, size_t cap) {
+    out[0] = '\0';
+    if (line >= v->line_count) return 0;
+    size_t mark = line / VIEW_LINE_STEP;
+    if (mark >= v->line_marks) mark = v->line_marks - 1;
+    size_t at = mark * VIEW_LINE_STEP, offset = v->lines[mark];
+    for (size_t k = line; k > at && line - k < VIEW_STARTS; --k) {   // the nearest line before it seen lately
+        if (v->start_line[k % VIEW_STARTS] == k) {
+            at = k;
+            offset = v->start_offset[k % VIEW_STARTS];
+            break;
+        }
+    }
+    size_t avail;
+    const char *p;
+    while (at < line && (p = viewer_bytes(v, offset, &avail)) != NULL) {
+        const char *nl = memchr(p, '\n', avail);
+        offset += nl ? (size_t)(nl - p) + 1 : avail;
+        if (nl) viewer_remember(v, ++at, offset);
+    }
+    if (at < line) return 0;
+    v->at_line = line;
+    v->at_offset = offset;
+    size_t n = 0;
+    int cut = 0, whole = 0;
+    while (!cut && !whole && (p = viewer_bytes(v, offset + n, &avail)) != NULL) {
+        size_t look = avail < cap - n ? avail : cap - n;   // one byte past what fits, to see the line end there
+        const char *nl = memchr(p, '\n', look);
+        cut = !nl && look == cap - n;   // a byte that is not the line end where none fits any more
+        size_t take = nl ? (size_t)(nl - p) : cut ? cap - 1 - n : avail;
+        whole = nl != NULL;
+        memcpy(out + n, p, take);
+        for (char *z = out + n; (z = memchr(z, '\0', n + take - (size_t)(z - out))) != NULL; ++z) *z = BUFFER_NUL_SHOWN;
+        n += take;
+        if (whole) viewer_remember(v, line + 1, offset + n + 1);
+    }
+    if (!cut && n > 0 && out[n - 1] == '\r') n--;   // the '\r' of a "\r\n" belongs to the line break
+    out[n] = '\0';
+    return n;
+}
+
+
+// permille of the file indexed
+int viewer_progress(viewer *v) {
+    if (v->size <= 0) return 1000;
+    return (int)((long long)v->read_at * 1000 / v->size);
+}
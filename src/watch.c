@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)   // a write that is complete, or a new file renamed in
+#define WATCH_FOLLOW_EVENTS (WATCH_EVENTS | IN_MODIFY)
+
+
+void watch_init(watcher *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->wd = -1;
+}
+
+
+void watch_free(watcher *w) {
+    if (w->fd >= 0) close(w->fd);
+    free(w->dir);
+    free(w->name);
+    watch_init(w);
+}
+
+
+// watches the file at path from now on, the file a symlink points at when it is one
+void watch_set(watcher *w, const char *path) {
+    if (!path) return;
+    char *real = realpath(path, NULL);
+    const char *file = real ? real : path;
+    const char *slash = strrchr(file, '/');
+    char *dir = slash ? strndup(file, slash == file ? 1 : (size_t)(slash - file)) : strdup(".");
+    char *name = strdup(slash ? slash + 1 : file);
+    free(real);
+    if (!dir || !name || (w->dir && strcmp(dir, w->dir) == 0 && strcmp(name, w->name) == 0)) {
+        free(dir);
+        free(name);
+        return;
+    }
+    if (w->fd < 0) w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->wd >= 0) inotify_rm_watch(w->fd, w->wd);
+    w->wd = w->fd >= 0 ? inotify_add_watch(w->fd, dir, w->follow ? WATCH_FOLLOW_EVENTS : WATCH_EVENTS) : -1;
+    if (w->wd < 0) perror("Could not watch file");
+    free(w->dir);
+    free(w->name);
+    w->dir = dir;
+    w->name = name;
+    w->changed = 0;
+}
+
+
+// follow mode on or off, the watch of the directory changes its mask in place
+void watch_follow(watcher *w, int on) {
+    w->follow = on;
+    if (w->wd >= 0) w->wd = inotify_add_watch(w->fd, w->dir, on ? WATCH_FOLLOW_EVENTS : WATCH_EVENTS);
+}
+
+
+// takes in the events that came since the last call, 1 when one of them was about the file
+int watch_poll(watcher *w) {
+    if (w->fd < 0) return 0;
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(w->fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            struct inotify_event *e = (struct inotify_event *)p;
+            if (e->mask & IN_Q_OVERFLOW) {
+                w->changed = 1;   // events were lost, one of them could have been ours
+            } else if (e->wd == w->wd && e->len > 0 && strcmp(e->name, w->name) == 0) {
+                w->changed = 1;
+            }
+            p += sizeof(struct inotify_event) + e->len;
+        }
+    }
+    return w->changed;
+}
+
+
+// bytes a and b have in common from the front, whole blocks are compared before single bytes
+static size_t same_front(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t step = n - i < WATCH_COMPARE_BLOCK ? n - i : WATCH_COMPARE_BLOCK;
+        if (memcmp(a + i, b + i, step) != 0) break;
+        i += step;
+    }
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+
+// the same from the back, a and b point right after the bytes compared
+static size_t same_back(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t step = n - i < WATCH_COMPARE_BLOCK ? n - i : WATCH_COMPARE_BLOCK;
+        if (memcmp(a - i - step, b - i - step, step) != 0) break;
+        i += step;
+    }
+    while (i < n && a[-(long)i - 1] == b[-(long)i - 1]) ++i;
+    return i;
+}
+
+
+// reads exactly n bytes at offset, a file cut short meanwhile is an error like any other
+static int watch_read(int fd, char *out, size_t n, size_t offset) {
+    while (n > 0) {
+        ssize_t got = pread(fd, out, n, (off_t)offset);
+        if (got <= 0) return -1;
+        out += got;
+        n -= (size_t)got;
+        offset += (size_t)got;
+    }
+    return 0;
+}
+
+
+// bytes the base holds from offset on that data has too, up to n
+static size_t base_front(const watch_job *job, size_t offset, const char *data, size_t n) {
+    size_t i = 0, pos = 0, same = 0;
+    while (i < job->count && pos + job->pieces[i].len <= offset) pos += job->pieces[i++].len;
+    for (; i < job->count && same < n; ++i) {
+        const piece *p = &job->pieces[i];
+        size_t inner = offset + same - pos;
+        size_t m = p->len - inner < n - same ? p->len - inner : n - same;
+        size_t run = same_front(job->chunks[p->chunk] + p->start + inner, data + same, m);
+        same += run;
+        pos += p->len;
+        if (run < m) break;
+    }
+    return same;
+}
+
+
+// the same from the back, end is where the bytes of the base stop and data_end where those of data do
+static size_t base_back(const watch_job *job, size_t end, const char *data_end, size_t n) {
+    size_t i = job->count, pos = 0, same = 0;
+    for (size_t k = 0; k < job->count; ++k) pos += job->pieces[k].len;
+    while (i > 0 && pos - job->pieces[i - 1].len >= end) pos -= job->pieces[--i].len;
+    for (; i > 0 && same < n; --i) {
+        const piece *p = &job->pieces[i - 1];
+        size_t inner = pos - (end - same);   // bytes of p after the ones compared next
+        size_t m = p->len - inner < n - same ? p->len - inner : n - same;
+        size_t run = same_back(job->chunks[p->chunk] + p->start + p->len - inner, data_end - same, m);
+        same += run;
+        pos -= p->len;
+        if (run < m) break;
+    }
+    return same;
+}
+
+
+// whole blocks the file and the base have in common from the front, each read and hashed once. Their
+// hashes go into front. Returns how many bytes that is, or -1
+static long long watch_front(watch_job *job, char *block, size_t limit, journal_blocks *front) {
+    int known = job->old.count > 0;
+    size_t pos = 0;
+    for (size_t i = 0; !SDL_AtomicGet(&job->stop); ++i) {
+        size_t n = known ? (i < job->old.count ? job->old.blocks[i].len : 0) : JOURNAL_HASH_BLOCK;
+        if (n == 0 || n > limit - pos) break;
+        if (watch_read(job->fd, block, n, pos) != 0) return -1;
+        uint64_t hash = journal_hash_update(JOURNAL_HASH_SEED, block, n);
+        int same = known ? hash == job->old.blocks[i].hash : base_front(job, pos, block, n) == n;
+        if (!same || journal_blocks_add(front, n, hash) != 0) break;
+        pos += n;
+    }
+    return SDL_AtomicGet(&job->stop) ? -1 : (long long)pos;
+}
+
+
+// the same from the back, the hashes go into back last block first
+static long long watch_back(watch_job *job, char *block, size_t limit, size_t old_len, journal_blocks *back) {
+    int known = job->old.count > 0;
+    size_t len = (size_t)job->st.st_size, pos = 0;
+    for (size_t i = 0; !SDL_AtomicGet(&job->stop); ++i) {
+        size_t k = job->old.count - 1 - i;
+        size_t n = known ? (i < job->old.count ? job->old.blocks[k].len : 0) : JOURNAL_HASH_BLOCK;
+        if (n == 0 || n > limit - pos) break;
+        if (watch_read(job->fd, block, n, len - pos - n) != 0) return -1;
+        uint64_t hash = journal_hash_update(JOURNAL_HASH_SEED, block, n);
+        int same = known ? hash == job->old.blocks[k].hash : base_back(job, old_len - pos, block + n, n) == n;
+        if (!same) break;
+        if (back->count == back->cap) {
+            size_t cap = back->cap ? back->cap * 2 : 64;
+            journal_block *blocks = realloc(back->blocks, cap * sizeof(journal_block));
+            if (!blocks) break;
+            back->blocks = blocks;
+            back->cap = cap;
+        }
+        back->blocks[back->count].len = n;
+        back->blocks[back->count++].hash = hash;
+        back->len += n;
+        pos += n;
+    }
+    return SDL_AtomicGet(&job->stop) ? -1 : (long long)pos;
+}
+
+
+// the range the file changed in against the base. Whole blocks are compared from both ends by their hash,
+// the base keeps those of its file, then the span between them is read and compared byte by byte to find
+// the first and last difference. The file is only read, never mapped, a writer cutting it short meanwhile
+// makes this fail instead of faulting
+static int watch_compare(watch_job *job) {
+    size_t len = (size_t)job->st.st_size, old_len = 0;
+    for (size_t i = 0; i < job->count; ++i) old_len += job->pieces[i].len;
+    if (job->old.len != old_len) journal_blocks_free(&job->old);
+    char *block = malloc(JOURNAL_HASH_BLOCK);
+    journal_blocks back;
+    memset(&back, 0, sizeof(back));
+    size_t limit = old_len < len ? old_len : len;   // the two ends must not overlap
+    long long front_blocks = block ? watch_front(job, block, limit, &job->blocks) : -1;
+    long long back_blocks = front_blocks >= 0 ? watch_back(job, block, limit - (size_t)front_blocks, old_len, &back)
+                                              : -1;
+    free(block);
+    size_t from = (size_t)front_blocks, span = len - from - (size_t)back_blocks;
+    char *data = back_blocks >= 0 ? malloc(span ? span : 1) : NULL;
+    if (!data || watch_read(job->fd, data, span, from) != 0) {
+        free(data);
+        journal_blocks_free(&back);
+        return -1;
+    }
+
+    // the exact ends inside the span, and the hashes of the whole file
+    size_t old_span = old_len - from - (size_t)back_blocks;
+    size_t shorter = span < old_span ? span : old_span;
+    size_t front = base_front(job, from, data, shorter);
+    size_t tail = base_back(job, old_len - (size_t)back_blocks, data + span, shorter - front);
+    int ok = journal_blocks_hash(&job->blocks, data, span) == 0;
+    for (size_t i = back.count; ok && i-- > 0;) {
+        ok = journal_blocks_add(&job->blocks, back.blocks[i].len, back.blocks[i].hash) == 0;
+    }
+    journal_blocks_free(&back);
+    if (!ok) {
+        free(data);
+        return -1;
+    }
+    job->change.offset = from + front;
+    job->change.old_len = old_span - front - tail;
+    job->change.new_len = span - front - tail;
+    memmove(data, data + front, job->change.new_len);
+    job->mid = data;
+    return 0;
+}
+
+
+static int watch_thread(void *data) {
+    watch_job *job = data;
+    SDL_AtomicSet(&job->state, watch_compare(job) == 0 ? 0 : -1);
+    return 0;
+}
+
+
+// starts comparing the file open at fd, whose stat is st, against the base of buf. The job owns fd, NULL when
+// it could not start
+watch_job *watch_start(const save_base *b, textbuffer *buf, int fd, const struct stat *st) {
+    watch_job *job = calloc(1, sizeof(watch_job));
+    if (!job) {
+        close(fd);
+        return NULL;
+    }
+    job->fd = fd;
+    job->st = *st;
+    job->base_st = b->st;
+    job->pieces = malloc((b->count ? b->count : 1) * sizeof(piece));
+    job->chunks = malloc((buf->chunk_count ? (size_t)buf->chunk_count : 1) * sizeof(char *));
+    job->old.blocks = b->blocks.count ? malloc(b->blocks.count * sizeof(journal_block)) : NULL;
+    if (!job->pieces || !job->chunks || (b->blocks.count && !job->old.blocks)) {
+        watch_job_free(job);
+        return NULL;
+    }
+    if (b->count) memcpy(job->pieces, b->pieces, b->count * sizeof(piece));
+    job->count = b->count;
+    for (int i = 0; i < buf->chunk_count; ++i) job->chunks[i] = buf->chunks[i].data;
+    if (b->blocks.count) memcpy(job->old.blocks, b->blocks.blocks, b->blocks.count * sizeof(journal_block));
+    job->old.count = job->old.cap = b->blocks.count;
+    job->old.len = b->blocks.len;
+    SDL_AtomicSet(&job->state, 1);
+    job->thread = SDL_CreateThread(watch_thread, "watch", job);
+    if (!job->thread) {
+        watch_job_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+
+// 1 while the thread still compares, then what it came to: 0 with change, mid and blocks filled in, or -1
+int watch_step(watch_job *job) {
+    int state = SDL_AtomicGet(&job->state);
+    if (state != 1 && job->thread) {
+        SDL_WaitThread(job->thread, NULL);
+        job->thread = NULL;
+    }
+    return state;
+}
+
+
+// stops the thread if it still runs and frees the job
+void watch_job_free(watch_job *job) {
+    if (!job) return;
+    SDL_AtomicSet(&job->stop, 1);
+    if (job->thread) SDL_WaitThread(job->thread, NULL);
+    if (job->fd >= 0) close(job->fd);
+    free(job->pieces);
+    free(job->chunks);
+    free(job->mid);
+    journal_blocks_free(&job->old);
+    journal_blocks_free(&job->blocks);
+    free(job);
+}
+
+
+// the whole new file as pieces: what the base had before and after the change, mid in between
+piece *watch_pieces(const save_base *b, textbuffer *buf, const watch_change *c, const piece *mid, size_t *n) {
+    piece *out = malloc((b->count + 2) * sizeof(piece));
+    if (!out) return NULL;
+    size_t count = 0, pos = 0, end = c->offset + c->old_len;
+    int mid_done = 0;
+    for (size_t i = 0; i < b->count; ++i) {
+        const piece *p = &b->pieces[i];
+        if (pos < c->offset) {   // part before the change
+            size_t keep = c->offset - pos < p->len ? c->offset - pos : p->len;
+            out[count++] = buffer_chunk_piece(buf, p->chunk, p->start, keep);
+        }
+        if (!mid_done && pos + p->len >= c->offset) {
+            if (mid->len > 0) out[count++] = *mid;
+            mid_done = 1;
+        }
+        if (pos + p->len > end) {   // part after it
+            size_t skip = end > pos ? end - pos : 0;
+            out[count++] = buffer_chunk_piece(buf, p->chunk, p->start + skip, p->len - skip);
+        }
+        pos += p->len;
+    }
+    if (!mid_done && mid->len > 0) out[count++] = *mid;
+    *n = count;
+    return out;
+}